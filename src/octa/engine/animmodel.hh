@@ -1436,12 +1436,23 @@ struct animmodel : model
         if(bih) loopv(parts) parts[i]->preloadBIH();
     }
 
+    // identifies the source of a cached BIH: the mesh files plus the collision settings they were loaded with
+    uint bihkey()
+    {
+        uint key = crc32(0, Z_NULL, 0);
+        loopv(parts) if(parts[i]->meshes && parts[i]->meshes->name) key = hashbihfile(parts[i]->meshes->name, key);
+        key = crc32(key, (const Bytef *)&collide, sizeof(collide));
+        if(collidemodel) key = crc32(key, (const Bytef *)collidemodel, strlen(collidemodel));
+        key = crc32(key, (const Bytef *)&scale, sizeof(scale));
+        return key;
+    }
+
     BIH *setBIH()
     {
         if(bih) return bih;
         vector<BIH::mesh> meshes;
         genBIH(meshes);
-        bih = new BIH(meshes);
+        bih = new BIH(meshes, name, bihkey());
         return bih;
     }
 
@@ -1,5 +1,13 @@
 #include "engine.hh"
 
+#ifndef WIN32
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 extern vec hitsurface;
 
 bool BIH::triintersect(const mesh &m, int tidx, const vec &mo, const vec &mray, float maxdist, float &dist, int mode)
@@ -112,6 +120,81 @@ inline bool BIH::traverse(const mesh &m, const vec &o, const vec &ray, const vec
     }
 }
 
+struct qtraversestate
+{
+    int node;
+    float tmin;
+};
+
+// unlike the binary walk this finds the nearest hit, children are visited front to back and every
+// triangle hit shrinks the ray so farther children drop out of the box tests
+bool BIH::traversequad(const mesh &m, const vec &o, const vec &ray, const vec &invray, float maxdist, float &dist, int mode, int curnode, float tmin, float tmax)
+{
+    qtraversestate stack[128];
+    int stacksize = 0;
+    vec mo = m.invxform.transform(o), mray = m.invxformnorm.transform(ray);
+    floatlanes ox(o.x), oy(o.y), oz(o.z), ix(invray.x), iy(invray.y), iz(invray.z);
+    bool hit = false;
+    for(;;)
+    {
+        const qnode &q = m.qnodes[curnode];
+        floatlanes x1 = (floatlanes(q.bbmin[0]) - ox)*ix, x2 = (floatlanes(q.bbmax[0]) - ox)*ix,
+                   y1 = (floatlanes(q.bbmin[1]) - oy)*iy, y2 = (floatlanes(q.bbmax[1]) - oy)*iy,
+                   z1 = (floatlanes(q.bbmin[2]) - oz)*iz, z2 = (floatlanes(q.bbmax[2]) - oz)*iz,
+                   enter = x1.min(x2).max(y1.min(y2)).max(z1.min(z2)).max(floatlanes(tmin)),
+                   exit = x1.max(x2).min(y1.max(y2)).min(z1.max(z2)).min(floatlanes(tmax));
+        int lanes = enter.le(exit);
+        float tnear[4];
+        enter.store(tnear);
+        int order[4], numhits = 0;
+        loopk(4) if(lanes&(1<<k))
+        {
+            int i = numhits++;
+            for(; i > 0 && tnear[order[i-1]] > tnear[k]; i--) order[i] = order[i-1];
+            order[i] = k;
+        }
+        loopi(numhits)
+        {
+            int k = order[i];
+            if(!q.isleaf(k) || tnear[k] >= tmax) continue;
+            if(triintersect(m, q.triindex(k), mo, mray, maxdist, dist, mode))
+            {
+                if(mode&RAY_SHADOW) return true;
+                hit = true;
+                maxdist = tmax = dist;
+            }
+        }
+        for(int i = numhits-1; i >= 0; i--)
+        {
+            int k = order[i];
+            if(q.isleaf(k) || tnear[k] >= tmax) continue;
+            if(stacksize < int(sizeof(stack)/sizeof(stack[0])))
+            {
+                qtraversestate &save = stack[stacksize++];
+                save.node = q.child[k];
+                save.tmin = tnear[k];
+            }
+            else if(traversequad(m, o, ray, invray, maxdist, dist, mode, q.child[k], tnear[k], tmax))
+            {
+                if(mode&RAY_SHADOW) return true;
+                hit = true;
+                maxdist = tmax = dist;
+            }
+        }
+        for(;;)
+        {
+            if(stacksize <= 0) return hit;
+            qtraversestate &restore = stack[--stacksize];
+            if(restore.tmin >= tmax) continue;
+            curnode = restore.node;
+            tmin = restore.tmin;
+            break;
+        }
+    }
+}
+
+VAR(bihquad, 0, 1, 1);
+
 inline bool BIH::traverse(const vec &o, const vec &ray, float maxdist, float &dist, int mode)
 {
     vec invray(ray.x ? 1/ray.x : 1e16f, ray.y ? 1/ray.y : 1e16f, ray.z ? 1/ray.z : 1e16f);
@@ -130,16 +213,111 @@ inline bool BIH::traverse(const vec &o, const vec &ray, float maxdist, float &di
         t2 = (m.bbmax.z - o.z)*invray.z;
         if(invray.z > 0) { tmin = max(tmin, t1); tmax = min(tmax, t2); } else { tmin = max(tmin, t2); tmax = min(tmax, t1); }
         tmax = min(tmax, maxdist);
-        if(tmin < tmax && traverse(m, o, ray, invray, maxdist, dist, mode, m.nodes, tmin, tmax)) return true;
+        if(tmin >= tmax) continue;
+        if(m.qnodes && bihquad)
+        {
+            if(traversequad(m, o, ray, invray, maxdist, dist, mode, 0, tmin, tmax)) return true;
+        }
+        else if(traverse(m, o, ray, invray, maxdist, dist, mode, m.nodes, tmin, tmax)) return true;
     }
     return false;
 }
 
+VAR(bihsah, 0, 1, 1);
+
+#define SAHBINS 16
+
+static inline float sahboxarea(const ivec &bmin, const ivec &bmax)
+{
+    float dx = bmax.x - bmin.x, dy = bmax.y - bmin.y, dz = bmax.z - bmin.z;
+    return dx*dy + dy*dz + dz*dx;
+}
+
+static inline int sahbinindex(int c, int cmin, int extent)
+{
+    return min((c - cmin)*SAHBINS/extent, SAHBINS-1);
+}
+
+// bins the triangle centers along each axis and picks the bin boundary with the lowest surface area cost
+static bool findsahsplit(const BIH::tribb *tribbs, const ushort *indices, int numindices, int &bestaxis, int &bestmin, int &bestextent, int &bestbin)
+{
+    ivec cmin(INT_MAX, INT_MAX, INT_MAX), cmax(INT_MIN, INT_MIN, INT_MIN);
+    loopi(numindices)
+    {
+        ivec c(tribbs[indices[i]].center);
+        cmin.min(c);
+        cmax.max(c);
+    }
+    float bestcost = 1e30f;
+    bestaxis = -1;
+    loopk(3)
+    {
+        int extent = cmax[k] - cmin[k] + 1;
+        if(extent <= 1) continue;
+        int counts[SAHBINS];
+        ivec binmin[SAHBINS], binmax[SAHBINS];
+        loopi(SAHBINS)
+        {
+            counts[i] = 0;
+            binmin[i] = ivec(INT_MAX, INT_MAX, INT_MAX);
+            binmax[i] = ivec(INT_MIN, INT_MIN, INT_MIN);
+        }
+        loopi(numindices)
+        {
+            const BIH::tribb &tri = tribbs[indices[i]];
+            int b = sahbinindex(tri.center[k], cmin[k], extent);
+            counts[b]++;
+            binmin[b].min(ivec(tri.center).sub(ivec(tri.radius)));
+            binmax[b].max(ivec(tri.center).add(ivec(tri.radius)));
+        }
+        int rightcounts[SAHBINS], count = 0;
+        float rightareas[SAHBINS];
+        ivec bmin(INT_MAX, INT_MAX, INT_MAX), bmax(INT_MIN, INT_MIN, INT_MIN);
+        for(int b = SAHBINS-1; b > 0; b--)
+        {
+            if(counts[b])
+            {
+                count += counts[b];
+                bmin.min(binmin[b]);
+                bmax.max(binmax[b]);
+            }
+            rightcounts[b] = count;
+            rightareas[b] = count ? sahboxarea(bmin, bmax) : 0;
+        }
+        count = 0;
+        bmin = ivec(INT_MAX, INT_MAX, INT_MAX);
+        bmax = ivec(INT_MIN, INT_MIN, INT_MIN);
+        for(int b = 1; b < SAHBINS; b++)
+        {
+            if(counts[b-1])
+            {
+                count += counts[b-1];
+                bmin.min(binmin[b-1]);
+                bmax.max(binmax[b-1]);
+            }
+            if(!count || !rightcounts[b]) continue;
+            float cost = count*sahboxarea(bmin, bmax) + rightcounts[b]*rightareas[b];
+            if(cost < bestcost)
+            {
+                bestcost = cost;
+                bestaxis = k;
+                bestmin = cmin[k];
+                bestextent = extent;
+                bestbin = b;
+            }
+        }
+    }
+    return bestaxis >= 0;
+}
+
 void BIH::build(mesh &m, ushort *indices, int numindices, const ivec &vmin, const ivec &vmax)
 {
     int axis = 2;
     loopk(2) if(vmax[k] - vmin[k] > vmax[axis] - vmin[axis]) axis = k;
 
+    int sahaxis = -1, sahmin = 0, sahextent = 1, sahbin = 0;
+    if(bihsah && numindices > 2 && findsahsplit(m.tribbs, indices, numindices, sahaxis, sahmin, sahextent, sahbin)) axis = sahaxis;
+
     ivec leftmin, leftmax, rightmin, rightmax;
     int splitleft, splitright;
     int left, right;
@@ -154,7 +332,7 @@ void BIH::build(mesh &m, ushort *indices, int numindices, const ivec &vmin, cons
             ivec trimin = ivec(tri.center).sub(ivec(tri.radius)),
                  trimax = ivec(tri.center).add(ivec(tri.radius));
             int amin = trimin[axis], amax = trimax[axis];
-            if(max(split - amin, 0) > max(amax - split, 0))
+            if(sahaxis >= 0 ? sahbinindex(tri.center[axis], sahmin, sahextent) < sahbin : max(split - amin, 0) > max(amax - split, 0))
             {
                 ++left;
                 splitleft = max(splitleft, amax);
@@ -171,6 +349,7 @@ void BIH::build(mesh &m, ushort *indices, int numindices, const ivec &vmin, cons
             }
         }
         if(left > 0 && right < numindices) break;
+        sahaxis = -1;
         axis = (axis+1)%3;
     }
 
@@ -221,8 +400,236 @@ void BIH::build(mesh &m, ushort *indices, int numindices, const ivec &vmin, cons
     }
 }
 
-BIH::BIH(vector<mesh> &buildmeshes)
-  : meshes(NULL), nummeshes(0), nodes(NULL), numnodes(0), tribbs(NULL), numtris(0), bbmin(1e16f, 1e16f, 1e16f), bbmax(-1e16f, -1e16f, -1e16f), center(0, 0, 0), radius(0), entradius(0)
+// fills in the bounds of both children of every node below idx, 4 ivecs per node
+void BIH::calcbounds(const mesh &m, int idx, ivec *bounds)
+{
+    const node &n = m.nodes[idx];
+    loopk(2)
+    {
+        ivec &bmin = bounds[4*idx + 2*k], &bmax = bounds[4*idx + 2*k + 1];
+        if(n.isleaf(k))
+        {
+            const tribb &tri = m.tribbs[n.childindex(k)];
+            bmin = ivec(tri.center).sub(ivec(tri.radius));
+            bmax = ivec(tri.center).add(ivec(tri.radius));
+        }
+        else
+        {
+            int c = idx + n.childindex(k);
+            calcbounds(m, c, bounds);
+            bmin = ivec(bounds[4*c]).min(bounds[4*c + 2]);
+            bmax = ivec(bounds[4*c + 1]).max(bounds[4*c + 3]);
+        }
+    }
+}
+
+// pulls up to four descendants of a binary node into one wide node, always opening the largest interior child
+int BIH::collapse(mesh &m, int idx, const ivec *bounds)
+{
+    int entries[4][2] = { { idx, 0 }, { idx, 1 } }, numentries = 2;
+    while(numentries < 4)
+    {
+        int best = -1;
+        float bestarea = -1;
+        loopi(numentries)
+        {
+            int n = entries[i][0], which = entries[i][1];
+            if(m.nodes[n].isleaf(which)) continue;
+            float area = sahboxarea(bounds[4*n + 2*which], bounds[4*n + 2*which + 1]);
+            if(area > bestarea) { best = i; bestarea = area; }
+        }
+        if(best < 0) break;
+        int c = entries[best][0] + m.nodes[entries[best][0]].childindex(entries[best][1]);
+        entries[best][0] = c;
+        entries[best][1] = 0;
+        entries[numentries][0] = c;
+        entries[numentries][1] = 1;
+        numentries++;
+    }
+
+    int offset = m.numqnodes++;
+    qnode &q = m.qnodes[offset];
+    loopi(4)
+    {
+        if(i >= numentries)
+        {
+            // a point far outside the world, so neither the slab nor the overlap tests can ever hit it
+            loopk(3) { q.bbmin[k][i] = q.bbmax[k][i] = 1e16f; }
+            q.child[i] = ~0;
+            continue;
+        }
+        int n = entries[i][0], which = entries[i][1];
+        const ivec &bmin = bounds[4*n + 2*which], &bmax = bounds[4*n + 2*which + 1];
+        loopk(3) { q.bbmin[k][i] = bmin[k]; q.bbmax[k][i] = bmax[k]; }
+        if(m.nodes[n].isleaf(which)) q.child[i] = ~m.nodes[n].childindex(which);
+        else q.child[i] = collapse(m, n + m.nodes[n].childindex(which), bounds);
+    }
+    return offset;
+}
+
+VARP(bihcache, 0, 1, 1);
+
+#define BIHCACHEVERSION 1
+
+struct bihcacheheader
+{
+    char magic[4];
+    int version;
+    uint key;
+    int nummeshes, numnodes, numqnodes, numtris;
+};
+
+struct bihcachemesh
+{
+    int numnodes, numqnodes, numtris;
+    vec bbmin, bbmax;
+};
+
+uint hashbihfile(const char *filename, uint key)
+{
+    stream *f = openfile(filename, "rb");
+    if(!f) return key;
+    uchar buf[4096];
+    for(;;)
+    {
+        size_t len = f->read(buf, sizeof(buf));
+        if(!len) break;
+        key = crc32(key, buf, len);
+    }
+    delete f;
+    return key;
+}
+
+// the model files alone don't say how they were placed, so fold in everything genBIH produced for them
+uint BIH::meshkey(uint key) const
+{
+    loopi(nummeshes)
+    {
+        const mesh &m = meshes[i];
+        key = crc32(key, (const Bytef *)&m.xform, sizeof(m.xform));
+        key = crc32(key, (const Bytef *)&m.numtris, sizeof(m.numtris));
+        key = crc32(key, (const Bytef *)m.tris, m.numtris*sizeof(tri));
+    }
+    return key;
+}
+
+static inline size_t bihcachesize(int nummeshes, int numnodes, int numqnodes, int numtris)
+{
+    return sizeof(bihcacheheader) + nummeshes*sizeof(bihcachemesh) + numqnodes*sizeof(BIH::qnode) + numnodes*sizeof(BIH::node) + numtris*sizeof(BIH::tribb);
+}
+
+bool BIH::loadcache(const char *cachename, uint key)
+{
+    if(!homedir[0]) return false;
+    defformatstring(name, "%scache/bih/%s.bih", homedir, cachename);
+    path(name);
+#ifdef WIN32
+    size_t size = 0;
+    uchar *data = (uchar *)loadfile(name, &size, false);
+    if(!data) return false;
+#else
+    int fd = open(name, O_RDONLY);
+    if(fd < 0) return false;
+    struct stat st;
+    if(fstat(fd, &st) < 0 || size_t(st.st_size) < sizeof(bihcacheheader)) { close(fd); return false; }
+    size_t size = st.st_size;
+    uchar *data = (uchar *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(data == (uchar *)MAP_FAILED) return false;
+#endif
+    cachedata = data;
+    cachesize = size;
+
+    const bihcacheheader &hdr = *(const bihcacheheader *)data;
+    if(size < sizeof(bihcacheheader) || memcmp(hdr.magic, "BIHC", 4) || hdr.version != BIHCACHEVERSION || hdr.key != key ||
+       hdr.nummeshes != nummeshes || hdr.numtris != numtris ||
+       size != bihcachesize(hdr.nummeshes, hdr.numnodes, hdr.numqnodes, hdr.numtris))
+        goto invalid;
+    {
+        const bihcachemesh *cmeshes = (const bihcachemesh *)(data + sizeof(bihcacheheader));
+        qnodes = (qnode *)(cmeshes + nummeshes);
+        nodes = (node *)(qnodes + hdr.numqnodes);
+        tribbs = (tribb *)(nodes + hdr.numnodes);
+        numnodes = hdr.numnodes;
+        numqnodes = hdr.numqnodes;
+        node *curnode = nodes;
+        qnode *curqnode = qnodes;
+        tribb *curtri = tribbs;
+        loopi(nummeshes)
+        {
+            mesh &m = meshes[i];
+            const bihcachemesh &cm = cmeshes[i];
+            if(cm.numtris != m.numtris || curnode + cm.numnodes > nodes + numnodes || curqnode + cm.numqnodes > qnodes + numqnodes) goto invalid;
+            m.nodes = curnode;
+            m.numnodes = cm.numnodes;
+            m.qnodes = cm.numqnodes ? curqnode : NULL;
+            m.numqnodes = cm.numqnodes;
+            m.tribbs = curtri;
+            m.bbmin = cm.bbmin;
+            m.bbmax = cm.bbmax;
+            bbmin.min(m.bbmin);
+            bbmax.max(m.bbmax);
+            curnode += cm.numnodes;
+            curqnode += cm.numqnodes;
+            curtri += cm.numtris;
+        }
+    }
+    center = vec(bbmin).add(bbmax).mul(0.5f);
+    radius = vec(bbmax).sub(bbmin).mul(0.5f).magnitude();
+    entradius = max(bbmin.squaredlen(), bbmax.squaredlen());
+    return true;
+
+invalid:
+#ifdef WIN32
+    delete[] data;
+#else
+    munmap(data, size);
+#endif
+    cachedata = NULL;
+    cachesize = 0;
+    nodes = NULL;
+    qnodes = NULL;
+    tribbs = NULL;
+    numnodes = numqnodes = 0;
+    bbmin = vec(1e16f, 1e16f, 1e16f);
+    bbmax = vec(-1e16f, -1e16f, -1e16f);
+    return false;
+}
+
+void BIH::savecache(const char *cachename, uint key) const
+{
+    if(!homedir[0]) return;
+    defformatstring(name, "cache/bih/%s.bih", cachename);
+    stream *f = openrawfile(path(name), "wb");
+    if(!f) { conoutf(CON_WARN, "could not write BIH cache %s", name); return; }
+    bihcacheheader hdr;
+    memcpy(hdr.magic, "BIHC", 4);
+    hdr.version = BIHCACHEVERSION;
+    hdr.key = key;
+    hdr.nummeshes = nummeshes;
+    hdr.numnodes = numnodes;
+    hdr.numqnodes = numqnodes;
+    hdr.numtris = numtris;
+    f->write(&hdr, sizeof(hdr));
+    loopi(nummeshes)
+    {
+        const mesh &m = meshes[i];
+        bihcachemesh cm;
+        cm.numnodes = m.numnodes;
+        cm.numqnodes = m.qnodes ? m.numqnodes : 0;
+        cm.numtris = m.numtris;
+        cm.bbmin = m.bbmin;
+        cm.bbmax = m.bbmax;
+        f->write(&cm, sizeof(cm));
+    }
+    f->write(qnodes, numqnodes*sizeof(qnode));
+    f->write(nodes, numnodes*sizeof(node));
+    f->write(tribbs, numtris*sizeof(tribb));
+    delete f;
+}
+
+BIH::BIH(vector<mesh> &buildmeshes, const char *cachename, uint cachekey)
+  : meshes(NULL), nummeshes(0), nodes(NULL), numnodes(0), qnodes(NULL), numqnodes(0), tribbs(NULL), numtris(0), bbmin(1e16f, 1e16f, 1e16f), bbmax(-1e16f, -1e16f, -1e16f), center(0, 0, 0), radius(0), entradius(0), cachedata(NULL), cachesize(0)
 {
     if(buildmeshes.empty()) return;
     loopv(buildmeshes) numtris += buildmeshes[i].numtris;
@@ -231,8 +638,6 @@ BIH::BIH(vector<mesh> &buildmeshes)
     nummeshes = buildmeshes.length();
     meshes = new mesh[nummeshes];
     memcpy(meshes, buildmeshes.getbuf(), sizeof(mesh)*buildmeshes.length());
-    tribbs = new tribb[numtris];
-    tribb *dsttri = tribbs;
     loopi(nummeshes)
     {
         mesh &m = meshes[i];
@@ -243,6 +648,19 @@ BIH::BIH(vector<mesh> &buildmeshes)
         m.invxform.invert(m.xform);
         m.invxformnorm = matrix3(m.invxform);
         m.invxformnorm.normalize();
+    }
+
+    if(cachename && bihcache)
+    {
+        cachekey = meshkey(cachekey);
+        if(loadcache(cachename, cachekey)) return;
+    }
+
+    tribbs = new tribb[numtris];
+    tribb *dsttri = tribbs;
+    loopi(nummeshes)
+    {
+        mesh &m = meshes[i];
         m.tribbs = dsttri;
         const tri *srctri = m.tris;
         vec mmin(1e16f, 1e16f, 1e16f), mmax(-1e16f, -1e16f, -1e16f);
@@ -283,12 +701,40 @@ BIH::BIH(vector<mesh> &buildmeshes)
     }
     delete[] indices;
     numnodes = int(curnode - nodes);
+
+    // every wide node swallows at least one binary node, so numnodes of them is enough
+    qnodes = new qnode[max(numnodes, 1)];
+    qnode *curqnode = qnodes;
+    ivec *bounds = new ivec[4*max(numnodes, 1)];
+    loopi(nummeshes)
+    {
+        mesh &m = meshes[i];
+        if(m.numtris < 2) continue;
+        calcbounds(m, 0, bounds);
+        m.qnodes = curqnode;
+        collapse(m, 0, bounds);
+        curqnode += m.numqnodes;
+    }
+    delete[] bounds;
+    numqnodes = int(curqnode - qnodes);
+
+    if(cachename && bihcache) savecache(cachename, cachekey);
 }
 
 BIH::~BIH()
 {
     delete[] meshes;
+    if(cachedata)
+    {
+#ifdef WIN32
+        delete[] (char *)cachedata;
+#else
+        munmap(cachedata, cachesize);
+#endif
+        return;
+    }
     delete[] nodes;
+    delete[] qnodes;
     delete[] tribbs;
 }
 
@@ -605,6 +1051,28 @@ inline void BIH::collide(const mesh &m, physent *d, const vec &dir, float cutoff
     }
 }
 
+template<int C>
+void BIH::collidequad(const mesh &m, physent *d, const vec &dir, float cutoff, const vec &center, const vec &radius, const matrix4x3 &orient, float &dist, int curnode, const ivec &bo, const ivec &br)
+{
+    int stack[128];
+    int stacksize = 0;
+    floatlanes minx(bo.x - br.x), miny(bo.y - br.y), minz(bo.z - br.z), maxx(bo.x + br.x), maxy(bo.y + br.y), maxz(bo.z + br.z);
+    for(;;)
+    {
+        const qnode &q = m.qnodes[curnode];
+        int lanes = floatlanes(q.bbmin[0]).le(maxx) & minx.le(floatlanes(q.bbmax[0])) &
+                    floatlanes(q.bbmin[1]).le(maxy) & miny.le(floatlanes(q.bbmax[1])) &
+                    floatlanes(q.bbmin[2]).le(maxz) & minz.le(floatlanes(q.bbmax[2]));
+        loopk(4) if(lanes&(1<<k))
+        {
+            if(q.isleaf(k)) tricollide<C>(m, q.triindex(k), d, dir, cutoff, center, radius, orient, dist, bo, br);
+            else if(stacksize < int(sizeof(stack)/sizeof(stack[0]))) stack[stacksize++] = q.child[k];
+            else collidequad<C>(m, d, dir, cutoff, center, radius, orient, dist, q.child[k], bo, br);
+        }
+        if(stacksize <= 0) return;
+        curnode = stack[--stacksize];
+    }
+}
 
 bool BIH::ellipsecollide(physent *d, const vec &dir, float cutoff, const vec &o, int yaw, int pitch, int roll, float scale)
 {
@@ -637,7 +1105,8 @@ bool BIH::ellipsecollide(physent *d, const vec &dir, float cutoff, const vec &o,
         if(!(m.flags&MESH_COLLIDE) || m.flags&MESH_NOCLIP) continue;
         matrix4x3 morient;
         morient.mul(orient, m.xform);
-        collide<COLLIDE_ELLIPSE>(m, d, dir, cutoff, m.invxform.transform(bo), radius, morient, dist, m.nodes, icenter, iradius);
+        if(m.qnodes && bihquad) collidequad<COLLIDE_ELLIPSE>(m, d, dir, cutoff, m.invxform.transform(bo), radius, morient, dist, 0, icenter, iradius);
+        else collide<COLLIDE_ELLIPSE>(m, d, dir, cutoff, m.invxform.transform(bo), radius, morient, dist, m.nodes, icenter, iradius);
     }
     return dist > -1e9f;
 }
@@ -678,7 +1147,8 @@ bool BIH::boxcollide(physent *d, const vec &dir, float cutoff, const vec &o, int
         if(!(m.flags&MESH_COLLIDE) || m.flags&MESH_NOCLIP) continue;
         matrix4x3 morient;
         morient.mul(dorient, dcenter, m.xform);
-        collide<COLLIDE_OBB>(m, d, ddir, cutoff, center, radius, morient, dist, m.nodes, icenter, iradius);
+        if(m.qnodes && bihquad) collidequad<COLLIDE_OBB>(m, d, ddir, cutoff, center, radius, morient, dist, 0, icenter, iradius);
+        else collide<COLLIDE_OBB>(m, d, ddir, cutoff, center, radius, morient, dist, m.nodes, icenter, iradius);
     }
     if(dist > -1e9f)
     {
@@ -767,6 +1237,28 @@ void BIH::genstaintris(stainrenderer *s, const mesh &m, const vec &center, float
     }
 }
 
+void BIH::genstaintrisquad(stainrenderer *s, const mesh &m, const vec &center, float radius, const matrix4x3 &orient, int curnode, const ivec &bo, const ivec &br)
+{
+    int stack[128];
+    int stacksize = 0;
+    floatlanes minx(bo.x - br.x), miny(bo.y - br.y), minz(bo.z - br.z), maxx(bo.x + br.x), maxy(bo.y + br.y), maxz(bo.z + br.z);
+    for(;;)
+    {
+        const qnode &q = m.qnodes[curnode];
+        int lanes = floatlanes(q.bbmin[0]).le(maxx) & minx.le(floatlanes(q.bbmax[0])) &
+                    floatlanes(q.bbmin[1]).le(maxy) & miny.le(floatlanes(q.bbmax[1])) &
+                    floatlanes(q.bbmin[2]).le(maxz) & minz.le(floatlanes(q.bbmax[2]));
+        loopk(4) if(lanes&(1<<k))
+        {
+            if(q.isleaf(k)) genstaintris(s, m, q.triindex(k), center, radius, orient, bo, br);
+            else if(stacksize < int(sizeof(stack)/sizeof(stack[0]))) stack[stacksize++] = q.child[k];
+            else genstaintrisquad(s, m, center, radius, orient, q.child[k], bo, br);
+        }
+        if(stacksize <= 0) return;
+        curnode = stack[--stacksize];
+    }
+}
+
 void BIH::genstaintris(stainrenderer *s, const vec &staincenter, float stainradius, const vec &o, int yaw, int pitch, int roll, float scale)
 {
     if(!numnodes) return;
@@ -798,7 +1290,8 @@ void BIH::genstaintris(stainrenderer *s, const vec &staincenter, float stainradi
         if(!(m.flags&MESH_RENDER) || m.flags&MESH_ALPHA) continue;
         matrix4x3 morient;
         morient.mul(orient, o, m.xform);
-        genstaintris(s, m, m.invxform.transform(bo), radius, morient, m.nodes, icenter, iradius);
+        if(m.qnodes && bihquad) genstaintrisquad(s, m, m.invxform.transform(bo), radius, morient, 0, icenter, iradius);
+        else genstaintris(s, m, m.invxform.transform(bo), radius, morient, m.nodes, icenter, iradius);
     }
 }
 
@@ -12,6 +12,17 @@ struct BIH
         bool isleaf(int which) const { return (child[1]&(1<<(14+which)))!=0; }
     };
 
+    // collapsed layout, each node holds the bounds of up to four children side by side so all of them
+    // are tested in one pass, children >= 0 are node indexes and < 0 are ~triangle indexes
+    struct qnode
+    {
+        float bbmin[3][4], bbmax[3][4];
+        int child[4];
+
+        bool isleaf(int which) const { return child[which] < 0; }
+        int triindex(int which) const { return ~child[which]; }
+    };
+
     struct tri
     {
         ushort vert[3];
@@ -38,6 +49,8 @@ struct BIH
         float scale, invscale;
         node *nodes;
         int numnodes;
+        qnode *qnodes;
+        int numqnodes;
         const tri *tris;
         const tribb *tribbs;
         int numtris;
@@ -47,7 +60,7 @@ struct BIH
         int flags;
         vec bbmin, bbmax;
 
-        mesh() : numnodes(0), numtris(0), tex(NULL), flags(0) {}
+        mesh() : numnodes(0), qnodes(NULL), numqnodes(0), numtris(0), tex(NULL), flags(0) {}
 
         vec getpos(int i) const { return *(const vec *)(pos + i*posstride); }
         vec2 gettc(int i) const { return *(const vec2 *)(tc + i*tcstride); }
@@ -57,20 +70,31 @@ struct BIH
     int nummeshes;
     node *nodes;
     int numnodes;
+    qnode *qnodes;
+    int numqnodes;
     tribb *tribbs;
     int numtris;
     vec bbmin, bbmax, center;
     float radius, entradius;
+    // when loaded from the on-disk cache, nodes, qnodes and tribbs all point into this mapping
+    void *cachedata;
+    size_t cachesize;
 
-    BIH(vector<mesh> &buildmeshes);
+    BIH(vector<mesh> &buildmeshes, const char *cachename = NULL, uint cachekey = 0);
 
     ~BIH();
 
     void build(mesh &m, ushort *indices, int numindices, const ivec &vmin, const ivec &vmax);
+    void calcbounds(const mesh &m, int idx, ivec *bounds);
+    int collapse(mesh &m, int idx, const ivec *bounds);
+    uint meshkey(uint key) const;
+    bool loadcache(const char *cachename, uint key);
+    void savecache(const char *cachename, uint key) const;
 
     bool traverse(const vec &o, const vec &ray, float maxdist, float &dist, int mode);
     bool traverse(const mesh &m, const vec &o, const vec &ray, const vec &invray, float maxdist, float &dist, int mode, node *curnode, float tmin, float tmax);
     bool triintersect(const mesh &m, int tidx, const vec &mo, const vec &mray, float maxdist, float &dist, int mode);
+    bool traversequad(const mesh &m, const vec &o, const vec &ray, const vec &invray, float maxdist, float &dist, int mode, int curnode, float tmin, float tmax);
 
     bool boxcollide(physent *d, const vec &dir, float cutoff, const vec &o, int yaw, int pitch, int roll, float scale = 1);
     bool ellipsecollide(physent *d, const vec &dir, float cutoff, const vec &o, int yaw, int pitch, int roll, float scale = 1);
@@ -78,14 +102,18 @@ struct BIH
     template<int C>
     void collide(const mesh &m, physent *d, const vec &dir, float cutoff, const vec &center, const vec &radius, const matrix4x3 &orient, float &dist, node *curnode, const ivec &bo, const ivec &br);
     template<int C>
+    void collidequad(const mesh &m, physent *d, const vec &dir, float cutoff, const vec &center, const vec &radius, const matrix4x3 &orient, float &dist, int curnode, const ivec &bo, const ivec &br);
+    template<int C>
     void tricollide(const mesh &m, int tidx, physent *d, const vec &dir, float cutoff, const vec &center, const vec &radius, const matrix4x3 &orient, float &dist, const ivec &bo, const ivec &br);
 
     void genstaintris(stainrenderer *s, const vec &staincenter, float stainradius, const vec &o, int yaw, int pitch, int roll, float scale = 1);
     void genstaintris(stainrenderer *s, const mesh &m, const vec &center, float radius, const matrix4x3 &orient, node *curnode, const ivec &bo, const ivec &br);
+    void genstaintrisquad(stainrenderer *s, const mesh &m, const vec &center, float radius, const matrix4x3 &orient, int curnode, const ivec &bo, const ivec &br);
     void genstaintris(stainrenderer *s, const mesh &m, int tidx, const vec &center, float radius, const matrix4x3 &orient, const ivec &bo, const ivec &br);
  
     void preload();
 };
 
+extern uint hashbihfile(const char *filename, uint key);
 extern bool mmintersect(const extentity &e, const vec &o, const vec &ray, float maxdist, int mode, float &dist);
 
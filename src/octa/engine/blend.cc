@@ -558,6 +558,8 @@ void moveblendmap(int dx, int dy)
     old.cleanup();
 }
 
+// brushes, blend textures and painting belong to the editor and renderer, the mapcompiler only keeps the blendmap
+#ifndef MAPCOMPILER
 struct BlendBrush
 {
     char *name;
@@ -1089,6 +1091,7 @@ void renderblendbrush()
     if(!brush->tex) brush->gentex();
     renderblendbrush(brush->tex, x1, y1, x2 - x1, y2 - y1);
 }
+#endif
 
 bool loadblendmap(stream *f, uchar &type, BlendMapNode &node)
 {
@@ -106,14 +106,24 @@ extern void cleanuptextures();
 
 // pvs
 extern void clearpvs();
+extern void genpvs(int *viewcellsize);
+extern void changedpvs(const ivec &bbmin, const ivec &bbmax);
 extern bool pvsoccluded(const ivec &bbmin, const ivec &bbmax);
 extern bool pvsoccludedsphere(const vec &center, float radius);
+extern int pvsoccluded(const ivec *bbmin, const ivec *bbmax, int numboxes, uchar *occluded);
 extern bool waterpvsoccluded(int height);
 extern void setviewcell(const vec &p);
 extern void savepvs(stream *f);
 extern void loadpvs(stream *f, int numpvs);
 extern int getnumviewcells();
 
+// swocclusion
+extern int swocclusion;
+extern void invalidateswoccluders();
+extern void resetswocclusion();
+extern void buildswocclusion();
+extern bool swoccluded(const ivec &bbmin, const ivec &bbmax);
+
 static inline bool pvsoccluded(const ivec &bborigin, int size)
 {
     return pvsoccluded(bborigin, ivec(bborigin).add(size));
@@ -201,6 +211,7 @@ extern void getcubevector(cube &c, int d, int x, int y, int z, ivec &p);
 extern void setcubevector(cube &c, int d, int x, int y, int z, const ivec &p);
 extern int familysize(const cube &c);
 extern void freeocta(cube *c);
+extern void releasecubes();
 extern void discardchildren(cube &c, bool fixtex = false, int depth = 0);
 extern void optiface(uchar *p, cube &c);
 extern void validatec(cube *c, int size = 0);
@@ -208,8 +219,10 @@ extern bool isvalidcube(const cube &c);
 extern ivec lu;
 extern int lusize;
 extern cube &lookupcube(const ivec &to, int tsize = 0, ivec &ro = lu, int &rsize = lusize);
-extern const cube *neighbourstack[32];
-extern int neighbourdepth;
+extern THREADLOCAL const cube *neighbourstack[32];
+extern THREADLOCAL int neighbourdepth;
+extern void buildlinearocta();
+extern bool checklinearocta();
 extern const cube &neighbourcube(const cube &c, int orient, const ivec &co, int size, ivec &ro = lu, int &rsize = lusize);
 extern void resetclipplanes();
 extern int getmippedtexture(const cube &p, int orient);
@@ -235,10 +248,12 @@ extern int visibleorient(const cube &c, int orient);
 extern void genfaceverts(const cube &c, int orient, ivec v[4]);
 extern int calcmergedsize(int orient, const ivec &co, int size, const vertinfo *verts, int numverts);
 extern void invalidatemerges(cube &c, const ivec &co, int size, bool msg);
+extern int vathreads;
 extern void calcmerges();
 extern int mergefaces(int orient, facebounds *m, int sz);
 extern void mincubeface(const cube &cu, int orient, const ivec &o, int size, const facebounds &orig, facebounds &cf, ushort nmat = MAT_AIR, ushort matmask = MATF_VOLUME);
 extern void remip();
+extern void reduceslope(ivec &n);
 
 static inline cubeext &ext(cube &c)
 {
@@ -284,6 +299,7 @@ extern matrix4 shadowmatrix;
 extern void loaddeferredlightshaders();
 extern void cleardeferredlightshaders();
 extern void clearshadowcache();
+extern void clearshadowcache(const ivec &bbmin, const ivec &bbmax);
 
 extern void rendervolumetric();
 extern void cleanupvolumetric();
@@ -309,8 +325,10 @@ extern int calctrisidemask(const vec &p1, const vec &p2, const vec &p3, float bi
 extern int cullfrustumsides(const vec &lightpos, float lightradius, float size, float border);
 extern int calcbbcsmsplits(const ivec &bbmin, const ivec &bbmax);
 extern int calcspherecsmsplits(const vec &center, float radius);
+extern int getcsmcullplanes(plane *cull);
 extern int calcbbrsmsplits(const ivec &bbmin, const ivec &bbmax);
 extern int calcspherersmsplits(const vec &center, float radius);
+extern bool getrsmcullplanes(plane *cull);
 
 static inline bool sphereinsidespot(const vec &dir, int spot, const vec &center, float radius)
 {
@@ -399,20 +417,25 @@ extern void cleanupprefabs();
 
 // octarender
 extern ivec worldmin, worldmax, nogimin, nogimax;
-extern vector<tjoint> tjoints;
 
-extern ushort encodenormal(const vec &n);
-extern vec decodenormal(ushort norm);
 extern void guessnormals(const vec *pos, int numverts, vec *normals);
-extern void reduceslope(ivec &n);
-extern void findtjoints();
 extern void octarender();
 extern void allchanged(bool load = false);
 extern void clearvas(cube *c);
 extern void destroyva(vtxarray *va, bool reparent = true);
+extern void dirtyva(vtxarray *va);
 extern void updatevabb(vtxarray *va, bool force = false);
 extern void updatevabbs(bool force = false);
 
+// tjoint
+extern vector<tjoint> tjoints;
+extern int filltjoints;
+extern void findtjoints();
+
+// normal
+extern ushort encodenormal(const vec &n);
+extern vec decodenormal(ushort norm);
+
 // renderva
 
 extern int oqfrags;
@@ -430,6 +453,7 @@ extern void renderalphageom(int side);
 extern void rendermapmodels();
 extern void renderoutline();
 extern void cleanupva();
+extern void invalidatevabounds();
 
 extern bool isfoggedsphere(float rad, const vec &cv);
 extern int isvisiblesphere(float rad, const vec &cv);
@@ -597,7 +621,68 @@ enum
     INIT_LOAD,
     INIT_RESET
 };
-extern int initing, numcpus;
+extern int initing;
+
+// jobs
+extern int numcpus;
+
+#define MAXJOBTHREADS 16
+
+typedef void (*jobfunc)(void *data, int job, int thread);
+extern THREADLOCAL int curjobthread;
+extern int jobthreadcount(int threads = 0);
+extern void runjobs(jobfunc fn, void *data, int numjobs, int threads = 0);
+extern void cleanupjobs();
+
+template<class T, class F>
+struct parallelsortjob
+{
+    T *buf;
+    int n, chunks;
+    F fun;
+};
+
+template<class T, class F>
+static void parallelsortchunk(void *data, int job, int thread)
+{
+    parallelsortjob<T, F> &p = *(parallelsortjob<T, F> *)data;
+    int start = (p.n*job)/p.chunks, end = (p.n*(job+1))/p.chunks;
+    quicksort(&p.buf[start], end - start, p.fun);
+}
+
+// sorts chunks of at least minchunk elements on the job threads, then merges the sorted runs
+template<class T, class F>
+static inline void parallelsort(T *buf, int n, F fun, int threads = 0, int minchunk = 256)
+{
+    int chunks = min(jobthreadcount(threads), n/max(minchunk, 1));
+    if(chunks <= 1) { quicksort(buf, n, fun); return; }
+    parallelsortjob<T, F> p = { buf, n, chunks, fun };
+    runjobs(parallelsortchunk<T, F>, &p, chunks, chunks);
+
+    int bounds[MAXJOBTHREADS+1];
+    loopi(chunks+1) bounds[i] = (n*i)/chunks;
+    T *src = buf, *dst = new T[n];
+    for(int runs = chunks; runs > 1; runs = (runs+1)/2)
+    {
+        int merged = 0;
+        for(int r = 0; r < runs; r += 2)
+        {
+            int lo = bounds[r], mid = bounds[min(r+1, runs)], hi = bounds[min(r+2, runs)], i = lo, j = mid, k = lo;
+            while(i < mid && j < hi) dst[k++] = fun(src[j], src[i]) ? src[j++] : src[i++];
+            while(i < mid) dst[k++] = src[i++];
+            while(j < hi) dst[k++] = src[j++];
+            bounds[merged++] = lo;
+        }
+        bounds[merged] = n;
+        swap(src, dst);
+    }
+    if(src != buf)
+    {
+        loopi(n) buf[i] = src[i];
+        swap(src, dst);
+    }
+    delete[] dst;
+}
 
 enum
 {
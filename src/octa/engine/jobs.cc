@@ -0,0 +1,113 @@
+// jobs.cc: worker threads shared by the world compilation passes
+
+#include "engine.hh"
+
+VAR(numcpus, 1, 1, 16);
+
+// small pool of persistent worker threads that split a batch of independent jobs with the calling thread
+
+static SDL_mutex *jobmutex = NULL;
+static SDL_cond *jobstart = NULL, *jobdone = NULL;
+static SDL_Thread *jobworkers[MAXJOBTHREADS];
+static int numjobworkers = 0, jobgeneration = 0, jobworkerbase = 0, jobthreads = 0, jobsbusy = 0;
+static bool jobsquit = false;
+static jobfunc curjobfunc = NULL;
+static void *curjobdata = NULL;
+static int numcurjobs = 0;
+static SDL_atomic_t nextjob;
+THREADLOCAL int curjobthread = -1;
+
+static void dojobs(int thread)
+{
+    curjobthread = thread;
+    for(;;)
+    {
+        int job = SDL_AtomicAdd(&nextjob, 1);
+        if(job >= numcurjobs) break;
+        curjobfunc(curjobdata, job, thread);
+    }
+    curjobthread = -1;
+}
+
+static int jobworker(void *data)
+{
+    int thread = int(size_t(data));
+    SDL_LockMutex(jobmutex);
+    int generation = jobworkerbase;
+    for(;;)
+    {
+        while(!jobsquit && generation == jobgeneration) SDL_CondWait(jobstart, jobmutex);
+        if(jobsquit) break;
+        generation = jobgeneration;
+        if(thread >= jobthreads) continue;
+        SDL_UnlockMutex(jobmutex);
+        dojobs(thread);
+        SDL_LockMutex(jobmutex);
+        if(--jobsbusy <= 0) SDL_CondSignal(jobdone);
+    }
+    SDL_UnlockMutex(jobmutex);
+    return 0;
+}
+
+int jobthreadcount(int threads)
+{
+    return clamp(threads > 0 ? threads : numcpus, 1, MAXJOBTHREADS);
+}
+
+void runjobs(jobfunc fn, void *data, int numjobs, int threads)
+{
+    if(numjobs <= 0) return;
+    threads = min(jobthreadcount(threads), numjobs);
+    if(threads <= 1 || curjobthread >= 0)
+    {
+        loopi(numjobs) fn(data, i, max(curjobthread, 0));
+        return;
+    }
+    if(!jobmutex)
+    {
+        jobmutex = SDL_CreateMutex();
+        jobstart = SDL_CreateCond();
+        jobdone = SDL_CreateCond();
+    }
+    jobworkerbase = jobgeneration;
+    while(numjobworkers < threads-1)
+    {
+        int thread = ++numjobworkers;
+        jobworkers[thread-1] = SDL_CreateThread(jobworker, "job worker", (void *)size_t(thread));
+    }
+    SDL_LockMutex(jobmutex);
+    curjobfunc = fn;
+    curjobdata = data;
+    numcurjobs = numjobs;
+    SDL_AtomicSet(&nextjob, 0);
+    jobthreads = threads;
+    jobsbusy = threads-1;
+    jobgeneration++;
+    SDL_CondBroadcast(jobstart);
+    SDL_UnlockMutex(jobmutex);
+
+    dojobs(0);
+
+    SDL_LockMutex(jobmutex);
+    while(jobsbusy > 0) SDL_CondWait(jobdone, jobmutex);
+    curjobfunc = NULL;
+    curjobdata = NULL;
+    SDL_UnlockMutex(jobmutex);
+}
+
+void cleanupjobs()
+{
+    if(!jobmutex) return;
+    SDL_LockMutex(jobmutex);
+    jobsquit = true;
+    SDL_CondBroadcast(jobstart);
+    SDL_UnlockMutex(jobmutex);
+    loopi(numjobworkers) SDL_WaitThread(jobworkers[i], NULL);
+    numjobworkers = 0;
+    jobsquit = false;
+    SDL_DestroyCond(jobstart);
+    SDL_DestroyCond(jobdone);
+    SDL_DestroyMutex(jobmutex);
+    jobstart = jobdone = NULL;
+    jobmutex = NULL;
+}
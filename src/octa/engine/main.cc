@@ -24,7 +24,9 @@ void cleanup()
     SDL_SetRelativeMouseMode(SDL_FALSE);
     if(screen) SDL_SetWindowGrab(screen, SDL_FALSE);
     cleargamma();
+    cleanupjobs();
     freeocta(worldroot);
+    releasecubes();
     extern void clear_texpacks(int n = 0); clear_texpacks(); /* OF */
     extern void clear_command(); clear_command();
     extern void clear_console(); clear_console();
@@ -924,32 +926,6 @@ int getclockmillis()
     return max(millis, totalmillis);
 }
 
-VAR(numcpus, 1, 1, 16);
-
-static const char *determinehomedir(string &hdir) {
-#ifdef WIN32
-    copystring(hdir, "$HOME\\My Games\\OctaForge");
-#else
-#ifdef __APPLE__
-    /* SDL_GetPrefPath is nasty and doesn't allow us to omit the org... */
-    char *shdir = SDL_GetPrefPath("", "");
-    if (!shdir) {
-        return NULL;
-    } else {
-        /* We find a way around that manually */
-        const char appn[] = "OctaForge";
-        int len = strlen(shdir);
-        memcpy(hdir, shdir, len - 2);
-        memcpy(hdir + len - 2, appn, sizeof(appn));
-        SDL_free(shdir);
-    }
-#else
-    copystring(hdir, "$HOME/.octaforge");
-#endif
-#endif
-    return hdir;
-}
-
 int main(int argc, char **argv)
 {
     #ifdef WIN32
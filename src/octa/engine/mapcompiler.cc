@@ -0,0 +1,136 @@
+// mapcompiler.cc: headless driver running the CPU side of map compilation
+
+#include "engine.hh"
+
+// only built into the mapcompiler target, which links the world, octa, light and bih code with -DMAPCOMPILER
+// and mapstubs.cc in place of the renderer: no models, shaders or vertex arrays are set up, and vslots are
+// saved as loaded since compacting them needs the texture slots
+// surface normals are left to calclight in the client, they depend on the per texture smoothing groups
+// the texture config sets up, and every vslot here resolves to the dummy slot
+
+struct compilephase
+{
+    const char *name;
+    double seconds;
+};
+
+static vector<compilephase> compilephases;
+static Uint64 phasestart = 0;
+
+static void beginphase()
+{
+    phasestart = SDL_GetPerformanceCounter();
+}
+
+static void endphase(const char *name)
+{
+    compilephase &p = compilephases.add();
+    p.name = name;
+    p.seconds = double(SDL_GetPerformanceCounter() - phasestart) / double(SDL_GetPerformanceFrequency());
+    logoutf("%-8s %9.3f s", name, p.seconds);
+}
+
+static void usage()
+{
+    logoutf("usage: mapcompiler [-u<homedir>] [-k<packagedir>] [-g<loglevel>] [-t<threads>] [-c<viewcellsize>] [-p0] [-o<output>] <map>");
+}
+
+int main(int argc, char **argv)
+{
+    setlogfile(NULL);
+
+    char *loglevel = (char*)"WARNING";
+    const char *dir = NULL, *mapname = NULL, *outname = NULL;
+    int threads = 0, viewcellsize = 32;
+    bool dopvs = true;
+    for(int i = 1; i<argc; i++)
+    {
+        if(argv[i][0]=='-') switch(argv[i][1])
+        {
+            case 'u': dir = sethomedir(&argv[i][2]); break;
+            case 'k':
+            {
+                const char *pkg = addpackagedir(&argv[i][2]);
+                if(pkg) logoutf("Adding package directory: %s", pkg);
+                break;
+            }
+            case 'g': loglevel = &argv[i][2]; break;
+            case 't': threads = atoi(&argv[i][2]); break;
+            case 'c': viewcellsize = atoi(&argv[i][2]); break;
+            case 'p': dopvs = atoi(&argv[i][2]) != 0; break;
+            case 'o': outname = &argv[i][2]; break;
+            default: usage(); return EXIT_FAILURE;
+        }
+        else mapname = argv[i];
+    }
+    if(!mapname || !*mapname) { usage(); return EXIT_FAILURE; }
+    if(!outname || !*outname) outname = mapname;
+
+    if(!dir)
+    {
+        string hdirbuf;
+        const char *hdir = determinehomedir(hdirbuf);
+        if(hdir) dir = sethomedir(hdir);
+    }
+    if(dir) logoutf("Using home directory: %s", dir);
+
+    logger::setlevel(loglevel);
+
+    numcpus = clamp(threads > 0 ? threads : SDL_GetCPUCount(), 1, 16);
+
+    if(SDL_Init(SDL_INIT_TIMER)<0) fatal("Unable to initialize SDL: %s", SDL_GetError());
+
+    if(!lua::init(false)) fatal("cannot initialize lua script engine");
+
+    if(!execfile("config/stdlib.cfg", false)) fatal("cannot load cubescript stdlib");
+
+    // renderprogress and renderbackground only draw between frames, and there are no frames here
+    inbetweenframes = false;
+
+    logoutf("compiling map %s with %d threads", mapname, numcpus);
+    Uint64 start = SDL_GetPerformanceCounter();
+
+    beginphase();
+    if(!load_world(mapname)) fatal("could not load map %s", mapname);
+    endphase("load");
+
+    beginphase();
+    remip();
+    endphase("remip");
+
+    beginphase();
+    calcmerges();
+    endphase("merges");
+
+    beginphase();
+    tjoints.setsize(0);
+    findtjoints();
+    endphase("tjoints");
+
+    if(dopvs)
+    {
+        beginphase();
+        genpvs(&viewcellsize);
+        endphase("pvs");
+    }
+
+    beginphase();
+    optimizeblendmap();
+    endphase("blendmap");
+
+    beginphase();
+    bool saved = save_world(outname);
+    endphase("save");
+
+    double total = double(SDL_GetPerformanceCounter() - start) / double(SDL_GetPerformanceFrequency());
+    logoutf("%-8s %9.3f s", "total", total);
+    loopv(compilephases) logoutf("  %-8s %5.1f%%", compilephases[i].name, 100*compilephases[i].seconds/max(total, 1e-6));
+
+    cleanupjobs();
+    freeocta(worldroot);
+    releasecubes();
+    lua::close();
+    closelogfile();
+    SDL_Quit();
+    return saved ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,235 @@
+// mapstubs.cc: stand-ins for the renderer, editor, sound and game entry points the world code calls
+// only linked into the mapcompiler, which builds the world, octa, light and bih code without any of them
+
+#include "engine.hh"
+#include "game.hh"
+
+#define LOGSTRLEN 512
+
+// logging goes to stdout or the log file, there is no console to print to
+
+static FILE *logfile = NULL;
+
+void closelogfile()
+{
+    if(logfile)
+    {
+        fclose(logfile);
+        logfile = NULL;
+    }
+}
+
+FILE *getlogfile()
+{
+    return logfile ? logfile : stdout;
+}
+
+void setlogfile(const char *fname)
+{
+    closelogfile();
+    if(fname && fname[0])
+    {
+        fname = findfile(fname, "w");
+        if(fname) logfile = fopen(fname, "w");
+    }
+    setvbuf(getlogfile(), NULL, _IOLBF, BUFSIZ);
+}
+
+void logoutfv(const char *fmt, va_list args)
+{
+    static char buf[LOGSTRLEN];
+    vformatstring(buf, fmt, args, sizeof(buf));
+    fprintf(getlogfile(), "%s\n", buf);
+}
+
+void logoutf(const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    logoutfv(fmt, args);
+    va_end(args);
+}
+
+void conoutfv(int type, const char *fmt, va_list args)
+{
+    logoutfv(fmt, args);
+}
+
+void conoutf(const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    conoutfv(CON_INFO, fmt, args);
+    va_end(args);
+}
+
+void conoutf(int type, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    conoutfv(type, fmt, args);
+    va_end(args);
+}
+
+void fatal(const char *fmt, ...)
+{
+    defvformatstring(msg, fmt, fmt);
+    if(logfile) logoutf("%s", msg);
+    fprintf(stderr, "mapcompiler error: %s\n", msg);
+    closelogfile();
+    exit(EXIT_FAILURE);
+}
+
+// main
+
+int curtime = 0, lastmillis = 1, totalmillis = 1, clockrealbase = 0;
+bool inbetweenframes = false;
+dynent *player = NULL;
+physent *camera1 = NULL;
+vec worldpos(0, 0, 0);
+int thirdperson = 0;
+
+bool interceptkey(int sym) { return false; }
+void renderbackground(const char *caption, const char *picname, const char *mapname, const char *mapinfo, bool force) {}
+
+// progress goes to the log instead of a loading screen, one line per stage
+void renderprogress(float bar, const char *text)
+{
+    static string lasttext = "";
+    if(!text || !strcmp(text, lasttext)) return;
+    copystring(lasttext, text);
+    logoutf("%s", text);
+}
+
+// octarender: there are no vertex arrays, only the lookups the compile passes use are kept up to date
+
+vector<vtxarray *> valist;
+
+void allchanged(bool load)
+{
+    entitiesinoctanodes();
+    tjoints.setsize(0);
+    buildlinearocta();
+}
+
+void destroyva(vtxarray *va, bool reparent) {}
+void updatevabb(vtxarray *va, bool force) {}
+
+// octaedit
+
+bool editmode = false, havesel = false;
+int nompedit = 1;
+selinfo sel;
+vector<ushort> texmru;
+
+bool noedit(bool view, bool msg) { return true; }
+void cancelsel() {}
+
+// the world code only records entity undos, nothing is ever undone here so they are dropped right away
+void addundo(undoblock *u)
+{
+    undoent *ue = u->ents();
+    loopi(u->numents)
+    {
+        delete[] ue[i].name;
+        delete[] ue[i].sdata;
+    }
+    delete[] (uchar *)u;
+}
+
+void pruneundos(int maxremain) {}
+void commitchanges(bool force) {}
+void changed(const ivec &bbmin, const ivec &bbmax, bool commit) {}
+bool editmoveplane(const vec &o, const vec &ray, int d, float off, vec &handle, vec &dest, bool first) { return false; }
+
+// texture: slots are defined by the texture system, so vslots are saved as loaded and every lookup
+// resolves to the default slot
+
+vector<VSlot *> vslots;
+Texture *notexture = NULL;
+Slot dummyslot;
+VSlot dummyvslot(&dummyslot);
+
+// the dummy slots are only looked up, never loaded, so nothing is combined into them
+const char *Slot::name() const { return tempformatstring("slot %d", index); }
+const char *DecalSlot::name() const { return tempformatstring("decal slot %d", Slot::index); }
+VSlot &Slot::emptyvslot() { return dummyvslot; }
+int Slot::cancombine(int type) const { return -1; }
+int DecalSlot::cancombine(int type) const { return -1; }
+
+VSlot &lookupvslot(int index, bool load)
+{
+    return vslots.inrange(index) && vslots[index]->slot ? *vslots[index] : dummyvslot;
+}
+
+DecalSlot &lookupdecalslot(int index, bool load)
+{
+    static DecalSlot dummydecalslot;
+    return dummydecalslot;
+}
+
+int compactvslots(bool cull) { return vslots.length(); }
+void clearslots() {}
+void clear_texpacks(int n) {}
+void writemediacfg(int level) {}
+uchar *loadalphamask(Texture *t) { return NULL; }
+const char *getshaderparamname(const char *name, bool insert) { return name; }
+
+// renderer
+
+void loaddeferredlightshaders() {}
+void cleardeferredlightshaders() {}
+void clearshadowcache() {}
+void clearradiancehintscache() {}
+void cleanupvolumetric() {}
+void clearparticles() {}
+void clearparticleemitters() {}
+void deleteparticles() {}
+void clearstains() {}
+void deletestains() {}
+void genstainmmtri(stainrenderer *s, const vec v[3]) {}
+void updateblendtextures(int x1, int y1, int x2, int y2) {}
+void clearblendtextures() {}
+void stoppaintblendmap() {}
+
+// models and sound
+
+model *loadmodel(const char *name, bool msg) { return NULL; }
+void clearanims() {}
+void clear_attachments(vector<modelattach> &attachments, hashtable<const char *, entlinkpos> &attachment_positions) {}
+void set_attachments(vector<modelattach> &attachments, hashtable<const char *, entlinkpos> &attachment_positions, const char **attach) {}
+void stopmapsound(extentity *e) {}
+void stopmapsounds() {}
+
+// input and network
+
+tagval *addreleaseaction(ident *id, int numargs) { return NULL; }
+void writebinds(stream *f) {}
+void writecompletions(stream *f) {}
+bool isconnected(bool attempt, bool local) { return false; }
+bool multiplayer(bool msg) { return false; }
+
+// game: nobody is playing, the map is compiled with no clients
+
+namespace game
+{
+    gameent *player1 = NULL;
+
+    void writeclientinfo(stream *f) {}
+    bool allowedittoggle() { return false; }
+    void forceedit(const char *name) {}
+    void edittrigger(const selinfo &sel, int op, int arg1, int arg2, int arg3, const VSlot *vs) {}
+    int scaletime(int t) { return t*100; }
+    const char *getclientmap() { return ""; }
+    const char *getmapinfo() { return NULL; }
+    void newmap(int size) {}
+    void startmap(const char *name) {}
+    bool allowmove(physent *d) { return false; }
+    void physicstrigger(physent *d, bool local, int floorlevel, int waterlevel, int material) {}
+    dynent *iterdynents(int i) { return NULL; }
+    int numdynents() { return 0; }
+    gameent *getclient(int cn) { return NULL; }
+    void collidedynent(int pl, int cn, const vec &wall) {}
+    void collideextent(int pl, int uid) {}
+    bool addmsg(int type, const char *fmt, ...) { return false; }
+}
@@ -1,7 +1,31 @@
 // This code is based off the Minkowski Portal Refinement algorithm by Gary Snethen in XenoCollide & Game Programming Gems 7.
 
+VAR(mprcache, 0, 1, 1);
+
 namespace mpr
 {
+    static inline uint hashkey(uint h, const void *data, int len)
+    {
+        const uchar *bytes = (const uchar *)data;
+        loopi(len) h = ((h<<5)+h)^bytes[i];
+        return h;
+    }
+
+    // the exact identity and geometry of a shape, a cached answer is only reused when both keys match in full
+    struct ShapeKey
+    {
+        uchar data[64];
+        int len;
+
+        ShapeKey() : len(0) {}
+
+        void add(const void *p, int n) { ASSERT(len + n <= int(sizeof(data))); memcpy(&data[len], p, n); len += n; }
+
+        bool operator==(const ShapeKey &k) const { return len == k.len && !memcmp(data, k.data, len); }
+    };
+
+    // id() names a shape so the same pair finds its cache slot again, key() fills in everything its answer depends on
+
     struct CubePlanes
     {
         const clipplanes &p;
@@ -10,6 +34,9 @@ namespace mpr
 
         vec center() const { return p.o; }
 
+        uint id() const { return hashkey(5381, &p.owner, sizeof(p.owner)); }
+        void key(ShapeKey &k) const { k.add(&p.owner, sizeof(p.owner)); k.add(&p.version, sizeof(p.version)); }
+
         vec supportpoint(const vec &n) const
         {
             int besti = 7;
@@ -34,6 +61,9 @@ namespace mpr
 
         vec center() const { return vec(o).add(size/2); }
 
+        uint id() const { return hashkey(hashkey(5381, &o, sizeof(o)), &size, sizeof(size)); }
+        void key(ShapeKey &k) const { k.add(&o, sizeof(o)); k.add(&size, sizeof(size)); }
+
         vec supportpoint(const vec &n) const
         {
             vec p(o);
@@ -51,6 +81,15 @@ namespace mpr
         Ent(physent *ent) : ent(ent) {}
 
         vec center() const { return vec(ent->o.x, ent->o.y, ent->o.z + (ent->aboveeye - ent->eyeheight)/2); }
+
+        uint id() const { return hashkey(5381, &ent, sizeof(ent)); }
+        void key(ShapeKey &k) const
+        {
+            float shape[6] = { ent->yaw, ent->radius, ent->xradius, ent->yradius, ent->eyeheight, ent->aboveeye };
+            k.add(&ent, sizeof(ent));
+            k.add(&ent->o, sizeof(ent->o));
+            k.add(shape, sizeof(shape));
+        }
     };
 
     struct EntOBB : Ent
@@ -195,6 +234,9 @@ namespace mpr
         }
 
         vec center() const { return o; }
+
+        uint id() const { return hashkey(5381, &o, sizeof(o)); }
+        void key(ShapeKey &k) const { k.add(&o, sizeof(o)); k.add(&radius, sizeof(radius)); k.add(&orient, sizeof(orient)); }
     };
 
     struct ModelOBB : Model
@@ -270,7 +312,7 @@ namespace mpr
     const float boundarytolerance = 1e-3f;
 
     template<class T, class U>
-    bool collide(const T &p1, const U &p2)
+    bool collide(const T &p1, const U &p2, vec *sepdir = NULL)
     {
         // v0 = center of Minkowski difference
         vec v0 = p2.center().sub(p1.center());
@@ -279,13 +321,13 @@ namespace mpr
         // v1 = support in direction of origin
         vec n = vec(v0).neg();
         vec v1 = p2.supportpoint(n).sub(p1.supportpoint(vec(n).neg()));
-        if(v1.dot(n) <= 0) return false;  // origin outside v1 support plane ==> miss
+        if(v1.dot(n) <= 0) { if(sepdir) *sepdir = n; return false; }  // origin outside v1 support plane ==> miss
 
         // v2 = support perpendicular to plane containing origin, v0 and v1
         n.cross(v1, v0);
         if(n.iszero()) return true;   // v0, v1 and origin colinear (and origin inside v1 support plane) == > hit
         vec v2 = p2.supportpoint(n).sub(p1.supportpoint(vec(n).neg()));
-        if(v2.dot(n) <= 0) return false;  // origin outside v2 support plane ==> miss
+        if(v2.dot(n) <= 0) { if(sepdir) *sepdir = n; return false; }  // origin outside v2 support plane ==> miss
 
         // v3 = support perpendicular to plane containing v0, v1 and v2
         n.cross(v0, v1, v2);
@@ -304,7 +346,7 @@ namespace mpr
         {
             // Obtain the next support point
             vec v3 = p2.supportpoint(n).sub(p1.supportpoint(vec(n).neg()));
-            if(v3.dot(n) <= 0) return false;  // origin outside v3 support plane ==> miss
+            if(v3.dot(n) <= 0) { if(sepdir) *sepdir = n; return false; }  // origin outside v3 support plane ==> miss
 
             // If origin is outside (v1,v0,v3), then portal is invalid -- eliminate v2 and find new support outside face
             vec v3xv0;
@@ -341,7 +383,7 @@ namespace mpr
                 vec v4 = p2.supportpoint(n).sub(p1.supportpoint(vec(n).neg()));
 
                 // If the origin is outside the support plane or the boundary is thin enough, we have a miss
-                if(v4.dot(n) <= 0 || vec(v4).sub(v3).dot(n) <= boundarytolerance || j > 100) return false;
+                if(v4.dot(n) <= 0 || vec(v4).sub(v3).dot(n) <= boundarytolerance || j > 100) { if(sepdir) *sepdir = n; return false; }
 
                 // Test origin against the three planes that separate the new portal candidates: (v1,v4,v0) (v2,v4,v0) (v3,v4,v0)
                 // Note:  We're taking advantage of the triple product identities here as an optimization
@@ -565,5 +607,150 @@ namespace mpr
         }
         return false;
     }
-}
 
+    ///
+    // Contact cache: the last answer for each pair of shapes, kept per job thread.
+    // A pair whose shapes haven't changed gets that answer back without running MPR,
+    // and a pair that was apart is first re-tested against its old separating direction.
+    // The hashed ids only pick the slot, reuse compares both shapes' full keys.
+
+    struct ContactCacheEntry
+    {
+        uint id1, id2;
+        const char *tag;
+        ShapeKey key1, key2;
+        bool valid, hit, contacts, hassep;
+        vec normal, point1, point2, sep;
+    };
+
+    struct ContactCache
+    {
+        ContactCacheEntry *entries;
+        uint queries, reused, separated, full;
+    };
+
+    const int CONTACTCACHESIZE = 1024;
+    static ContactCache contactcaches[MAXJOBTHREADS];
+
+    static inline ContactCacheEntry &getcontact(ContactCache &cc, uint id1, uint id2)
+    {
+        if(!cc.entries) cc.entries = new ContactCacheEntry[CONTACTCACHESIZE]();
+        cc.queries++;
+        return cc.entries[(id1 ^ (id2*0x9E3779B9U))&(CONTACTCACHESIZE-1)];
+    }
+
+    // the same two ids can be tested as different shapes, e.g. a mapmodel as a box or an ellipse
+    template<class T, class U>
+    static inline const char *pairtag()
+    {
+        static const char tag = 0;
+        return &tag;
+    }
+
+    template<class T, class U>
+    static inline bool separated(const T &p1, const U &p2, const vec &n)
+    {
+        return p2.supportpoint(n).sub(p1.supportpoint(vec(n).neg())).dot(n) <= 0;
+    }
+
+    template<class T, class U>
+    bool cachedcollide(const T &p1, const U &p2)
+    {
+        if(!mprcache) return collide(p1, p2);
+        ContactCache &cc = contactcaches[max(curjobthread, 0)];
+        const char *tag = pairtag<T, U>();
+        uint id1 = p1.id(), id2 = p2.id()^hashkey(5381, &tag, sizeof(tag));
+        ShapeKey key1, key2;
+        p1.key(key1);
+        p2.key(key2);
+        ContactCacheEntry &e = getcontact(cc, id1, id2);
+        if(e.valid && e.id1 == id1 && e.id2 == id2)
+        {
+            if(e.tag == tag && e.key1 == key1 && e.key2 == key2) { cc.reused++; return e.hit; }
+            if(e.hassep && separated(p1, p2, e.sep))
+            {
+                cc.separated++;
+                e.tag = tag;
+                e.key1 = key1;
+                e.key2 = key2;
+                e.hit = e.contacts = false;
+                return false;
+            }
+        }
+        cc.full++;
+        vec sep(0, 0, 0);
+        bool hit = collide(p1, p2, &sep);
+        e.id1 = id1;
+        e.id2 = id2;
+        e.tag = tag;
+        e.key1 = key1;
+        e.key2 = key2;
+        e.valid = true;
+        e.hit = hit;
+        e.contacts = false;
+        e.hassep = !hit && !sep.iszero();
+        e.sep = sep;
+        return hit;
+    }
+
+    template<class T, class U>
+    bool cachedcollide(const T &p1, const U &p2, vec *contactnormal, vec *contactpoint1, vec *contactpoint2)
+    {
+        if(!mprcache) return collide(p1, p2, contactnormal, contactpoint1, contactpoint2);
+        ContactCache &cc = contactcaches[max(curjobthread, 0)];
+        const char *tag = pairtag<T, U>();
+        uint id1 = p1.id(), id2 = p2.id()^hashkey(5381, &tag, sizeof(tag));
+        ShapeKey key1, key2;
+        p1.key(key1);
+        p2.key(key2);
+        ContactCacheEntry &e = getcontact(cc, id1, id2);
+        if(e.valid && e.id1 == id1 && e.id2 == id2)
+        {
+            if(e.tag == tag && e.key1 == key1 && e.key2 == key2 && (e.contacts || !e.hit))
+            {
+                cc.reused++;
+                if(contactnormal) *contactnormal = e.hit ? e.normal : e.sep;
+                if(e.hit)
+                {
+                    if(contactpoint1) *contactpoint1 = e.point1;
+                    if(contactpoint2) *contactpoint2 = e.point2;
+                }
+                return e.hit;
+            }
+            if(e.hassep && separated(p1, p2, e.sep))
+            {
+                cc.separated++;
+                e.tag = tag;
+                e.key1 = key1;
+                e.key2 = key2;
+                e.hit = e.contacts = false;
+                if(contactnormal) *contactnormal = e.sep;
+                return false;
+            }
+        }
+        cc.full++;
+        vec normal(0, 0, 0), point1(0, 0, 0), point2(0, 0, 0);
+        bool hit = collide(p1, p2, &normal, &point1, &point2);
+        e.id1 = id1;
+        e.id2 = id2;
+        e.tag = tag;
+        e.key1 = key1;
+        e.key2 = key2;
+        e.valid = true;
+        e.hit = hit;
+        e.contacts = hit;
+        e.normal = normal;
+        e.point1 = point1;
+        e.point2 = point2;
+        // a miss leaves the normal pointing away from the origin, only trust it as a separating direction if it really is one
+        e.hassep = !hit && !normal.iszero() && separated(p1, p2, normal);
+        e.sep = normal;
+        if(contactnormal) *contactnormal = normal;
+        if(hit)
+        {
+            if(contactpoint1) *contactpoint1 = point1;
+            if(contactpoint2) *contactpoint2 = point2;
+        }
+        return hit;
+    }
+}
@@ -1,5 +1,20 @@
 #include "engine.hh"
 
+ushort encodenormal(const vec &n)
+{
+    if(n.iszero()) return 0;
+    int yaw = int(-atan2(n.x, n.y)/RAD), pitch = int(asin(n.z)/RAD);
+    return ushort(clamp(pitch + 90, 0, 180)*360 + (yaw < 0 ? yaw%360 + 360 : yaw%360) + 1);
+}
+
+vec decodenormal(ushort norm)
+{
+    if(!norm) return vec(0, 0, 1);
+    norm--;
+    const vec2 &yaw = sincos360[norm%360], &pitch = sincos360[norm/360+270];
+    return vec(-yaw.y*pitch.x, yaw.x*pitch.x, pitch.y);
+}
+
 struct normalkey
 {
     vec pos;
@@ -29,53 +44,71 @@ struct tnormal
 {
     int next;
     float offset;
-    int normals[2];
-    normalgroup *groups[2];
+    vec normals[2];
+    normalkey groups[2];
+};
+
+// normal groups are bucketed by a coarse grid over their position, so each bucket can be filled by its own thread
+#define NORMALGRIDSHIFT 6
+#define NUMNORMALBUCKETS 64
+
+struct normalbucket
+{
+    hashset<normalgroup> groups;
+    vector<normal> normals;
+    vector<tnormal> tnormals;
+
+    normalbucket() : groups(1<<12) {}
 };
 
-hashset<normalgroup> normalgroups(1<<16);
-vector<normal> normals;
-vector<tnormal> tnormals;
+static normalbucket normalbuckets[NUMNORMALBUCKETS];
 vector<int> smoothgroups;
 
+static inline normalbucket &findnormalbucket(const vec &pos)
+{
+    ivec cell = ivec(pos).shr(NORMALGRIDSHIFT);
+    uint h = uint(cell.x)*73856093U ^ uint(cell.y)*19349663U ^ uint(cell.z)*83492791U;
+    return normalbuckets[(h>>8)&(NUMNORMALBUCKETS-1)];
+}
+
 VARR(lerpangle, 0, 44, 180);
+VAR(normalthreads, 0, 0, 16);
 
 static bool usetnormals = true;
 
-static int addnormal(const vec &pos, int smooth, const vec &surface)
+static void addnormal(normalbucket &b, const vec &pos, int smooth, const vec &surface)
 {
     normalkey key = { pos, smooth };
-    normalgroup &g = normalgroups.access(key, key);
-    normal &n = normals.add();
+    normalgroup &g = b.groups.access(key, key);
+    normal &n = b.normals.add();
     n.next = g.normals;
     n.surface = surface;
-    return g.normals = normals.length()-1;
+    g.normals = b.normals.length()-1;
 }
 
-static void addtnormal(const vec &pos, int smooth, float offset, int normal1, int normal2, const vec &pos1, const vec &pos2)
+static void addnormal(normalbucket &b, const vec &pos, int smooth, int axis)
 {
     normalkey key = { pos, smooth };
-    normalgroup &g = normalgroups.access(key, key);
-    tnormal &n = tnormals.add();
-    n.next = g.tnormals;
-    n.offset = offset;
-    n.normals[0] = normal1;
-    n.normals[1] = normal2;
-    normalkey key1 = { pos1, smooth }, key2 = { pos2, smooth };
-    n.groups[0] = normalgroups.access(key1);
-    n.groups[1] = normalgroups.access(key2);
-    g.tnormals = tnormals.length()-1;
+    normalgroup &g = b.groups.access(key, key);
+    g.flat += 1<<(4*axis);
 }
 
-static int addnormal(const vec &pos, int smooth, int axis)
+static void addtnormal(normalbucket &b, const tnormal &t, const vec &pos, int smooth)
 {
     normalkey key = { pos, smooth };
-    normalgroup &g = normalgroups.access(key, key);
-    g.flat += 1<<(4*axis);
-    return axis - 6;
+    normalgroup &g = b.groups.access(key, key);
+    tnormal &n = b.tnormals.add(t);
+    n.next = g.tnormals;
+    g.tnormals = b.tnormals.length()-1;
 }
 
-static inline void findnormal(const normalgroup &g, float lerpthreshold, const vec &surface, vec &v)
+static inline const normalgroup *findnormalgroup(const normalkey &key, normalbucket *&b)
+{
+    b = &findnormalbucket(key.pos);
+    return b->groups.access(key);
+}
+
+static inline void findnormal(const normalbucket &b, const normalgroup &g, float lerpthreshold, const vec &surface, vec &v)
 {
     v = vec(0, 0, 0);
     int total = 0;
@@ -87,7 +120,7 @@ static inline void findnormal(const normalgroup &g, float lerpthreshold, const v
     else if(surface.z <= -lerpthreshold) { int n = (g.flat>>16)&0xF; v.z -= n; total += n; }
     for(int cur = g.normals; cur >= 0;)
     {
-        normal &o = normals[cur];
+        const normal &o = b.normals[cur];
         if(o.surface.dot(surface) >= lerpthreshold)
         {
             v.add(o.surface);
@@ -99,18 +132,15 @@ static inline void findnormal(const normalgroup &g, float lerpthreshold, const v
     else if(!total) v = surface;
 }
 
-static inline bool findtnormal(const normalgroup &g, float lerpthreshold, const vec &surface, vec &v)
+static inline bool findtnormal(const normalbucket &b, const normalgroup &g, float lerpthreshold, const vec &surface, vec &v)
 {
     float bestangle = lerpthreshold;
-    tnormal *bestnorm = NULL;
+    const tnormal *bestnorm = NULL;
     for(int cur = g.tnormals; cur >= 0;)
     {
-        tnormal &o = tnormals[cur];
-        static const vec flats[6] = { vec(-1, 0, 0), vec(1, 0, 0), vec(0, -1, 0), vec(0, 1, 0), vec(0, 0, -1), vec(0, 0, 1) };
-        vec n1 = o.normals[0] < 0 ? flats[o.normals[0]+6] : normals[o.normals[0]].surface,
-            n2 = o.normals[1] < 0 ? flats[o.normals[1]+6] : normals[o.normals[1]].surface,
-            nt;
-        nt.lerp(n1, n2, o.offset).normalize();
+        const tnormal &o = b.tnormals[cur];
+        vec nt;
+        nt.lerp(o.normals[0], o.normals[1], o.offset).normalize();
         float tangle = nt.dot(surface);
         if(tangle >= bestangle)
         {
@@ -120,23 +150,29 @@ static inline bool findtnormal(const normalgroup &g, float lerpthreshold, const
         cur = o.next;
     }
     if(!bestnorm) return false;
-    vec n1, n2;
-    findnormal(*bestnorm->groups[0], lerpthreshold, surface, n1);
-    findnormal(*bestnorm->groups[1], lerpthreshold, surface, n2);
-    v.lerp(n1, n2, bestnorm->offset).normalize();
+    vec n[2];
+    loopi(2)
+    {
+        normalbucket *nb;
+        const normalgroup *ng = findnormalgroup(bestnorm->groups[i], nb);
+        if(ng) findnormal(*nb, *ng, lerpthreshold, surface, n[i]);
+        else n[i] = surface;
+    }
+    v.lerp(n[0], n[1], bestnorm->offset).normalize();
     return true;
 }
 
 void findnormal(const vec &pos, int smooth, const vec &surface, vec &v)
 {
     normalkey key = { pos, smooth };
-    const normalgroup *g = normalgroups.access(key);
+    normalbucket *b;
+    const normalgroup *g = findnormalgroup(key, b);
     if(g)
     {
         int angle = smoothgroups.inrange(smooth) && smoothgroups[smooth] >= 0 ? smoothgroups[smooth] : lerpangle;
         float lerpthreshold = cos360(angle) - 1e-5f;
-        if(g->tnormals < 0 || !findtnormal(*g, lerpthreshold, surface, v))
-            findnormal(*g, lerpthreshold, surface, v);
+        if(g->tnormals < 0 || !findtnormal(*b, *g, lerpthreshold, surface, v))
+            findnormal(*b, *g, lerpthreshold, surface, v);
     }
     else v = surface;
 }
@@ -144,33 +180,93 @@ void findnormal(const vec &pos, int smooth, const vec &surface, vec &v)
 VARR(lerpsubdiv, 0, 2, 4);
 VARR(lerpsubdivsize, 4, 4, 128);
 
-static uint normalprogress = 0;
+struct normalentry
+{
+    normalkey key;
+    int axis;
+    vec surface;
+};
+
+struct tnormalentry
+{
+    normalkey key;
+    tnormal t;
+};
+
+// normals found by a job, kept per bucket in walk order so merging the jobs in order matches a serial walk
+struct normaljob
+{
+    cube *c;
+    ivec o;
+    int size, thread;
+    vector<normalentry> normals[NUMNORMALBUCKETS];
+    vector<tnormalentry> tnormals[NUMNORMALBUCKETS];
+};
+
+static vector<normaljob> normaljobs;
+static THREADLOCAL normaljob *curnormaljob = NULL;
+
+static SDL_atomic_t normalprogress;
+static THREADLOCAL int normalcount = 0;
 
 void show_addnormals_progress()
 {
-    float bar1 = float(normalprogress) / float(allocnodes);
+    float bar1 = float(SDL_AtomicGet(&normalprogress)) / float(allocnodes);
     renderprogress(bar1, "computing normals...");
 }
 
+#define CHECK_NORMALS_PROGRESS(exit) \
+    if(curnormaljob && curnormaljob->thread) { if(calclight_canceled) { exit; } } \
+    else CHECK_CALCLIGHT_PROGRESS(exit, show_addnormals_progress)
+
+static const vec flatnormals[6] = { vec(-1, 0, 0), vec(1, 0, 0), vec(0, -1, 0), vec(0, 1, 0), vec(0, 0, -1), vec(0, 0, 1) };
+
+static inline void emitnormal(const vec &pos, int smooth, const vec &surface, int axis = -1)
+{
+    normalbucket &b = findnormalbucket(pos);
+    if(curnormaljob)
+    {
+        normalentry &e = curnormaljob->normals[&b - normalbuckets].add();
+        e.key.pos = pos;
+        e.key.smooth = smooth;
+        e.axis = axis;
+        e.surface = surface;
+    }
+    else if(axis >= 0) addnormal(b, pos, smooth, axis);
+    else addnormal(b, pos, smooth, surface);
+}
+
+static inline void emittnormal(const tnormal &t, const vec &pos, int smooth)
+{
+    normalbucket &b = findnormalbucket(pos);
+    if(curnormaljob)
+    {
+        tnormalentry &e = curnormaljob->tnormals[&b - normalbuckets].add();
+        e.key.pos = pos;
+        e.key.smooth = smooth;
+        e.t = t;
+    }
+    else addtnormal(b, t, pos, smooth);
+}
+
 void addnormals(cube &c, const ivec &o, int size)
 {
-    CHECK_CALCLIGHT_PROGRESS(return, show_addnormals_progress);
+    CHECK_NORMALS_PROGRESS(return);
 
     if(c.children)
     {
-        normalprogress++;
+        if(!(++normalcount&0xFF)) SDL_AtomicAdd(&normalprogress, 0x100);
         size >>= 1;
         loopi(8) addnormals(c.children[i], ivec(i, o, size), size);
         return;
     }
     else if(isempty(c)) return;
 
-    vec pos[MAXFACEVERTS];
-    int norms[MAXFACEVERTS];
+    vec pos[MAXFACEVERTS], norms[MAXFACEVERTS];
     int tj = usetnormals && c.ext ? c.ext->tjoints : -1, vis;
     loopi(6) if((vis = visibletris(c, i, o, size)))
     {
-        CHECK_CALCLIGHT_PROGRESS(return, show_addnormals_progress);
+        CHECK_NORMALS_PROGRESS(return);
         if(c.texture[i] == DEFAULT_SKY) continue;
 
         vec planes[2];
@@ -209,15 +305,15 @@ void addnormals(cube &c, const ivec &o, int size)
         VSlot &vslot = lookupvslot(c.texture[i], false);
         int smooth = vslot.slot->smooth;
 
-        if(!numplanes) loopk(numverts) norms[k] = addnormal(pos[k], smooth, i);
-        else if(numplanes==1) loopk(numverts) norms[k] = addnormal(pos[k], smooth, planes[0]);
+        if(!numplanes) loopk(numverts) { norms[k] = flatnormals[i]; emitnormal(pos[k], smooth, norms[k], i); }
+        else if(numplanes==1) loopk(numverts) { norms[k] = planes[0]; emitnormal(pos[k], smooth, norms[k]); }
         else
         {
             vec avg = vec(planes[0]).add(planes[1]).normalize();
-            norms[0] = addnormal(pos[0], smooth, avg);
-            norms[1] = addnormal(pos[1], smooth, planes[0]);
-            norms[2] = addnormal(pos[2], smooth, avg);
-            for(int k = 3; k < numverts; k++) norms[k] = addnormal(pos[k], smooth, planes[1]);
+            norms[0] = norms[2] = avg;
+            norms[1] = planes[0];
+            for(int k = 3; k < numverts; k++) norms[k] = planes[1];
+            loopk(numverts) emitnormal(pos[k], smooth, norms[k]);
         }
 
         while(tj >= 0 && tjoints[tj].edge < i*(MAXFACEVERTS+1)) tj = tjoints[tj].next;
@@ -232,35 +328,107 @@ void addnormals(cube &c, const ivec &o, int size)
             int origin = int(min(v1[axis], v2[axis])*8)&~0x7FFF,
                 offset1 = (int(v1[axis]*8) - origin) / d[axis],
                 offset2 = (int(v2[axis]*8) - origin) / d[axis];
-            vec o = vec(v1).sub(vec(d).mul(offset1/8.0f)), n1, n2;
+            vec o = vec(v1).sub(vec(d).mul(offset1/8.0f));
             float doffset = 1.0f / (offset2 - offset1);
 
+            tnormal t;
+            t.normals[0] = norms[e1];
+            t.normals[1] = norms[e2];
+            t.groups[0].pos = v1;
+            t.groups[0].smooth = t.groups[1].smooth = smooth;
+            t.groups[1].pos = v2;
             while(tj >= 0)
             {
-                tjoint &t = tjoints[tj];
-                if(t.edge != edge) break;
-                float offset = (t.offset - offset1) * doffset;
-                vec tpos = vec(d).mul(t.offset/8.0f).add(o);
-                addtnormal(tpos, smooth, offset, norms[e1], norms[e2], v1, v2);
-                tj = t.next;
+                tjoint &tjt = tjoints[tj];
+                if(tjt.edge != edge) break;
+                t.offset = (tjt.offset - offset1) * doffset;
+                vec tpos = vec(d).mul(tjt.offset/8.0f).add(o);
+                emittnormal(t, tpos, smooth);
+                tj = tjt.next;
             }
         }
     }
 }
 
+// splits the world into jobs in tree order
+static void findnormaljobs(cube *c, const ivec &co, int size, int jobsize)
+{
+    loopi(8)
+    {
+        ivec o(i, co, size);
+        if(c[i].children && size > jobsize)
+        {
+            SDL_AtomicAdd(&normalprogress, 1);
+            findnormaljobs(c[i].children, o, size>>1, jobsize);
+        }
+        else if(c[i].children || !isempty(c[i]))
+        {
+            normaljob &j = normaljobs.add();
+            j.c = &c[i];
+            j.o = o;
+            j.size = size;
+            j.thread = 0;
+        }
+    }
+}
+
+static void addnormaljob(void *data, int index, int thread)
+{
+    normaljob &j = normaljobs[index];
+    j.thread = thread;
+    curnormaljob = &j;
+    addnormals(*j.c, j.o, j.size);
+    curnormaljob = NULL;
+}
+
+static void mergenormalbucket(void *data, int index, int thread)
+{
+    normalbucket &b = normalbuckets[index];
+    // a group keeps separate lists of normals and tnormals, so only the order within each kind matters
+    loopv(normaljobs)
+    {
+        vector<normalentry> &normals = normaljobs[i].normals[index];
+        loopvj(normals)
+        {
+            const normalentry &e = normals[j];
+            if(e.axis >= 0) addnormal(b, e.key.pos, e.key.smooth, e.axis);
+            else addnormal(b, e.key.pos, e.key.smooth, e.surface);
+        }
+        vector<tnormalentry> &tnormals = normaljobs[i].tnormals[index];
+        loopvj(tnormals) addtnormal(b, tnormals[j].t, tnormals[j].key.pos, tnormals[j].key.smooth);
+    }
+}
+
 void calcnormals(bool lerptjoints)
 {
+    Uint32 start = SDL_GetTicks();
     usetnormals = lerptjoints;
     if(usetnormals) findtjoints();
-    normalprogress = 1;
-    loopi(8) addnormals(worldroot[i], ivec(i, ivec(0, 0, 0), worldsize/2), worldsize/2);
+    SDL_AtomicSet(&normalprogress, 1);
+    normalcount = 0;
+    int threads = jobthreadcount(normalthreads);
+    if(threads > 1)
+    {
+        findnormaljobs(worldroot, ivec(0, 0, 0), worldsize/2, min(0x1000, worldsize>>3));
+        runjobs(addnormaljob, NULL, normaljobs.length(), threads);
+        if(!calclight_canceled) runjobs(mergenormalbucket, NULL, NUMNORMALBUCKETS, threads);
+        normaljobs.shrink(0);
+    }
+    else loopi(8) addnormals(worldroot[i], ivec(i, ivec(0, 0, 0), worldsize/2), worldsize/2);
+    int groups = 0;
+    loopi(NUMNORMALBUCKETS) groups += normalbuckets[i].groups.numelems;
+    conoutf(CON_DEBUG, "computed normals: %d groups, %d threads, %.1f seconds", groups, threads, (SDL_GetTicks() - start)/1000.0f);
 }
 
 void clearnormals()
 {
-    normalgroups.clear();
-    normals.setsize(0);
-    tnormals.setsize(0);
+    loopi(NUMNORMALBUCKETS)
+    {
+        normalbucket &b = normalbuckets[i];
+        b.groups.clear();
+        b.normals.setsize(0);
+        b.tnormals.setsize(0);
+    }
 }
 
 void resetsmoothgroups()
@@ -16,12 +16,160 @@ static struct emptycube : cube
     }
 } emptycube;
 
+// slab allocator for fixed size blocks, so subdividing and reloading maps doesn't churn the heap
+struct cubepool
+{
+    enum { SLABSIZE = 1<<16 };
+
+    struct freeblock { freeblock *next; };
+
+    int blocksize;
+    freeblock *freelist;
+    vector<uchar *> slabs;
+    int live, highwater;
+    SDL_SpinLock lock;
+
+    cubepool(int size) : blocksize((max(size, int(sizeof(freeblock))) + 15)&~15), freelist(NULL), live(0), highwater(0), lock(0) {}
+
+    void *alloc()
+    {
+        SDL_AtomicLock(&lock);
+        if(!freelist)
+        {
+            int n = max(SLABSIZE/blocksize, 1);
+            uchar *slab = new uchar[n*blocksize];
+            slabs.add(slab);
+            for(int i = n-1; i >= 0; i--)
+            {
+                freeblock *b = (freeblock *)&slab[i*blocksize];
+                b->next = freelist;
+                freelist = b;
+            }
+        }
+        freeblock *b = freelist;
+        freelist = b->next;
+        highwater = max(highwater, ++live);
+        SDL_AtomicUnlock(&lock);
+        return b;
+    }
+
+    void free(void *p)
+    {
+        freeblock *b = (freeblock *)p;
+        SDL_AtomicLock(&lock);
+        b->next = freelist;
+        freelist = b;
+        live--;
+        SDL_AtomicUnlock(&lock);
+    }
+
+    int findslab(const void *p) const
+    {
+        int lo = 0, hi = slabs.length()-1;
+        while(lo < hi)
+        {
+            int mid = (lo + hi + 1)/2;
+            if(slabs[mid] <= (const uchar *)p) lo = mid;
+            else hi = mid-1;
+        }
+        return lo;
+    }
+
+    // returns every slab none of whose blocks are in use anymore, all of them once nothing is live;
+    // the number of blocks still allocated is returned so callers can tell what was kept
+    int release()
+    {
+        SDL_AtomicLock(&lock);
+        if(!live)
+        {
+            slabs.deletearrays();
+            freelist = NULL;
+        }
+        else if(freelist)
+        {
+            int n = max(SLABSIZE/blocksize, 1);
+            slabs.sort();
+            vector<int> freecount;
+            loopv(slabs) freecount.add(0);
+            for(freeblock *b = freelist; b; b = b->next) freecount[findslab(b)]++;
+            freeblock *kept = NULL;
+            for(freeblock *b = freelist, *next; b; b = next)
+            {
+                next = b->next;
+                if(freecount[findslab(b)] >= n) continue;
+                b->next = kept;
+                kept = b;
+            }
+            freelist = kept;
+            loopvrev(slabs) if(freecount[i] >= n)
+            {
+                delete[] slabs[i];
+                slabs.remove(i);
+            }
+        }
+        int remaining = live;
+        SDL_AtomicUnlock(&lock);
+        return remaining;
+    }
+
+    int slabbytes() const { return slabs.length()*max(SLABSIZE/blocksize, 1)*blocksize; }
+};
+
+static cubepool cubefamilies(8*sizeof(cube));
+
+static const int cubeextverts[] = { 0, 4, 8, 16, 32, 64, 128, 255 };
+#define NUMCUBEEXTPOOLS int(sizeof(cubeextverts)/sizeof(cubeextverts[0]))
+static cubepool cubeexts[NUMCUBEEXTPOOLS] =
+{
+    cubepool(sizeof(cubeext)), cubepool(sizeof(cubeext) + 4*sizeof(vertinfo)), cubepool(sizeof(cubeext) + 8*sizeof(vertinfo)), cubepool(sizeof(cubeext) + 16*sizeof(vertinfo)),
+    cubepool(sizeof(cubeext) + 32*sizeof(vertinfo)), cubepool(sizeof(cubeext) + 64*sizeof(vertinfo)), cubepool(sizeof(cubeext) + 128*sizeof(vertinfo)), cubepool(sizeof(cubeext) + 255*sizeof(vertinfo))
+};
+
+static inline int cubeextpool(int maxverts)
+{
+    int i = 0;
+    while(i < NUMCUBEEXTPOOLS-1 && cubeextverts[i] < maxverts) i++;
+    return i;
+}
+
+static inline void freecubeextdata(cubeext *ext)
+{
+    cubeexts[cubeextpool(ext->maxverts)].free(ext);
+}
+
+void releasecubes()
+{
+    int live = cubefamilies.release();
+    loopi(NUMCUBEEXTPOOLS) live += cubeexts[i].release();
+    if(live) conoutf(CON_WARN, "releasecubes: %d cube blocks still allocated, only empty slabs were freed", live);
+}
+
+ICOMMAND(cubepoolstats, "", (),
+{
+    conoutf("cube families: %d live, %d peak, %d KB reserved", cubefamilies.live, cubefamilies.highwater, cubefamilies.slabbytes()/1024);
+    int live = 0;
+    int highwater = 0;
+    int bytes = 0;
+    int used = 0;
+    loopi(NUMCUBEEXTPOOLS)
+    {
+        cubepool &p = cubeexts[i];
+        live += p.live;
+        highwater += p.highwater;
+        bytes += p.slabbytes();
+        used += p.live*p.blocksize;
+    }
+    conoutf("cube exts: %d live (%d KB), %d peak, %d KB reserved", live, used/1024, highwater, bytes/1024);
+});
+
 cube *worldroot = newcubes(F_SOLID);
 int allocnodes = 0;
 
 cubeext *growcubeext(cubeext *old, int maxverts)
 {
-    cubeext *ext = (cubeext *)new uchar[sizeof(cubeext) + maxverts*sizeof(vertinfo)];
+    int pool = cubeextpool(maxverts);
+    maxverts = cubeextverts[pool];
+    cubeext *ext = (cubeext *)cubeexts[pool].alloc();
     if(old)
     {
         ext->va = old->va;
@@ -43,7 +191,7 @@ void setcubeext(cube &c, cubeext *ext)
     cubeext *old = c.ext;
     if(old == ext) return;
     c.ext = ext;
-    if(old) delete[] (uchar *)old;
+    if(old) freecubeextdata(old);
 }
 
 cubeext *newcubeext(cube &c, int maxverts, bool init)
@@ -65,7 +213,7 @@ cubeext *newcubeext(cube &c, int maxverts, bool init)
 
 cube *newcubes(uint face, int mat)
 {
-    cube *c = new cube[8];
+    cube *c = (cube *)cubefamilies.alloc();
     loopi(8)
     {
         c->children = NULL;
@@ -78,6 +226,7 @@ cube *newcubes(uint face, int mat)
         c++;
     }
     allocnodes++;
+    invalidatelinearocta();
     return c-8;
 }
 
@@ -92,15 +241,16 @@ void freeocta(cube *c)
 {
     if(!c) return;
     loopi(8) discardchildren(c[i]);
-    delete[] c;
+    cubefamilies.free(c);
     allocnodes--;
+    invalidatelinearocta();
 }
 
 void freecubeext(cube &c)
 {
     if(c.ext)
     {
-        delete[] (uchar *)c.ext;
+        freecubeextdata(c.ext);
         c.ext = NULL;
     }
 }
@@ -131,8 +281,10 @@ void discardchildren(cube &c, bool fixtex, int depth)
             loopi(6) c.texture[i] = getmippedtexture(c, i);
             if(depth > 0 && filled != F_EMPTY) c.faces[0] = F_SOLID;
         }
-        DELETEA(c.children);
+        cubefamilies.free(c.children);
+        c.children = NULL;
         allocnodes--;
+        invalidatelinearocta();
     }
 }
 
@@ -230,6 +382,50 @@ void validatec(cube *c, int size)
     }
 }
 
+vector<linearcube> linearocta;
+bool linearoctavalid = false;
+int linearoctachanged = 0;
+
+static void linearizeocta(cube *c, int first)
+{
+    loopi(8)
+    {
+        linearcube &l = linearocta[first+i];
+        l.children = 0;
+        l.material = c[i].material;
+        l.flags = (isempty(c[i]) ? LINEAR_EMPTY : 0) | (isentirelysolid(c[i]) ? LINEAR_SOLID : 0) | (c[i].ext && c[i].ext->ents ? LINEAR_ENTS : 0);
+        l.c = &c[i];
+    }
+    loopi(8) if(c[i].children)
+    {
+        int children = linearocta.length();
+        linearocta.pad(8);
+        linearocta[first+i].children = children;
+        linearizeocta(c[i].children, children);
+    }
+}
+
+VARF(linearoctree, 0, 1, 1, buildlinearocta());
+
+void buildlinearocta()
+{
+    linearocta.setsize(0);
+    linearoctavalid = false;
+    if(!linearoctree || !worldroot) return;
+    linearocta.reserve(8*allocnodes);
+    linearocta.pad(8);
+    linearizeocta(worldroot, 0);
+    linearoctavalid = true;
+}
+
+// rebuilds the linearized octree on demand once edits of the current frame are done, so editing a cube
+// does not relinearize the world on every query in between; job threads only ever read it
+bool checklinearocta()
+{
+    if(!linearoctavalid && linearoctree && worldroot && linearoctachanged != totalmillis && curjobthread < 0) buildlinearocta();
+    return linearoctavalid;
+}
+
 ivec lu;
 int lusize;
 cube &lookupcube(const ivec &to, int tsize, ivec &ro, int &rsize)
@@ -238,6 +434,19 @@ cube &lookupcube(const ivec &to, int tsize, ivec &ro, int &rsize)
         ty = clamp(to.y, 0, worldsize-1),
         tz = clamp(to.z, 0, worldsize-1);
     int scale = worldscale-1, csize = abs(tsize);
+    if(linearoctavalid && tsize <= 0)
+    {
+        const linearcube *l = &linearocta[octastep(tx, ty, tz, scale)];
+        while(!(csize>>scale) && l->children)
+        {
+            scale--;
+            l = &linearocta[l->children + octastep(tx, ty, tz, scale)];
+        }
+        ro = ivec(tx, ty, tz).mask(~0<<scale);
+        rsize = 1<<scale;
+        return *l->c;
+    }
+    if(tsize > 0) invalidatelinearocta(); // caller intends to modify the cube
     cube *c = &worldroot[octastep(tx, ty, tz, scale)];
     if(!(csize>>scale)) do
     {
@@ -264,6 +473,16 @@ int lookupmaterial(const vec &v)
     ivec o(v);
     if(!insideworld(o)) return MAT_AIR;
     int scale = worldscale-1;
+    if(linearoctavalid)
+    {
+        const linearcube *l = &linearocta[octastep(o.x, o.y, o.z, scale)];
+        while(l->children)
+        {
+            scale--;
+            l = &linearocta[l->children + octastep(o.x, o.y, o.z, scale)];
+        }
+        return l->material;
+    }
     cube *c = &worldroot[octastep(o.x, o.y, o.z, scale)];
     while(c->children)
     {
@@ -273,8 +492,8 @@ int lookupmaterial(const vec &v)
     return c->material;
 }
 
-const cube *neighbourstack[32];
-int neighbourdepth = -1;
+THREADLOCAL const cube *neighbourstack[32];
+THREADLOCAL int neighbourdepth = -1;
 
 const cube &neighbourcube(const cube &c, int orient, const ivec &co, int size, ivec &ro, int &rsize)
 {
@@ -1431,6 +1650,22 @@ bool clippoly(poly &p, const facebounds &b)
     return true;
 }
 
+void reduceslope(ivec &n)
+{
+    int mindim = -1, minval = 64;
+    loopi(3) if(n[i])
+    {
+        int val = abs(n[i]);
+        if(mindim < 0 || val < minval)
+        {
+            mindim = i;
+            minval = val;
+        }
+    }
+    if(!(n[R[mindim]]%minval) && !(n[C[mindim]]%minval)) n.div(minval);
+    while(!((n.x|n.y|n.z)&1)) n.shr(1);
+}
+
 bool genpoly(cube &cu, int orient, const ivec &o, int size, int vis, ivec &n, int &offset, poly &p)
 {
     int dim = dimension(orient), coord = dimcoord(orient);
@@ -1691,61 +1926,115 @@ void mergepolys(int orient, const ivec &co, const ivec &n, int offset, vector<po
     addmerges(orient, co, n, offset, polys);
 }
 
-static int genmergeprogress = 0;
+static SDL_atomic_t genmergeprogress;
+static THREADLOCAL int genmergecount = 0, genmergethread = 0;
 
 struct cfpolys
 {
     vector<poly> polys;
 };
 
-static hashtable<cfkey, cfpolys> cpolys;
+typedef hashtable<cfkey, cfpolys> cfpolytable;
 
-void genmerges(cube *c = worldroot, const ivec &o = ivec(0, 0, 0), int size = worldsize>>1)
+static vector<cfpolytable *> cpolytables;
+static THREADLOCAL cfpolytable *cpolys = NULL;
+
+// polys only merge within a 1<<maxmerge subtree, so each of those is merged independently by a job
+struct mergejob
 {
-    if((genmergeprogress++&0xFFF)==0) renderprogress(float(genmergeprogress)/allocnodes, "merging faces...");
-    neighbourstack[++neighbourdepth] = c;
-    loopi(8)
+    cube *c;
+    ivec o;
+    int size, neighbourdepth;
+    const cube *neighbourstack[32];
+};
+
+static vector<mergejob> mergejobs;
+static bool queuemergejobs = false;
+
+void genmerges(cube *c = worldroot, const ivec &o = ivec(0, 0, 0), int size = worldsize>>1);
+
+static void genmerges(cube *c, int i, const ivec &co, int size)
+{
+    int vis;
+    if(c[i].children) genmerges(c[i].children, co, size>>1);
+    else if(!isempty(c[i])) loopj(6) if((vis = visibletris(c[i], j, co, size)))
     {
-        ivec co(i, o, size);
-        int vis;
-        if(c[i].children) genmerges(c[i].children, co, size>>1);
-        else if(!isempty(c[i])) loopj(6) if((vis = visibletris(c[i], j, co, size)))
+        cfkey k;
+        poly p;
+        if(size < 1<<maxmerge && c != worldroot)
         {
-            cfkey k;
-            poly p;
-            if(size < 1<<maxmerge && c != worldroot)
+            if(genpoly(c[i], j, co, size, vis, k.n, k.offset, p))
             {
-                if(genpoly(c[i], j, co, size, vis, k.n, k.offset, p))
-                {
-                    k.orient = j;
-                    k.tex = c[i].texture[j];
-                    k.material = c[i].material&MAT_ALPHA;
-                    cpolys[k].polys.add(p);
-                    continue;
-                }
+                k.orient = j;
+                k.tex = c[i].texture[j];
+                k.material = c[i].material&MAT_ALPHA;
+                (*cpolys)[k].polys.add(p);
+                continue;
             }
-            else if(minface && size >= 1<<minface && touchingface(c[i], j))
+        }
+        else if(minface && size >= 1<<minface && touchingface(c[i], j))
+        {
+            if(genpoly(c[i], j, co, size, vis, k.n, k.offset, p) && p.merged)
             {
-                if(genpoly(c[i], j, co, size, vis, k.n, k.offset, p) && p.merged)
-                {
-                    addmerge(c[i], j, co, k.n, k.offset, p);
-                    continue;
-                }
+                addmerge(c[i], j, co, k.n, k.offset, p);
+                continue;
             }
-            clearmerge(c[i], j);
         }
-        if((size == 1<<maxmerge || c == worldroot) && cpolys.numelems)
+        clearmerge(c[i], j);
+    }
+    if((size == 1<<maxmerge || c == worldroot) && cpolys->numelems)
+    {
+        enumeratekt(*cpolys, cfkey, key, cfpolys, val,
         {
-            enumeratekt(cpolys, cfkey, key, cfpolys, val,
-            {
-                mergepolys(key.orient, co, key.n, key.offset, val.polys);
-            });
-            cpolys.clear();
+            mergepolys(key.orient, co, key.n, key.offset, val.polys);
+        });
+        cpolys->clear();
+    }
+}
+
+void genmerges(cube *c, const ivec &o, int size)
+{
+    if(!(genmergecount++&0xFFF))
+    {
+        int total = SDL_AtomicAdd(&genmergeprogress, 0x1000) + 0x1000;
+        if(!genmergethread) renderprogress(float(total)/allocnodes, "merging faces...");
+    }
+    neighbourstack[++neighbourdepth] = c;
+    loopi(8)
+    {
+        ivec co(i, o, size);
+        if(queuemergejobs && size == 1<<maxmerge && c != worldroot && c[i].children)
+        {
+            mergejob &j = mergejobs.add();
+            j.c = &c[i];
+            j.o = co;
+            j.size = size;
+            j.neighbourdepth = neighbourdepth;
+            memcpy(j.neighbourstack, neighbourstack, (neighbourdepth+1)*sizeof(const cube *));
+            continue;
         }
+        genmerges(c, i, co, size);
     }
     --neighbourdepth;
 }
 
+static void genmergejob(void *data, int index, int thread)
+{
+    mergejob &j = mergejobs[index];
+    int oldneighbourdepth = neighbourdepth;
+    neighbourdepth = j.neighbourdepth;
+    memcpy(neighbourstack, j.neighbourstack, (neighbourdepth+1)*sizeof(const cube *));
+    cpolys = cpolytables[thread];
+    genmergethread = thread;
+
+    // merge the job cube on its own, flushing its polys at the 1<<maxmerge level as usual
+    genmerges(j.c, 0, j.o, j.size);
+
+    genmergethread = 0;
+    cpolys = cpolytables[0];
+    neighbourdepth = oldneighbourdepth;
+}
+
 int calcmergedsize(int orient, const ivec &co, int size, const vertinfo *verts, int numverts)
 {
     ushort x1 = verts[0].x, y1 = verts[0].y, z1 = verts[0].z,
@@ -1810,9 +2099,24 @@ void invalidatemerges(cube &c, const ivec &co, int size, bool msg)
     invalidatemerges(c);
 }
 
+VARP(vathreads, 0, 0, 16);
+
 void calcmerges()
 {
-    genmergeprogress = 0;
+    SDL_AtomicSet(&genmergeprogress, 0);
+    genmergecount = 0;
+    int threads = jobthreadcount(vathreads);
+    while(cpolytables.length() < threads) cpolytables.add(new cfpolytable);
+    cpolys = cpolytables[0];
+
+    // subtrees are disjoint and only read their neighbours' shapes, so job order doesn't affect the result
+    queuemergejobs = threads > 1;
     genmerges();
+    queuemergejobs = false;
+    if(mergejobs.length())
+    {
+        runjobs(genmergejob, NULL, mergejobs.length(), threads);
+        mergejobs.setsize(0);
+    }
 }
 
@@ -148,6 +148,8 @@ struct vtxarray
     vector<grasstri> grasstris;
     int hasmerges, mergelevel;
     int shadowmask;
+    int cullidx;             // index into the flattened va bounds
+    int occluders, numoccluders; // range of software occluder boxes
 };
 
 struct cube;
@@ -207,6 +209,21 @@ struct cube
     };
 };
 
+enum
+{
+    LINEAR_EMPTY = 1<<0,
+    LINEAR_SOLID = 1<<1,
+    LINEAR_ENTS  = 1<<2
+};
+
+struct linearcube            // read-only mirror of a cube, stored in depth first morton order
+{
+    int children;            // index of the first of 8 contiguous children in linearocta, or 0 if a leaf
+    ushort material;
+    uchar flags;             // LINEAR_ flags summarizing faces and entities of the source cube
+    cube *c;                 // the source cube, for everything not mirrored here
+};
+
 struct block3
 {
     ivec o, s;
@@ -241,6 +258,11 @@ struct undoblock // undo header, all data sits in payload
 extern cube *worldroot;             // the world data. only a ptr to 8 cubes (ie: like cube.children above)
 extern int wtris, wverts, vtris, vverts, glde, gbatches, rplanes;
 extern int allocnodes, allocva, selchildcount, selchildmat;
+extern vector<linearcube> linearocta;
+extern bool linearoctavalid;
+extern int linearoctachanged;
+
+static inline void invalidatelinearocta() { linearoctavalid = false; linearoctachanged = totalmillis; }
 
 const uint F_EMPTY = 0;             // all edges in the range (0,0)
 const uint F_SOLID = 0x80808080;    // all edges in the range (0,8)
@@ -521,24 +521,49 @@ void tryedit()
 //////////// ready changes to vertex arrays ////////////
 
 static bool haschanged = false;
+static ivec changedmin(INT_MAX, INT_MAX, INT_MAX), changedmax(INT_MIN, INT_MIN, INT_MIN);
 
-void readychanges(const ivec &bbmin, const ivec &bbmax, cube *c, const ivec &cor, int size)
+VAR(dbgchanges, 0, 0, 1);
+
+// queues the va for an in-place rebuild, or destroys it and returns true if its merges escape so the enclosing va must be rebuilt instead
+static bool readyva(cube &c, const ivec &co, int size)
+{
+    vtxarray *va = c.ext->va;
+    if(va->hasmerges&(MERGE_ORIGIN|MERGE_PART))
+    {
+        int scale = 0;
+        while(1<<scale < size) scale++;
+        if(va->hasmerges&MERGE_PART || va->mergelevel > scale)
+        {
+            destroyva(va);
+            c.ext->va = NULL;
+            invalidatemerges(c, co, size, true);
+            return true;
+        }
+        if(c.children) loopi(8) invalidatemerges(c.children[i], ivec(i, co, size/2), size/2, true);
+        else if(c.merged)
+        {
+            brightencube(c);
+            c.merged = 0;
+        }
+    }
+    dirtyva(va);
+    return false;
+}
+
+// returns true if the changes touched cubes that are rendered by an enclosing va
+static bool readychanges(const ivec &bbmin, const ivec &bbmax, cube *c, const ivec &cor, int size)
 {
+    bool touched = false;
     loopoctabox(cor, size, bbmin, bbmax)
     {
         ivec o(i, cor, size);
         if(c[i].ext)
         {
-            if(c[i].ext->va)             // removes va s so that octarender will recreate
-            {
-                int hasmerges = c[i].ext->va->hasmerges;
-                destroyva(c[i].ext->va);
-                c[i].ext->va = NULL;
-                if(hasmerges) invalidatemerges(c[i], o, size, true);
-            }
             freeoctaentities(c[i]);
             c[i].ext->tjoints = -1;
         }
+        bool owned = true;
         if(c[i].children)
         {
             if(size<=1)
@@ -547,33 +572,49 @@ void readychanges(const ivec &bbmin, const ivec &bbmax, cube *c, const ivec &cor
                 discardchildren(c[i], true);
                 brightencube(c[i]);
             }
-            else readychanges(bbmin, bbmax, c[i].children, o, size/2);
+            else owned = readychanges(bbmin, bbmax, c[i].children, o, size/2);
         }
         else brightencube(c[i]);
+        if(owned && c[i].ext && c[i].ext->va) owned = readyva(c[i], o, size);
+        if(owned) touched = true;
     }
+    return touched;
 }
 
 void commitchanges(bool force)
 {
     if(!force && !haschanged) return;
     haschanged = false;
-
-    extern vector<vtxarray *> valist;
-    int oldlen = valist.length();
+    // only lights reaching into the edited region need their cached shadow maps re-rendered
+    bool regional = changedmin.x <= changedmax.x;
+    ivec clearmin = changedmin, clearmax = changedmax;
+    changedmin = ivec(INT_MAX, INT_MAX, INT_MAX);
+    changedmax = ivec(INT_MIN, INT_MIN, INT_MIN);
+
+    extern vector<vtxarray *> valist, dirtyvas;
+    extern int vabuilt;
+    // dirty vas are replaced during octarender, so the survivors shift down by that many
+    int oldlen = valist.length() - dirtyvas.length(), olddirty = dirtyvas.length(), oldbuilt = vabuilt;
     resetclipplanes();
     entitiesinoctanodes();
     inbetweenframes = false;
     octarender();
     inbetweenframes = true;
     setupmaterials(oldlen);
-    clearshadowcache();
+    if(regional && !force) clearshadowcache(clearmin, clearmax);
+    else clearshadowcache();
     updatevabbs();
+    if(dbgchanges) conoutf(CON_DEBUG, "rebuilt %d vertex arrays (%d in place), %d total", vabuilt - oldbuilt, olddirty, valist.length());
 }
 
 void changed(const ivec &bbmin, const ivec &bbmax, bool commit)
 {
     readychanges(bbmin, bbmax, worldroot, ivec(0, 0, 0), worldsize/2);
     haschanged = true;
+    changedmin.min(bbmin);
+    changedmax.max(bbmax);
+    invalidatelinearocta();
+    changedpvs(bbmin, bbmax);
 
     if(commit) commitchanges();
 }
@@ -581,8 +622,13 @@ void changed(const ivec &bbmin, const ivec &bbmax, bool commit)
 void changed(const block3 &sel, bool commit)
 {
     if(sel.s.iszero()) return;
-    readychanges(ivec(sel.o).sub(1), ivec(sel.s).mul(sel.grid).add(sel.o).add(1), worldroot, ivec(0, 0, 0), worldsize/2);
+    ivec bbmin = ivec(sel.o).sub(1), bbmax = ivec(sel.s).mul(sel.grid).add(sel.o).add(1);
+    readychanges(bbmin, bbmax, worldroot, ivec(0, 0, 0), worldsize/2);
     haschanged = true;
+    changedmin.min(bbmin);
+    changedmax.max(bbmax);
+    invalidatelinearocta();
+    changedpvs(bbmin, bbmax);
 
     if(commit) commitchanges();
 }
@@ -265,6 +265,24 @@ struct sortval
      sortval() {}
 };
 
+struct vabuffer
+{
+    vtxarray *va;
+    vector<vertex> verts;
+    vector<ushort> tris, skytris, decaltris;
+
+    vabuffer() : va(NULL) {}
+
+    void clear()
+    {
+        va = NULL;
+        verts.setsize(0);
+        tris.setsize(0);
+        skytris.setsize(0);
+        decaltris.setsize(0);
+    }
+};
+
 struct vacollect : verthash
 {
     ivec origin;
@@ -277,7 +295,9 @@ struct vacollect : verthash
     vector<grasstri> grasstris;
     vector<materialsurface> matsurfs;
     vector<octaentities *> mapmodels, decals, extdecals;
+    vector<int> decalents;
     int worldtris, skytris, decaltris;
+    vabuffer buf;
     vec alphamin, alphamax;
     vec refractmin, refractmax;
     ivec nogimin, nogimax;
@@ -293,6 +313,7 @@ struct vacollect : verthash
         mapmodels.setsize(0);
         decals.setsize(0);
         extdecals.setsize(0);
+        decalents.setsize(0);
         grasstris.setsize(0);
         texs.setsize(0);
         decaltexs.setsize(0);
@@ -411,30 +432,19 @@ struct vacollect : verthash
     {
         if(decals.length()) extdecals.put(decals.getbuf(), decals.length());
         if(extdecals.empty()) return;
+        // entities are shared between vertex arrays built on different threads, so dedup locally rather than flagging them
+        loopv(extdecals) decalents.put(extdecals[i]->decals.getbuf(), extdecals[i]->decals.length());
+        decalents.sort();
+        decalents.unique();
         vector<extentity *> &ents = entities::getents();
-        loopv(extdecals)
+        loopv(decalents)
         {
-            octaentities *oe = extdecals[i];
-            loopvj(oe->decals)
-            {
-                extentity &e = *ents[oe->decals[j]];
-                if(e.flags&EF_RENDER) continue;
-                e.flags |= EF_RENDER;
-                DecalSlot &s = lookupdecalslot(e.attr[0], true);
-                if(!s.shader) continue;
-                ushort envmap = s.shader->type&SHADER_ENVMAP ? (s.texmask&(1<<TEX_ENVMAP) ? EMID_CUSTOM : closestenvmap(e.o)) : EMID_NONE;
-                decalkey k(e.attr[0], envmap);
-                gendecal(e, s, k);
-            }
-        }
-        loopv(extdecals)
-        {
-            octaentities *oe = extdecals[i];
-            loopvj(oe->decals)
-            {
-                extentity &e = *ents[oe->decals[j]];
-                if(e.flags&EF_RENDER) e.flags &= ~EF_RENDER;
-            }
+            extentity &e = *ents[decalents[i]];
+            DecalSlot &s = lookupdecalslot(e.attr[0], true);
+            if(!s.shader) continue;
+            ushort envmap = s.shader->type&SHADER_ENVMAP ? (s.texmask&(1<<TEX_ENVMAP) ? EMID_CUSTOM : closestenvmap(e.o)) : EMID_NONE;
+            decalkey k(e.attr[0], envmap);
+            gendecal(e, s, k);
         }
         enumeratekt(decalindices, decalkey, k, sortval, t,
         {
@@ -448,6 +458,8 @@ struct vacollect : verthash
         optimize();
         gendecals();
 
+        buf.va = va;
+
         va->verts = verts.length();
         va->tris = worldtris/3;
         va->vbuf = 0;
@@ -455,19 +467,7 @@ struct vacollect : verthash
         va->minvert = 0;
         va->maxvert = va->verts-1;
         va->voffset = 0;
-        if(va->verts)
-        {
-            if(vbosize[VBO_VBUF] + verts.length() > maxvbosize ||
-               vbosize[VBO_EBUF] + worldtris > USHRT_MAX ||
-               vbosize[VBO_SKYBUF] + skytris > USHRT_MAX ||
-               vbosize[VBO_DECALBUF] + decaltris > USHRT_MAX)
-                flushvbo();
-
-            uchar *vdata = addvbo(va, VBO_VBUF, va->verts, sizeof(vertex));
-            genverts(vdata);
-            va->minvert += va->voffset;
-            va->maxvert += va->voffset;
-        }
+        if(va->verts) genverts(buf.verts.pad(va->verts));
 
         va->matbuf = NULL;
         va->matsurfs = matsurfs.length();
@@ -493,12 +493,7 @@ struct vacollect : verthash
         va->skydata = 0;
         va->skyoffset = 0;
         va->sky = skyindices.length();
-        if(va->sky)
-        {
-            ushort *skydata = (ushort *)addvbo(va, VBO_SKYBUF, va->sky, sizeof(ushort));
-            memcpy(skydata, skyindices.getbuf(), va->sky*sizeof(ushort));
-            if(va->voffset) loopi(va->sky) skydata[i] += va->voffset;
-        }
+        if(va->sky) buf.skytris.move(skyindices);
 
         va->texelems = NULL;
         va->texs = texs.length();
@@ -516,7 +511,6 @@ struct vacollect : verthash
         if(va->texs)
         {
             va->texelems = new elementset[va->texs];
-            ushort *edata = (ushort *)addvbo(va, VBO_EBUF, worldtris, sizeof(ushort)), *curbuf = edata;
             loopv(texs)
             {
                 const sortkey &k = texs[i];
@@ -526,24 +520,8 @@ struct vacollect : verthash
                 e.orient = k.orient;
                 e.layer = k.layer;
                 e.envmap = k.envmap;
-                ushort *startbuf = curbuf;
-                e.minvert = USHRT_MAX;
-                e.maxvert = 0;
-
-                if(t.tris.length())
-                {
-                    memcpy(curbuf, t.tris.getbuf(), t.tris.length() * sizeof(ushort));
-
-                    loopvj(t.tris)
-                    {
-                        curbuf[j] += va->voffset;
-                        e.minvert = min(e.minvert, curbuf[j]);
-                        e.maxvert = max(e.maxvert, curbuf[j]);
-                    }
-
-                    curbuf += t.tris.length();
-                }
-                e.length = curbuf-startbuf;
+                e.length = t.tris.length();
+                if(e.length) buf.tris.put(t.tris.getbuf(), e.length);
 
                 if(k.layer==LAYER_BLEND) { va->texs--; va->tris -= e.length/3; va->blends++; va->blendtris += e.length/3; }
                 else if(k.alpha==ALPHA_BACK) { va->texs--; va->tris -= e.length/3; va->alphaback++; va->alphabacktris += e.length/3; }
@@ -572,7 +550,6 @@ struct vacollect : verthash
         if(va->decaltexs)
         {
             va->decalelems = new elementset[va->decaltexs];
-            ushort *edata = (ushort *)addvbo(va, VBO_DECALBUF, decaltris, sizeof(ushort)), *curbuf = edata;
             loopv(decaltexs)
             {
                 const decalkey &k = decaltexs[i];
@@ -581,32 +558,12 @@ struct vacollect : verthash
                 e.texture = k.tex;
                 e.reuse = k.reuse;
                 e.envmap = k.envmap;
-                ushort *startbuf = curbuf;
-                e.minvert = USHRT_MAX;
-                e.maxvert = 0;
-
-                if(t.tris.length())
-                {
-                    memcpy(curbuf, t.tris.getbuf(), t.tris.length() * sizeof(ushort));
-
-                    loopvj(t.tris)
-                    {
-                        curbuf[j] += va->voffset;
-                        e.minvert = min(e.minvert, curbuf[j]);
-                        e.maxvert = max(e.maxvert, curbuf[j]);
-                    }
-
-                    curbuf += t.tris.length();
-                }
-                e.length = curbuf-startbuf;
+                e.length = t.tris.length();
+                if(e.length) buf.decaltris.put(t.tris.getbuf(), e.length);
             }
         }
 
-        if(grasstris.length())
-        {
-            va->grasstris.move(grasstris);
-            loadgrassshaders();
-        }
+        if(grasstris.length()) va->grasstris.move(grasstris);
 
         if(mapmodels.length()) va->mapmodels.put(mapmodels.getbuf(), mapmodels.length());
         if(decals.length()) va->decals.put(decals.getbuf(), decals.length());
@@ -616,31 +573,13 @@ struct vacollect : verthash
     {
         return verts.empty() && matsurfs.empty() && skyindices.empty() && grasstris.empty() && mapmodels.empty() && decals.empty();
     }
-} vc;
+};
+
+static THREADLOCAL vacollect *vc = NULL;
 
 int recalcprogress = 0;
 #define progress(s)     if((recalcprogress++&0xFFF)==0) renderprogress(recalcprogress/(float)allocnodes, s);
 
-vector<tjoint> tjoints;
-
-VARFP(filltjoints, 0, 1, 1, allchanged());
-
-void reduceslope(ivec &n)
-{
-    int mindim = -1, minval = 64;
-    loopi(3) if(n[i])
-    {
-        int val = abs(n[i]);
-        if(mindim < 0 || val < minval)
-        {
-            mindim = i;
-            minval = val;
-        }
-    }
-    if(!(n[R[mindim]]%minval) && !(n[C[mindim]]%minval)) n.div(minval);
-    while(!((n.x|n.y|n.z)&1)) n.shr(1);
-}
-
 // [rotation][orient]
 extern const vec orientation_tangent[6][6] =
 {
@@ -663,11 +602,11 @@ extern const vec orientation_bitangent[6][6] =
 
 void addtris(VSlot &vslot, int orient, const sortkey &key, vertex *verts, int *index, int numverts, int convex, int tj)
 {
-    int &total = key.tex==DEFAULT_SKY ? vc.skytris : vc.worldtris;
+    int &total = key.tex==DEFAULT_SKY ? vc->skytris : vc->worldtris;
     int edge = orient*(MAXFACEVERTS+1);
     loopi(numverts-2) if(index[0]!=index[i+1] && index[i+1]!=index[i+2] && index[i+2]!=index[0])
     {
-        vector<ushort> &idxs = key.tex==DEFAULT_SKY ? vc.skyindices : vc.indices[key].tris;
+        vector<ushort> &idxs = key.tex==DEFAULT_SKY ? vc->skyindices : vc->indices[key].tris;
         int left = index[0], mid = index[i+1], right = index[i+2], start = left, i0 = left, i1 = -1;
         loopk(4)
         {
@@ -730,7 +669,7 @@ void addtris(VSlot &vslot, int orient, const sortkey &key, vertex *verts, int *i
                     vt.tangent.lerp(v1.tangent, v2.tangent, offset);
                     if(v1.tangent.w != v2.tangent.w)
                         vt.tangent.w = orientation_bitangent[vslot.rotation][orient].scalartriple(vt.norm.tonormal(), vt.tangent.tonormal()) < 0 ? 0 : 255;
-                    int i2 = vc.addvert(vt);
+                    int i2 = vc->addvert(vt);
                     if(i2 < 0) return;
                     if(i1 >= 0)
                     {
@@ -751,7 +690,7 @@ void addtris(VSlot &vslot, int orient, const sortkey &key, vertex *verts, int *i
 
 void addgrasstri(int face, vertex *verts, int numv, ushort texture, int layer)
 {
-    grasstri &g = vc.grasstris.add();
+    grasstri &g = vc->grasstris.add();
     int i1, i2, i3, i4;
     if(numv <= 3 && face%2) { i1 = face+1; i2 = face+2; i3 = i4 = 0; }
     else { i1 = 0; i2 = face+1; i3 = face+2; i4 = numv > 3 ? face+3 : i3; }
@@ -762,7 +701,7 @@ void addgrasstri(int face, vertex *verts, int numv, ushort texture, int layer)
     g.numv = numv;
 
     g.surface.toplane(g.v[0], g.v[1], g.v[2]);
-    if(g.surface.z <= 0) { vc.grasstris.pop(); return; }
+    if(g.surface.z <= 0) { vc->grasstris.pop(); return; }
 
     g.minz = min(min(g.v[0].z, g.v[1].z), min(g.v[2].z, g.v[3].z));
     g.maxz = max(max(g.v[0].z, g.v[1].z), max(g.v[2].z, g.v[3].z));
@@ -808,21 +747,6 @@ static inline void calctexgen(VSlot &vslot, int orient, vec4 &sgen, vec4 &tgen)
     }
 }
 
-ushort encodenormal(const vec &n)
-{
-    if(n.iszero()) return 0;
-    int yaw = int(-atan2(n.x, n.y)/RAD), pitch = int(asin(n.z)/RAD);
-    return ushort(clamp(pitch + 90, 0, 180)*360 + (yaw < 0 ? yaw%360 + 360 : yaw%360) + 1);
-}
-
-vec decodenormal(ushort norm)
-{
-    if(!norm) return vec(0, 0, 1);
-    norm--;
-    const vec2 &yaw = sincos360[norm%360], &pitch = sincos360[norm/360+270];
-    return vec(-yaw.y*pitch.x, yaw.x*pitch.x, pitch.y);
-}
-
 void guessnormals(const vec *pos, int numverts, vec *normals)
 {
     vec n1, n2;
@@ -887,14 +811,14 @@ void addcubeverts(VSlot &vslot, int orient, int size, vec *pos, int convex, usho
             v.norm = bvec(128, 128, 255);
             v.tangent = bvec4(255, 128, 128, 255);
         }
-        index[k] = vc.addvert(v);
+        index[k] = vc->addvert(v);
         if(index[k] < 0) return;
     }
 
     if(alpha)
     {
-        loopk(numverts) { vc.alphamin.min(pos[k]); vc.alphamax.max(pos[k]); }
-        if(vslot.refractscale > 0) loopk(numverts) { vc.refractmin.min(pos[k]); vc.refractmax.max(pos[k]); }
+        loopk(numverts) { vc->alphamin.min(pos[k]); vc->alphamax.max(pos[k]); }
+        if(vslot.refractscale > 0) loopk(numverts) { vc->refractmin.min(pos[k]); vc->refractmax.max(pos[k]); }
     }
 
     sortkey key(texture, vslot.scroll.iszero() ? O_ANY : orient, layer&LAYER_BOTTOM ? layer : LAYER_TOP, envmap, alpha ? (vslot.refractscale > 0 ? ALPHA_REFRACT : (vslot.alphaback ? ALPHA_BACK : ALPHA_FRONT)) : NO_ALPHA);
@@ -917,156 +841,6 @@ void addcubeverts(VSlot &vslot, int orient, int size, vec *pos, int convex, usho
     }
 }
 
-struct edgegroup
-{
-    ivec slope, origin;
-    int axis;
-};
-
-static inline uint hthash(const edgegroup &g)
-{
-    return g.slope.x^g.slope.y^g.slope.z^g.origin.x^g.origin.y^g.origin.z;
-}
-
-static inline bool htcmp(const edgegroup &x, const edgegroup &y)
-{
-    return x.slope==y.slope && x.origin==y.origin;
-}
-
-enum
-{
-    CE_START = 1<<0,
-    CE_END   = 1<<1,
-    CE_FLIP  = 1<<2,
-    CE_DUP   = 1<<3
-};
-
-struct cubeedge
-{
-    cube *c;
-    int next, offset;
-    ushort size;
-    uchar index, flags;
-};
-
-vector<cubeedge> cubeedges;
-hashtable<edgegroup, int> edgegroups(1<<13);
-
-void gencubeedges(cube &c, const ivec &co, int size)
-{
-    ivec pos[MAXFACEVERTS];
-    int vis;
-    loopi(6) if((vis = visibletris(c, i, co, size)))
-    {
-        int numverts = c.ext ? c.ext->surfaces[i].numverts&MAXFACEVERTS : 0;
-        if(numverts)
-        {
-            vertinfo *verts = c.ext->verts() + c.ext->surfaces[i].verts;
-            ivec vo = ivec(co).mask(~0xFFF).shl(3);
-            loopj(numverts)
-            {
-                vertinfo &v = verts[j];
-                pos[j] = ivec(v.x, v.y, v.z).add(vo);
-            }
-        }
-        else if(c.merged&(1<<i)) continue;
-        else
-        {
-            ivec v[4];
-            genfaceverts(c, i, v);
-            int order = vis&4 || (!flataxisface(c, i) && faceconvexity(v) < 0) ? 1 : 0;
-            ivec vo = ivec(co).shl(3);
-            pos[numverts++] = v[order].mul(size).add(vo);
-            if(vis&1) pos[numverts++] = v[order+1].mul(size).add(vo);
-            pos[numverts++] = v[order+2].mul(size).add(vo);
-            if(vis&2) pos[numverts++] = v[(order+3)&3].mul(size).add(vo);
-        }
-        loopj(numverts)
-        {
-            int e1 = j, e2 = j+1 < numverts ? j+1 : 0;
-            ivec d = pos[e2];
-            d.sub(pos[e1]);
-            if(d.iszero()) continue;
-            int axis = abs(d.x) > abs(d.y) ? (abs(d.x) > abs(d.z) ? 0 : 2) : (abs(d.y) > abs(d.z) ? 1 : 2);
-            if(d[axis] < 0)
-            {
-                d.neg();
-                swap(e1, e2);
-            }
-            reduceslope(d);
-
-            int t1 = pos[e1][axis]/d[axis],
-                t2 = pos[e2][axis]/d[axis];
-            edgegroup g;
-            g.origin = ivec(pos[e1]).sub(ivec(d).mul(t1));
-            g.slope = d;
-            g.axis = axis;
-            cubeedge ce;
-            ce.c = &c;
-            ce.offset = t1;
-            ce.size = t2 - t1;
-            ce.index = i*(MAXFACEVERTS+1)+j;
-            ce.flags = CE_START | CE_END | (e1!=j ? CE_FLIP : 0);
-            ce.next = -1;
-
-            bool insert = true;
-            int *exists = edgegroups.access(g);
-            if(exists)
-            {
-                int prev = -1, cur = *exists;
-                while(cur >= 0)
-                {
-                    cubeedge &p = cubeedges[cur];
-                    if(p.flags&CE_DUP ?
-                        ce.offset>=p.offset && ce.offset+ce.size<=p.offset+p.size :
-                        ce.offset==p.offset && ce.size==p.size)
-                    {
-                        p.flags |= CE_DUP;
-                        insert = false;
-                        break;
-                    }
-                    else if(ce.offset >= p.offset)
-                    {
-                        if(ce.offset == p.offset+p.size) ce.flags &= ~CE_START;
-                        prev = cur;
-                        cur = p.next;
-                    }
-                    else break;
-                }
-                if(insert)
-                {
-                    ce.next = cur;
-                    while(cur >= 0)
-                    {
-                        cubeedge &p = cubeedges[cur];
-                        if(ce.offset+ce.size==p.offset) { ce.flags &= ~CE_END; break; }
-                        cur = p.next;
-                    }
-                    if(prev>=0) cubeedges[prev].next = cubeedges.length();
-                    else *exists = cubeedges.length();
-                }
-            }
-            else edgegroups[g] = cubeedges.length();
-
-            if(insert) cubeedges.add(ce);
-        }
-    }
-}
-
-void gencubeedges(cube *c = worldroot, const ivec &co = ivec(0, 0, 0), int size = worldsize>>1)
-{
-    progress("fixing t-joints...");
-    neighbourstack[++neighbourdepth] = c;
-    loopi(8)
-    {
-        ivec o(i, co, size);
-        if(c[i].ext) c[i].ext->tjoints = -1;
-        if(c[i].children) gencubeedges(c[i].children, o, size>>1);
-        else if(!isempty(c[i])) gencubeedges(c[i], o, size);
-    }
-    --neighbourdepth;
-}
-
 void gencubeverts(cube &c, const ivec &co, int size, int csi)
 {
     if(!(c.visible&0xC0)) return;
@@ -1123,9 +897,78 @@ void gencubeverts(cube &c, const ivec &co, int size, int csi)
 
 ////////// Vertex Arrays //////////////
 
-int allocva = 0;
+int allocva = 0, vabuilt = 0;
 int wtris = 0, wverts = 0, vtris = 0, vverts = 0, glde = 0, gbatches = 0;
-vector<vtxarray *> valist, varoot;
+vector<vtxarray *> valist, varoot, dirtyvas;
+
+struct vajob
+{
+    cube *c;
+    ivec o;
+    int size, csi, thread;
+    bool force;
+    int entdepth, neighbourdepth;
+    octaentities *entstack[32];
+    const cube *neighbourstack[32];
+    vector<vtxarray *> roots;
+    vector<vabuffer *> pending;
+};
+
+static THREADLOCAL vajob *curvajob = NULL;
+
+static void uploadelems(vtxarray *va, int type, elementset *elems, int numelems, const vector<ushort> &tris)
+{
+    ushort *edata = (ushort *)addvbo(va, type, tris.length(), sizeof(ushort));
+    loopv(tris) edata[i] = tris[i] + va->voffset;
+    loopi(numelems)
+    {
+        elementset &e = elems[i];
+        e.minvert = USHRT_MAX;
+        e.maxvert = 0;
+        loopj(e.length)
+        {
+            e.minvert = min(e.minvert, edata[j]);
+            e.maxvert = max(e.maxvert, edata[j]);
+        }
+        edata += e.length;
+    }
+}
+
+// packs a built vertex array into the shared vbos; only ever runs on the main thread
+static void uploadva(vabuffer &b)
+{
+    vtxarray *va = b.va;
+    if(va->verts)
+    {
+        if(vbosize[VBO_VBUF] + b.verts.length() > maxvbosize ||
+           vbosize[VBO_EBUF] + b.tris.length() > USHRT_MAX ||
+           vbosize[VBO_SKYBUF] + b.skytris.length() > USHRT_MAX ||
+           vbosize[VBO_DECALBUF] + b.decaltris.length() > USHRT_MAX)
+            flushvbo();
+
+        uchar *vdata = addvbo(va, VBO_VBUF, va->verts, sizeof(vertex));
+        memcpy(vdata, b.verts.getbuf(), va->verts*sizeof(vertex));
+        va->minvert += va->voffset;
+        va->maxvert += va->voffset;
+    }
+    if(va->sky)
+    {
+        ushort *skydata = (ushort *)addvbo(va, VBO_SKYBUF, va->sky, sizeof(ushort));
+        memcpy(skydata, b.skytris.getbuf(), va->sky*sizeof(ushort));
+        if(va->voffset) loopi(va->sky) skydata[i] += va->voffset;
+    }
+    if(va->texelems) uploadelems(va, VBO_EBUF, va->texelems, va->texs + va->blends + va->alphaback + va->alphafront + va->refract, b.tris);
+    if(va->decalelems) uploadelems(va, VBO_DECALBUF, va->decalelems, va->decaltexs, b.decaltris);
+    if(va->grasstris.length()) loadgrassshaders();
+
+    wverts += va->verts;
+    wtris  += va->tris + va->blends + va->alphabacktris + va->alphafronttris + va->refracttris + va->decaltris;
+    allocva++;
+    vabuilt++;
+    valist.add(va);
+    invalidatevabounds();
+    invalidateswoccluders();
+}
 
 vtxarray *newva(const ivec &o, int size)
 {
@@ -1140,28 +983,38 @@ vtxarray *newva(const ivec &o, int size)
     va->bbmax = va->alphamax = va->refractmax = ivec(-1, -1, -1);
     va->hasmerges = 0;
     va->mergelevel = -1;
+    va->cullidx = -1;
+    va->occluders = va->numoccluders = 0;
 
-    vc.setupdata(va);
+    vc->setupdata(va);
 
     if(va->alphafronttris || va->alphabacktris || va->refracttris)
     {
-        va->alphamin = ivec(vec(vc.alphamin).mul(8)).shr(3);
-        va->alphamax = ivec(vec(vc.alphamax).mul(8)).add(7).shr(3);
+        va->alphamin = ivec(vec(vc->alphamin).mul(8)).shr(3);
+        va->alphamax = ivec(vec(vc->alphamax).mul(8)).add(7).shr(3);
     }
 
     if(va->refracttris)
     {
-        va->refractmin = ivec(vec(vc.refractmin).mul(8)).shr(3);
-        va->refractmax = ivec(vec(vc.refractmax).mul(8)).add(7).shr(3);
+        va->refractmin = ivec(vec(vc->refractmin).mul(8)).shr(3);
+        va->refractmax = ivec(vec(vc->refractmax).mul(8)).add(7).shr(3);
     }
 
-    va->nogimin = vc.nogimin;
-    va->nogimax = vc.nogimax;
+    va->nogimin = vc->nogimin;
+    va->nogimax = vc->nogimax;
 
-    wverts += va->verts;
-    wtris  += va->tris + va->blends + va->alphabacktris + va->alphafronttris + va->refracttris + va->decaltris;
-    allocva++;
-    valist.add(va);
+    if(curvajob)
+    {
+        vabuffer *b = new vabuffer;
+        b->va = va;
+        b->verts.move(vc->buf.verts);
+        b->tris.move(vc->buf.tris);
+        b->skytris.move(vc->buf.skytris);
+        b->decaltris.move(vc->buf.decaltris);
+        curvajob->pending.add(b);
+    }
+    else uploadva(vc->buf);
+    vc->buf.clear();
 
     return va;
 }
@@ -1172,7 +1025,10 @@ void destroyva(vtxarray *va, bool reparent)
     wtris -= va->tris + va->blends + va->alphabacktris + va->alphafronttris + va->refracttris + va->decaltris;
     allocva--;
     valist.removeobj(va);
+    invalidatevabounds();
+    invalidateswoccluders();
     if(!va->parent) varoot.removeobj(va);
+    if(dirtyvas.length()) dirtyvas.removeobj(va);
     if(reparent)
     {
         if(va->parent) va->parent->children.removeobj(va);
@@ -1193,6 +1049,11 @@ void destroyva(vtxarray *va, bool reparent)
     delete va;
 }
 
+void dirtyva(vtxarray *va)
+{
+    if(dirtyvas.find(va) < 0) dirtyvas.add(va);
+}
+
 void clearvas(cube *c)
 {
     loopi(8)
@@ -1213,6 +1074,8 @@ void updatevabb(vtxarray *va, bool force)
 {
     if(!force && va->bbmin.x >= 0) return;
 
+    invalidatevabounds();
+
     va->bbmin = va->geommin;
     va->bbmax = va->geommax;
     va->bbmin.min(va->lavamin);
@@ -1273,8 +1136,8 @@ struct mergedface
 };
 
 #define MAXMERGELEVEL 12
-static int vahasmerges = 0, vamergemax = 0;
-static vector<mergedface> vamerges[MAXMERGELEVEL+1];
+static THREADLOCAL int vahasmerges = 0, vamergemax = 0;
+static THREADLOCAL vector<mergedface> *vamerges = NULL;
 
 int genmergedfaces(cube &c, const ivec &co, int size, int minlevel = -1)
 {
@@ -1375,7 +1238,7 @@ static inline void finddecals(vtxarray *va)
 {
     if(va->hasmerges&(MERGE_ORIGIN|MERGE_PART))
     {
-        loopv(va->decals) vc.extdecals.add(va->decals[i]);
+        loopv(va->decals) vc->extdecals.add(va->decals[i]);
         loopv(va->children) finddecals(va->children[i]);
     }
 }
@@ -1409,8 +1272,8 @@ void rendercube(cube &c, const ivec &co, int size, int csi, int &maxlevel) // cr
 
         if(c.ext && c.ext->ents)
         {
-            if(c.ext->ents->mapmodels.length()) vc.mapmodels.add(c.ext->ents);
-            if(c.ext->ents->decals.length()) vc.decals.add(c.ext->ents);
+            if(c.ext->ents->mapmodels.length()) vc->mapmodels.add(c.ext->ents);
+            if(c.ext->ents->decals.length()) vc->decals.add(c.ext->ents);
         }
         return;
     }
@@ -1422,18 +1285,18 @@ void rendercube(cube &c, const ivec &co, int size, int csi, int &maxlevel) // cr
     }
     if(c.material != MAT_AIR)
     {
-        genmatsurfs(c, co, size, vc.matsurfs);
+        genmatsurfs(c, co, size, vc->matsurfs);
         if(c.material&MAT_NOGI)
         {
-            vc.nogimin.min(co);
-            vc.nogimax.max(ivec(co).add(size));
+            vc->nogimin.min(co);
+            vc->nogimax.max(ivec(co).add(size));
         }
     }
 
     if(c.ext && c.ext->ents)
     {
-        if(c.ext->ents->mapmodels.length()) vc.mapmodels.add(c.ext->ents);
-        if(c.ext->ents->decals.length()) vc.decals.add(c.ext->ents);
+        if(c.ext->ents->mapmodels.length()) vc->mapmodels.add(c.ext->ents);
+        if(c.ext->ents->decals.length()) vc->decals.add(c.ext->ents);
     }
 
     if(csi <= MAXMERGELEVEL && vamerges[csi].length()) addmergedverts(csi, co);
@@ -1444,9 +1307,9 @@ void calcgeombb(const ivec &co, int size, ivec &bbmin, ivec &bbmax)
     vec vmin(co), vmax = vmin;
     vmin.add(size);
 
-    loopv(vc.verts)
+    loopv(vc->verts)
     {
-        const vec &v = vc.verts[i].pos;
+        const vec &v = vc->verts[i].pos;
         vmin.min(v);
         vmax.max(v);
     }
@@ -1455,8 +1318,8 @@ void calcgeombb(const ivec &co, int size, ivec &bbmin, ivec &bbmax)
     bbmax = ivec(vmax.mul(8)).add(7).shr(3);
 }
 
-static int entdepth = -1;
-static octaentities *entstack[32];
+static THREADLOCAL int entdepth = -1;
+static THREADLOCAL octaentities *entstack[32];
 
 void setva(cube &c, const ivec &co, int size, int csi)
 {
@@ -1465,13 +1328,13 @@ void setva(cube &c, const ivec &co, int size, int csi)
     int vamergeoffset[MAXMERGELEVEL+1];
     loopi(MAXMERGELEVEL+1) vamergeoffset[i] = vamerges[i].length();
 
-    vc.origin = co;
-    vc.size = size;
+    vc->origin = co;
+    vc->size = size;
 
     loopi(entdepth+1)
     {
         octaentities *oe = entstack[i];
-        if(oe->decals.length()) vc.extdecals.add(oe);
+        if(oe->decals.length()) vc->extdecals.add(oe);
     }
 
     int maxlevel = -1;
@@ -1481,13 +1344,13 @@ void setva(cube &c, const ivec &co, int size, int csi)
 
     calcgeombb(co, size, bbmin, bbmax);
 
-    if(size == min(0x1000, worldsize/2) || !vc.emptyva())
+    if(size == min(0x1000, worldsize/2) || !vc->emptyva())
     {
         vtxarray *va = newva(co, size);
         ext(c).va = va;
         va->geommin = bbmin;
         va->geommax = bbmax;
-        calcmatbb(va, co, size, vc.matsurfs);
+        calcmatbb(va, co, size, vc->matsurfs);
         va->hasmerges = vahasmerges;
         va->mergelevel = vamergemax;
     }
@@ -1496,7 +1359,7 @@ void setva(cube &c, const ivec &co, int size, int csi)
         loopi(MAXMERGELEVEL+1) vamerges[i].setsize(vamergeoffset[i]);
     }
 
-    vc.clear();
+    vc->clear();
 }
 
 static inline int setcubevisibility(cube &c, const ivec &co, int size)
@@ -1528,20 +1391,39 @@ VARF(vafacemax, 64, 384, 256*256, allchanged());
 VARF(vafacemin, 0, 96, 256*256, allchanged());
 VARF(vacubesize, 32, 128, 0x1000, allchanged());
 
+static SDL_atomic_t vajobprogress;
+static THREADLOCAL int vajobcount = 0;
+
+static inline void updatevaprogress()
+{
+    if(!curvajob)
+    {
+        progress("recalculating geometry...");
+        loadprogress = clamp(recalcprogress/float(allocnodes), 0.0f, 1.0f);
+        return;
+    }
+    if(++vajobcount&0xFFF) return;
+    int total = SDL_AtomicAdd(&vajobprogress, 0x1000) + 0x1000;
+    if(curvajob->thread) return;
+    loadprogress = clamp(total/float(allocnodes), 0.0f, 1.0f);
+    renderprogress(loadprogress, "recalculating geometry...");
+}
+
 int updateva(cube *c, const ivec &co, int size, int csi)
 {
-    progress("recalculating geometry...");
+    updatevaprogress();
+    vector<vtxarray *> &roots = curvajob ? curvajob->roots : varoot;
     int ccount = 0, cmergemax = vamergemax, chasmerges = vahasmerges;
     neighbourstack[++neighbourdepth] = c;
     loopi(8)                                    // counting number of semi-solid/solid children cubes
     {
-        int count = 0, childpos = varoot.length();
+        int count = 0, childpos = roots.length();
         ivec o(i, co, size);
         vamergemax = 0;
         vahasmerges = 0;
         if(c[i].ext && c[i].ext->va)
         {
-            varoot.add(c[i].ext->va);
+            roots.add(c[i].ext->va);
             if(c[i].ext->va->hasmerges&MERGE_ORIGIN) findmergedfaces(c[i], o, size, csi, csi);
         }
         else
@@ -1556,17 +1438,16 @@ int updateva(cube *c, const ivec &co, int size, int csi)
             int tcount = count + (csi <= MAXMERGELEVEL ? vamerges[csi].length() : 0);
             if(tcount > vafacemax || (tcount >= vafacemin && size >= vacubesize) || size == min(0x1000, worldsize/2))
             {
-                loadprogress = clamp(recalcprogress/float(allocnodes), 0.0f, 1.0f);
                 setva(c[i], o, size, csi);
                 if(c[i].ext && c[i].ext->va)
                 {
-                    while(varoot.length() > childpos)
+                    while(roots.length() > childpos)
                     {
-                        vtxarray *child = varoot.pop();
+                        vtxarray *child = roots.pop();
                         c[i].ext->va->children.add(child);
                         child->parent = c[i].ext->va;
                     }
-                    varoot.add(c[i].ext->va);
+                    roots.add(c[i].ext->va);
                     if(vamergemax > size)
                     {
                         cmergemax = max(cmergemax, vamergemax);
@@ -1589,77 +1470,255 @@ int updateva(cube *c, const ivec &co, int size, int csi)
     return ccount;
 }
 
-void addtjoint(const edgegroup &g, const cubeedge &e, int offset)
+struct vabuilder
+{
+    vacollect vc;
+    vector<mergedface> merges[MAXMERGELEVEL+1];
+};
+
+static vector<vabuilder *> vabuilders;
+static vector<vajob> vajobs;
+
+static inline void bindvabuilder(int thread)
 {
-    int vcoord = (g.slope[g.axis]*offset + g.origin[g.axis]) & 0x7FFF;
-    tjoint &tj = tjoints.add();
-    tj.offset = vcoord / g.slope[g.axis];
-    tj.edge = e.index;
+    vc = &vabuilders[thread]->vc;
+    vamerges = vabuilders[thread]->merges;
+}
 
-    int prev = -1, cur = ext(*e.c).tjoints;
-    while(cur >= 0)
+// worker threads must never touch GL, so load every slot a subtree will render with up front
+static void loadvaslots(cube *c, const ivec &co, int size)
+{
+    vector<extentity *> &ents = entities::getents();
+    neighbourstack[++neighbourdepth] = c;
+    loopi(8)
     {
-        tjoint &o = tjoints[cur];
-        if(tj.edge < o.edge || (tj.edge==o.edge && (e.flags&CE_FLIP ? tj.offset > o.offset : tj.offset < o.offset))) break;
-        prev = cur;
-        cur = o.next;
+        ivec o(i, co, size);
+        if(c[i].ext)
+        {
+            if(c[i].ext->va) continue;
+            if(c[i].ext->ents) loopvj(c[i].ext->ents->decals) lookupdecalslot(ents[c[i].ext->ents->decals[j]]->attr[0], true);
+        }
+        if(c[i].children) loadvaslots(c[i].children, o, size/2);
+        else if(!isempty(c[i])) loopj(6)
+        {
+            VSlot &vslot = lookupvslot(c[i].texture[j], false);
+            if(vslot.linked && (!vslot.layer || lookupvslot(vslot.layer, false).linked)) continue;
+            if(!(c[i].merged&(1<<j)) && !visibletris(c[i], j, o, size)) continue;
+            lookupvslot(c[i].texture[j], true);
+            if(vslot.layer && !(c[i].material&MAT_ALPHA)) lookupvslot(vslot.layer, true);
+        }
     }
+    --neighbourdepth;
+}
+
+// aim for enough jobs to keep every thread busy even when a few subtrees hold most of the map
+#define VAJOBTARGET 64
 
-    tj.next = cur;
-    if(prev < 0) e.c->ext->tjoints = tjoints.length()-1;
-    else tjoints[prev].next = tjoints.length()-1;
+static int countvajobs(cube *c, int size, int jobsize)
+{
+    int count = 0;
+    loopi(8)
+    {
+        if(c[i].ext && c[i].ext->va) continue;
+        if(size > jobsize)
+        {
+            if(c[i].children) count += countvajobs(c[i].children, size/2, jobsize);
+        }
+        else if(c[i].children || size == min(0x1000, worldsize/2)) count++;
+    }
+    return count;
 }
 
-void findtjoints(int cur, const edgegroup &g)
+// every cube of the job size that lacks a va becomes an independent job, as whether it gets a va only
+// depends on its own subtree; merges escaping a job are found again by the main thread
+static void findvajobs(cube *c, const ivec &co, int size, int csi, int jobsize)
 {
-    int active = -1;
-    while(cur >= 0)
+    bool force = size == min(0x1000, worldsize/2);
+    neighbourstack[++neighbourdepth] = c;
+    loopi(8)
     {
-        cubeedge &e = cubeedges[cur];
-        int prevactive = -1, curactive = active;
-        while(curactive >= 0)
+        ivec o(i, co, size);
+        if(c[i].ext && c[i].ext->va) continue;
+        if(size > jobsize)
         {
-            cubeedge &a = cubeedges[curactive];
-            if(a.offset+a.size <= e.offset)
+            if(!c[i].children) continue;
+            octaentities *oe = c[i].ext ? c[i].ext->ents : NULL;
+            if(oe)
             {
-                if(prevactive >= 0) cubeedges[prevactive].next = a.next;
-                else active = a.next;
+                vector<extentity *> &ents = entities::getents();
+                loopvj(oe->decals) lookupdecalslot(ents[oe->decals[j]]->attr[0], true);
+                entstack[++entdepth] = oe;
             }
-            else
-            {
-                prevactive = curactive;
-                if(!(a.flags&CE_DUP))
-                {
-                    if(e.flags&CE_START && e.offset > a.offset && e.offset < a.offset+a.size)
-                        addtjoint(g, a, e.offset);
-                    if(e.flags&CE_END && e.offset+e.size > a.offset && e.offset+e.size < a.offset+a.size)
-                        addtjoint(g, a, e.offset+e.size);
-                }
-                if(!(e.flags&CE_DUP))
-                {
-                    if(a.flags&CE_START && a.offset > e.offset && a.offset < e.offset+e.size)
-                        addtjoint(g, e, a.offset);
-                    if(a.flags&CE_END && a.offset+a.size > e.offset && a.offset+a.size < e.offset+e.size)
-                        addtjoint(g, e, a.offset+a.size);
-                }
-            }
-            curactive = a.next;
+            findvajobs(c[i].children, o, size/2, csi-1, jobsize);
+            if(oe) --entdepth;
+            continue;
+        }
+        // leaves below the forced size are cheap, so the main thread takes them
+        if(!force && !c[i].children) continue;
+        vajob &j = vajobs.add();
+        j.c = &c[i];
+        j.o = o;
+        j.size = size;
+        j.csi = csi;
+        j.thread = 0;
+        j.force = force;
+        j.entdepth = entdepth;
+        memcpy(j.entstack, entstack, (entdepth+1)*sizeof(octaentities *));
+        j.neighbourdepth = neighbourdepth;
+        memcpy(j.neighbourstack, neighbourstack, (neighbourdepth+1)*sizeof(const cube *));
+        if(c[i].ext && c[i].ext->ents)
+        {
+            vector<extentity *> &ents = entities::getents();
+            loopvj(c[i].ext->ents->decals) lookupdecalslot(ents[c[i].ext->ents->decals[j]]->attr[0], true);
+        }
+        if(c[i].children) loadvaslots(c[i].children, o, size/2);
+        else if(!isempty(c[i])) loopj(6) if(c[i].merged&(1<<j) || visibletris(c[i], j, o, size))
+        {
+            VSlot &vslot = lookupvslot(c[i].texture[j], true);
+            if(vslot.layer && !(c[i].material&MAT_ALPHA)) lookupvslot(vslot.layer, true);
         }
-        int next = e.next;
-        e.next = active;
-        active = cur;
-        cur = next;
     }
+    --neighbourdepth;
 }
 
-void findtjoints()
+// mirrors one iteration of updateva, deferring the vbo uploads to the main thread
+static void buildvajob(void *data, int index, int thread)
 {
-    recalcprogress = 0;
-    gencubeedges();
-    tjoints.setsize(0);
-    enumeratekt(edgegroups, edgegroup, g, int, e, findtjoints(e, g));
-    cubeedges.setsize(0);
-    edgegroups.clear();
+    vajob &j = vajobs[index];
+    j.thread = thread;
+    int oldentdepth = entdepth, oldneighbourdepth = neighbourdepth;
+    entdepth = j.entdepth;
+    memcpy(entstack, j.entstack, (entdepth+1)*sizeof(octaentities *));
+    neighbourdepth = j.neighbourdepth;
+    memcpy(neighbourstack, j.neighbourstack, (neighbourdepth+1)*sizeof(const cube *));
+    bindvabuilder(thread);
+    curvajob = &j;
+
+    cube &c = *j.c;
+    vamergemax = 0;
+    vahasmerges = 0;
+    int count = 0;
+    if(c.children)
+    {
+        if(c.ext && c.ext->ents) entstack[++entdepth] = c.ext->ents;
+        count = updateva(c.children, j.o, j.size/2, j.csi-1);
+        if(c.ext && c.ext->ents) --entdepth;
+    }
+    else if(!isempty(c)) count = setcubevisibility(c, j.o, j.size);
+    int tcount = count + (j.csi <= MAXMERGELEVEL ? vamerges[j.csi].length() : 0);
+    if(j.force || tcount > vafacemax || (tcount >= vafacemin && j.size >= vacubesize)) setva(c, j.o, j.size, j.csi);
+    if(c.ext && c.ext->va)
+    {
+        vtxarray *va = c.ext->va;
+        loopv(j.roots)
+        {
+            vtxarray *child = j.roots[i];
+            va->children.add(child);
+            child->parent = va;
+        }
+        j.roots.setsize(0);
+        j.roots.add(va);
+    }
+    // the main thread renders the cube into an enclosing va instead and finds the vas below it as roots
+    else if(!j.force) j.roots.setsize(0);
+    // any merges escaping the job are still rendered by the enclosing va
+    loopi(MAXMERGELEVEL+1) vamerges[i].setsize(0);
+
+    curvajob = NULL;
+    bindvabuilder(0);
+    entdepth = oldentdepth;
+    neighbourdepth = oldneighbourdepth;
+}
+
+static inline bool dirtyvacmp(vtxarray *x, vtxarray *y) { return x->size < y->size; }
+
+// rebuilds only the vas whose own cubes were edited, keeping their parents and unchanged siblings
+static void rebuilddirtyvas()
+{
+    vector<vtxarray *> vas;
+    vas.move(dirtyvas);
+    vas.sort(dirtyvacmp);
+    loopv(vas)
+    {
+        vtxarray *old = vas[i], *parent = old->parent;
+        vajob &job = vajobs.add();
+        job.o = ivec(0, 0, 0);
+        job.size = worldsize/2;
+        job.csi = worldscale-1;
+        job.force = true;
+        cube *c = worldroot;
+        int oldentdepth = entdepth, oldneighbourdepth = neighbourdepth;
+        for(;;)
+        {
+            neighbourstack[++neighbourdepth] = c;
+            int idx = octastep(old->o.x, old->o.y, old->o.z, job.csi);
+            cube &cur = c[idx];
+            job.o = ivec(idx, job.o, job.size);
+            if(job.size <= old->size) { job.c = &cur; break; }
+            ASSERT(cur.children);
+            if(cur.ext && cur.ext->ents) entstack[++entdepth] = cur.ext->ents;
+            c = cur.children;
+            job.size /= 2;
+            job.csi--;
+        }
+        job.entdepth = entdepth;
+        memcpy(job.entstack, entstack, (entdepth+1)*sizeof(octaentities *));
+        job.neighbourdepth = neighbourdepth;
+        memcpy(job.neighbourstack, neighbourstack, (neighbourdepth+1)*sizeof(const cube *));
+        entdepth = oldentdepth;
+        neighbourdepth = oldneighbourdepth;
+
+        // the children are found again as existing vas and linked to the replacement
+        if(parent) parent->children.removeobj(old);
+        loopvj(old->children) old->children[j]->parent = NULL;
+        old->children.setsize(0);
+        destroyva(old, false);
+        job.c->ext->va = NULL;
+
+        buildvajob(NULL, 0, 0);
+        loopvj(job.pending)
+        {
+            uploadva(*job.pending[j]);
+            delete job.pending[j];
+        }
+        if(parent) loopvj(job.roots)
+        {
+            vtxarray *child = job.roots[j];
+            parent->children.add(child);
+            child->parent = parent;
+        }
+        for(vtxarray *va = parent; va; va = va->parent) va->bbmin.x = -1;
+        vajobs.shrink(0);
+    }
+}
+
+static void buildvajobs(int csi, int threads)
+{
+    int jobsize = min(0x1000, worldsize/2);
+    while(jobsize/2 >= vacubesize && countvajobs(worldroot, worldsize/2, jobsize) < VAJOBTARGET) jobsize /= 2;
+    vajobs.shrink(0);
+    findvajobs(worldroot, ivec(0, 0, 0), worldsize/2, csi-1, jobsize);
+    if(vajobs.length() <= 1)
+    {
+        vajobs.shrink(0);
+        return;
+    }
+
+    SDL_AtomicSet(&vajobprogress, recalcprogress);
+    runjobs(buildvajob, NULL, vajobs.length(), threads);
+    recalcprogress = SDL_AtomicGet(&vajobprogress);
+
+    // upload in job order so the vbo packing doesn't depend on which thread built what
+    loopv(vajobs)
+    {
+        vector<vabuffer *> &pending = vajobs[i].pending;
+        loopvj(pending)
+        {
+            uploadva(*pending[j]);
+            delete pending[j];
+        }
+    }
+    vajobs.shrink(0);
 }
 
 void octarender()                               // creates va s for all leaf cubes that don't already have them
@@ -1667,8 +1726,14 @@ void octarender()                               // creates va s for all leaf cub
     int csi = 0;
     while(1<<csi < worldsize) csi++;
 
+    int threads = jobthreadcount(vathreads);
+    while(vabuilders.length() < threads) vabuilders.add(new vabuilder);
+    bindvabuilder(0);
+
     recalcprogress = 0;
+    if(dirtyvas.length()) rebuilddirtyvas();
     varoot.setsize(0);
+    if(threads > 1) buildvajobs(csi, threads);
     updateva(worldroot, ivec(0, 0, 0), worldsize/2, csi-1);
     loadprogress = 0;
     flushvbo();
@@ -1726,6 +1791,7 @@ void allchanged(bool load)
     setupmaterials();
     clearshadowcache();
     updatevabbs(true);
+    buildlinearocta();
     if(load)
     {
         genshadowmeshes();
@@ -7,19 +7,76 @@
 #include "mpr.hh"
 #include "game.hh"
 
-const int MAXCLIPPLANES = 1024;
-static clipplanes clipcache[MAXCLIPPLANES];
+#define CLIPCACHEWAYS 4
+
+// set-associative clip plane cache, one per job thread so collision can run concurrently without locks
+struct clipplanecache
+{
+    clipplanes *entries;
+    uint *stamps, clock;
+    int numsets;
+    uint hits, misses, evictions;
+};
+static clipplanecache clipcaches[MAXJOBTHREADS];
 static int clipcacheversion = -2;
 
-static inline clipplanes &getclipplanes(const cube &c, const ivec &o, int size, bool collide = true, int offset = 0)
+static void clearclipcaches()
 {
-    clipplanes &p = clipcache[int(&c - worldroot)&(MAXCLIPPLANES-1)];
-    if(p.owner != &c || p.version != clipcacheversion+offset)
+    loopi(MAXJOBTHREADS)
     {
-        p.owner = &c;
-        p.version = clipcacheversion+offset;
-        genclipplanes(c, o, size, p, collide);
+        clipplanecache &cc = clipcaches[i];
+        DELETEA(cc.entries);
+        DELETEA(cc.stamps);
+        cc.numsets = 0;
     }
+}
+
+VARF(clipcachebits, 4, 8, 14, clearclipcaches());
+
+static void initclipcache(clipplanecache &cc)
+{
+    cc.numsets = 1<<clipcachebits;
+    cc.entries = new clipplanes[cc.numsets*CLIPCACHEWAYS];
+    memset(cc.entries, 0, cc.numsets*CLIPCACHEWAYS*sizeof(clipplanes));
+    cc.stamps = new uint[cc.numsets*CLIPCACHEWAYS];
+    memset(cc.stamps, 0, cc.numsets*CLIPCACHEWAYS*sizeof(uint));
+    cc.clock = 0;
+}
+
+static inline bool validclipplanes(const clipplanes &p)
+{
+    return p.owner && (p.version == clipcacheversion || p.version == clipcacheversion+1);
+}
+
+static inline clipplanes &getclipplanes(const cube &c, const ivec &o, int size, bool collide = true, int offset = 0)
+{
+    clipplanecache &cc = clipcaches[max(curjobthread, 0)];
+    if(!cc.entries) initclipcache(cc);
+    int set = (int(&c - worldroot)&(cc.numsets-1))*CLIPCACHEWAYS, version = clipcacheversion+offset;
+    clipplanes *ways = &cc.entries[set];
+    uint *stamps = &cc.stamps[set], clock = ++cc.clock;
+    int victim = 0;
+    uint oldest = UINT_MAX;
+    loopi(CLIPCACHEWAYS)
+    {
+        clipplanes &p = ways[i];
+        if(p.owner == &c && p.version == version)
+        {
+            cc.hits++;
+            stamps[i] = clock;
+            return p;
+        }
+        // stale entries are free to take, otherwise the least recently used way goes
+        uint age = validclipplanes(p) ? stamps[i] : 0;
+        if(age < oldest) { victim = i; oldest = age; }
+    }
+    cc.misses++;
+    clipplanes &p = ways[victim];
+    if(validclipplanes(p)) cc.evictions++;
+    p.owner = &c;
+    p.version = version;
+    stamps[victim] = clock;
+    genclipplanes(c, o, size, p, collide);
     return p;
 }
 
@@ -28,11 +85,52 @@ void resetclipplanes()
     clipcacheversion += 2;
     if(!clipcacheversion)
     {
-        memset(clipcache, 0, sizeof(clipcache));
+        loopi(MAXJOBTHREADS)
+        {
+            clipplanecache &cc = clipcaches[i];
+            if(cc.entries) memset(cc.entries, 0, cc.numsets*CLIPCACHEWAYS*sizeof(clipplanes));
+        }
         clipcacheversion = 2;
     }
 }
 
+static void clipcachestats(int *reset)
+{
+    uint hits = 0, misses = 0, evictions = 0;
+    loopi(MAXJOBTHREADS)
+    {
+        clipplanecache &cc = clipcaches[i];
+        if(!cc.hits && !cc.misses) continue;
+        conoutf("clip cache %d: %u hits, %u misses, %u evictions, %.1f%% hit rate",
+            i, cc.hits, cc.misses, cc.evictions, 100.0f*cc.hits/max(cc.hits + cc.misses, 1u));
+        hits += cc.hits;
+        misses += cc.misses;
+        evictions += cc.evictions;
+        if(*reset) cc.hits = cc.misses = cc.evictions = 0;
+    }
+    conoutf("clip cache total: %u hits, %u misses, %u evictions, %.1f%% hit rate, %d sets of %d ways",
+        hits, misses, evictions, 100.0f*hits/max(hits + misses, 1u), 1<<clipcachebits, CLIPCACHEWAYS);
+}
+COMMAND(clipcachestats, "i");
+
+static void mprcachestats(int *reset)
+{
+    uint queries = 0, reused = 0, separated = 0, full = 0;
+    loopi(MAXJOBTHREADS)
+    {
+        mpr::ContactCache &cc = mpr::contactcaches[i];
+        queries += cc.queries;
+        reused += cc.reused;
+        separated += cc.separated;
+        full += cc.full;
+        if(*reset) cc.queries = cc.reused = cc.separated = cc.full = 0;
+    }
+    float scale = 100.0f/max(queries, 1u);
+    conoutf("mpr cache: %u queries, %.1f%% reused, %.1f%% separated early, %.1f%% full queries",
+        queries, reused*scale, separated*scale, full*scale);
+}
+COMMAND(mprcachestats, "i");
+
 /////////////////////////  ray - cube collision ///////////////////////////////////////////////
 
 static inline bool pointinbox(const vec &v, const vec &bo, const vec &br)
@@ -200,11 +298,43 @@ static float shadowent(octaentities *oc, const vec &o, const vec &ray, float rad
     return dist;
 }
 
-#define INITRAYCUBE \
+// node accessors, so the same ray stepping walks either the pointer octree or its linearized copy
+struct cubewalk
+{
+    typedef cube *level;
+    typedef cube *node;
+
+    static level root() { return worldroot; }
+    static node child(level l, int i) { return &l[i]; }
+    static level children(node n) { return n->children; }
+    static octaentities *ents(node n) { return n->ext ? n->ext->ents : NULL; }
+    static cube &getcube(node n) { return *n; }
+    static bool empty(node n) { return isempty(*n); }
+    static bool solid(node n) { return isentirelysolid(*n); }
+    static ushort material(node n) { return n->material; }
+};
+
+// levels hold indexes of the first child of each family, 0 marks a leaf since the root family is never a child
+struct linearwalk
+{
+    typedef int level;
+    typedef const linearcube *node;
+
+    static level root() { return 0; }
+    static node child(level l, int i) { return &linearocta[l+i]; }
+    static level children(node n) { return n->children; }
+    static octaentities *ents(node n) { return n->flags&LINEAR_ENTS ? n->c->ext->ents : NULL; }
+    static cube &getcube(node n) { return *n->c; }
+    static bool empty(node n) { return (n->flags&LINEAR_EMPTY) != 0; }
+    static bool solid(node n) { return (n->flags&LINEAR_SOLID) != 0; }
+    static ushort material(node n) { return n->material; }
+};
+
+#define INITRAYCUBE(walk) \
     float dist = 0, dent = radius > 0 ? radius : 1e16f; \
     vec v(o), invray(ray.x ? 1/ray.x : 1e16f, ray.y ? 1/ray.y : 1e16f, ray.z ? 1/ray.z : 1e16f); \
-    cube *levels[20]; \
-    levels[worldscale] = worldroot; \
+    typename walk::level levels[20]; \
+    levels[worldscale] = walk::root(); \
     int lshift = worldscale, elvl = mode&RAY_BB ? worldscale : 0; \
     ivec lsizemask(invray.x>0 ? 1 : 0, invray.y>0 ? 1 : 0, invray.z>0 ? 1 : 0); \
 
@@ -229,15 +359,16 @@ static float shadowent(octaentities *oc, const vec &o, const vec &ray, float rad
         dist += disttoworld; \
     }
 
-#define DOWNOCTREE(disttoent, earlyexit) \
-        cube *lc = levels[lshift]; \
-        for(;;) \
+#define DOWNOCTREE(walk, disttoent, earlyexit) \
+        typename walk::node lc; \
+        for(typename walk::level lvl = levels[lshift];;) \
         { \
             lshift--; \
-            lc += octastep(x, y, z, lshift); \
-            if(lc->ext && lc->ext->ents && lshift < elvl) \
+            lc = walk::child(lvl, octastep(x, y, z, lshift)); \
+            octaentities *oc = walk::ents(lc); \
+            if(oc && lshift < elvl) \
             { \
-                float edist = disttoent(lc->ext->ents, o, ray, dent, mode, t); \
+                float edist = disttoent(oc, o, ray, dent, mode, t); \
                 if(edist < dent) \
                 { \
                     earlyexit return min(edist, dist); \
@@ -245,9 +376,9 @@ static float shadowent(octaentities *oc, const vec &o, const vec &ray, float rad
                     dent = min(dent, edist); \
                 } \
             } \
-            if(lc->children==NULL) break; \
-            lc = lc->children; \
-            levels[lshift] = lc; \
+            lvl = walk::children(lc); \
+            if(!lvl) break; \
+            levels[lshift] = lvl; \
         }
 
 #define FINDCLOSEST(xclosest, yclosest, zclosest) \
@@ -276,28 +407,27 @@ static float shadowent(octaentities *oc, const vec &o, const vec &ray, float rad
             diff >>= 1; \
         } while(diff);
 
-float raycube(const vec &o, const vec &ray, float radius, int mode, int size, extentity *t)
+template<class W>
+static float raycube(const vec &o, const vec &ray, float radius, int mode, int size, extentity *t)
 {
-    if(ray.iszero()) return 0;
-
-    INITRAYCUBE;
+    INITRAYCUBE(W);
     CHECKINSIDEWORLD;
 
     int closest = -1, x = int(v.x), y = int(v.y), z = int(v.z);
     for(;;)
     {
-        DOWNOCTREE(disttoent, if(mode&RAY_SHADOW));
+        DOWNOCTREE(W, disttoent, if(mode&RAY_SHADOW));
 
         int lsize = 1<<lshift;
 
-        cube &c = *lc;
+        ushort mat = W::material(lc);
         if((dist>0 || !(mode&RAY_SKIPFIRST)) &&
-           (((mode&RAY_CLIPMAT) && isclipped(c.material&MATF_VOLUME)) ||
-            ((mode&RAY_EDITMAT) && c.material != MAT_AIR) ||
-            (!(mode&RAY_PASS) && lsize==size && !isempty(c)) ||
-            isentirelysolid(c) ||
+           (((mode&RAY_CLIPMAT) && isclipped(mat&MATF_VOLUME)) ||
+            ((mode&RAY_EDITMAT) && mat != MAT_AIR) ||
+            (!(mode&RAY_PASS) && lsize==size && !W::empty(lc)) ||
+            W::solid(lc) ||
             dent < dist) &&
-            (!(mode&RAY_CLIPMAT) || (c.material&MATF_CLIP)!=MAT_NOCLIP))
+            (!(mode&RAY_CLIPMAT) || (mat&MATF_CLIP)!=MAT_NOCLIP))
         {
             if(dist < dent)
             {
@@ -317,8 +447,9 @@ float raycube(const vec &o, const vec &ray, float radius, int mode, int size, ex
 
         ivec lo(x&(~0<<lshift), y&(~0<<lshift), z&(~0<<lshift));
 
-        if(!isempty(c))
+        if(!W::empty(lc))
         {
+            cube &c = W::getcube(lc);
             const clipplanes &p = getclipplanes(c, lo, lsize, false, 1);
             float f = 0;
             if(raycubeintersect(p, c, v, ray, invray, dent-dist, f) && (dist+f>0 || !(mode&RAY_SKIPFIRST)) && (!(mode&RAY_CLIPMAT) || (c.material&MATF_CLIP)!=MAT_NOCLIP))
@@ -333,16 +464,22 @@ float raycube(const vec &o, const vec &ray, float radius, int mode, int size, ex
     }
 }
 
+float raycube(const vec &o, const vec &ray, float radius, int mode, int size, extentity *t)
+{
+    if(ray.iszero()) return 0;
+    return checklinearocta() ? raycube<linearwalk>(o, ray, radius, mode, size, t) : raycube<cubewalk>(o, ray, radius, mode, size, t);
+}
+
 // optimized version for light shadowing... every cycle here counts!!!
 float shadowray(const vec &o, const vec &ray, float radius, int mode, extentity *t)
 {
-    INITRAYCUBE;
+    INITRAYCUBE(cubewalk);
     CHECKINSIDEWORLD;
 
     int side = O_BOTTOM, x = int(v.x), y = int(v.y), z = int(v.z);
     for(;;)
     {
-        DOWNOCTREE(shadowent, );
+        DOWNOCTREE(cubewalk, shadowent, );
 
         cube &c = *lc;
         ivec lo(x&(~0<<lshift), y&(~0<<lshift), z&(~0<<lshift));
@@ -365,6 +502,45 @@ float shadowray(const vec &o, const vec &ray, float radius, int mode, extentity
     }
 }
 
+// compares the pointer octree against the linearized copy on the current map, e.g. "map test; linearoctabench 100000"
+static void linearoctabench(int *n)
+{
+    int queries = *n > 0 ? *n : 100000;
+    buildlinearocta();
+    if(!linearoctavalid) { conoutf(CON_ERROR, "linearized octree is disabled"); return; }
+
+    vector<vec> points, rays;
+    loopi(queries)
+    {
+        points.add(vec(rndscale(worldsize), rndscale(worldsize), rndscale(worldsize)));
+        rays.add(vec(rndscale(2)-1, rndscale(2)-1, rndscale(2)-1).normalize());
+    }
+
+    double freq = SDL_GetPerformanceFrequency();
+    double times[2][3];
+    int check[2] = { 0, 0 };
+    loopk(2)
+    {
+        linearoctavalid = k!=0;
+        Uint64 start = SDL_GetPerformanceCounter();
+        loopv(points) check[k] += lookupcube(ivec(points[i])).material;
+        Uint64 lookups = SDL_GetPerformanceCounter();
+        loopv(points) check[k] += lookupmaterial(points[i]);
+        Uint64 materials = SDL_GetPerformanceCounter();
+        loopv(points) check[k] += int(k ? raycube<linearwalk>(points[i], rays[i], 0, RAY_CLIPMAT|RAY_POLY, 0, NULL) : raycube<cubewalk>(points[i], rays[i], 0, RAY_CLIPMAT|RAY_POLY, 0, NULL));
+        Uint64 end = SDL_GetPerformanceCounter();
+        times[k][0] = (lookups - start)/freq;
+        times[k][1] = (materials - lookups)/freq;
+        times[k][2] = (end - materials)/freq;
+    }
+    linearoctavalid = true;
+
+    static const char * const names[3] = { "lookupcube", "lookupmaterial", "raycube" };
+    conoutf("%d queries over %d nodes (%d KB linearized)%s", queries, linearocta.length(), int(linearocta.length()*sizeof(linearcube)/1024), check[0] != check[1] ? ", RESULTS DIFFER" : "");
+    loopi(3) conoutf("%s: pointer %.2f ms, linear %.2f ms (%.2fx)", names[i], times[0][i]*1000, times[1][i]*1000, times[1][i] > 0 ? times[0][i]/times[1][i] : 0.0);
+}
+COMMAND(linearoctabench, "i");
+
 float rayent(const vec &o, const vec &ray, float radius, int mode, int size, int &orient, int &ent)
 {
     hitent = -1;
@@ -410,12 +586,111 @@ float rayfloor(const vec &o, vec &floor, int mode, float radius)
     return dist;
 }
 
+// batched ray casts for scripts tracing many rays at once, one call per batch instead of per ray
+
+static inline void castraysingle(int i, const vec *o, const vec *ray, float radius, const float *radii, int mode, float *dists, vec *normals)
+{
+    float rradius = radii ? radii[i] : radius;
+    hitsurface = vec(0, 0, 0);
+    float dist = raycube(o[i], ray[i], rradius, mode);
+    dists[i] = dist;
+    if(normals) normals[i] = dist >= 0 && (rradius <= 0 || dist < rradius) ? hitsurface : vec(0, 0, 0);
+}
+
+int raycubes(const vec *o, const vec *ray, int numrays, float *dists, vec *normals, float radius, int mode)
+{
+    if(numrays <= 0) return 0;
+    loopi(numrays) castraysingle(i, o, ray, radius, NULL, mode, dists, normals);
+    int hits = 0;
+    loopi(numrays) if(dists[i] >= 0 && (radius <= 0 || dists[i] < radius)) hits++;
+    return hits;
+}
+
+int raycubeslos(const vec *o, const vec *dest, int numrays, uchar *visible)
+{
+    if(numrays <= 0) return 0;
+    static vector<vec> rays;
+    static vector<float> mags, dists;
+    rays.setsize(0);
+    mags.setsize(0);
+    loopi(numrays)
+    {
+        vec &ray = rays.add(vec(dest[i]).sub(o[i]));
+        float mag = ray.magnitude();
+        if(mag > 0) ray.mul(1/mag);
+        mags.add(mag);
+    }
+    dists.setsize(0);
+    dists.pad(numrays);
+    loopi(numrays) castraysingle(i, o, rays.getbuf(), 0, mags.getbuf(), RAY_CLIPMAT|RAY_POLY, dists.getbuf(), NULL);
+    int numvisible = 0;
+    loopi(numrays)
+    {
+        visible[i] = mags[i] <= 0 || dists[i] >= mags[i] ? 1 : 0;
+        numvisible += visible[i];
+    }
+    return numvisible;
+}
+
 /////////////////////////  entity collision  ///////////////////////////////////////////////
 
-// info about collisions
-bool collideinside; // whether an internal collision happened
-physent *collideplayer; // whether the collection hit a player
-vec collidewall; // just the normal vectors.
+// info about collisions, per thread so physics jobs can collide concurrently
+THREADLOCAL bool collideinside; // whether an internal collision happened
+THREADLOCAL physent *collideplayer; // whether the collection hit a player
+THREADLOCAL vec collidewall; // just the normal vectors.
+
+enum { PHYSEVENT_TRIGGER = 0, PHYSEVENT_EXTENT, PHYSEVENT_DEADLY, PHYSEVENT_OFFMAP };
+
+struct physevent
+{
+    int type, floorlevel, waterlevel, value;
+    bool local;
+};
+
+// one entity moved against the world on a job thread, anything that calls into the game is recorded
+// and replayed on the main thread in entity order once all jobs are done
+struct physjob
+{
+    physent *d;
+    physent saved;
+    vector<physevent> events;
+    bool serial;
+};
+
+static THREADLOCAL physjob *curphysjob = NULL;
+
+static void dispatchphysevent(physent *d, const physevent &e)
+{
+    switch(e.type)
+    {
+        case PHYSEVENT_TRIGGER:
+            game::physicstrigger(d, e.local, e.floorlevel, e.waterlevel, e.value);
+            break;
+        case PHYSEVENT_EXTENT:
+            game::collideextent(((gameent *)d)->clientnum, e.value);
+            break;
+        case PHYSEVENT_DEADLY:
+            lua::L->call_external("physics_in_deadly", "ii", ((gameent *)d)->clientnum, e.value);
+            break;
+        case PHYSEVENT_OFFMAP:
+            lua::L->call_external("physics_off_map", "i", ((gameent *)d)->clientnum);
+            break;
+    }
+}
+
+static void firephysevent(physent *d, int type, bool local = false, int floorlevel = 0, int waterlevel = 0, int value = 0)
+{
+    physevent e;
+    e.type = type;
+    e.floorlevel = floorlevel;
+    e.waterlevel = waterlevel;
+    e.value = value;
+    e.local = local;
+    // the probes used by ragdolls and droptofloor aren't game entities, so they have no one to tell
+    if(type == PHYSEVENT_EXTENT && d->type == ENT_BOUNCE) return;
+    if(curphysjob) curphysjob->events.add(e);
+    else dispatchphysevent(d, e);
+}
 
 const float STAIRHEIGHT = 4.1f;
 const float FLOORZ = 0.867f;
@@ -516,73 +791,204 @@ bool ellipsecollide(physent *d, const vec &dir, const vec &o, const vec &center,
     return false;
 }
 
-#define DYNENTCACHESIZE 1024
-
-static uint dynentframe = 0;
+// sort-and-sweep broadphase over the live dynents, rebuilt lazily once per physics frame
+// entries stay sorted on their min x, so a query only walks the slice of the sweep that can reach it
+// entities wider than a dynentsize cell go on a separate list so they don't widen the window for everyone
 
-static struct dynentcacheentry
+struct dynentbounds
 {
-    int x, y;
-    uint frame;
-    vector<physent *> dynents;
-} dynentcache[DYNENTCACHESIZE];
+    physent *d;
+    vec bbmin, bbmax;
+
+    dynentbounds() {}
+    dynentbounds(physent *d) : d(d) { calc(); }
+
+    void calc()
+    {
+        bbmin = vec(d->o.x-d->radius, d->o.y-d->radius, d->o.z-d->eyeheight);
+        bbmax = vec(d->o.x+d->radius, d->o.y+d->radius, d->o.z+d->aboveeye);
+    }
+
+    bool overlaps(const vec &omin, const vec &omax) const
+    {
+        return bbmin.x <= omax.x && bbmax.x >= omin.x &&
+               bbmin.y <= omax.y && bbmax.y >= omin.y &&
+               bbmin.z <= omax.z && bbmax.z >= omin.z;
+    }
+};
+
+static uint dynentframe = 0, dynentsweepframe = 0;
+static vector<dynentbounds> dynentsweep, dynentlarge;
+
+VARF(dynentsize, 4, 7, 12, cleardynentcache());
 
 void cleardynentcache()
 {
     dynentframe++;
-    if(!dynentframe || dynentframe == 1) loopi(DYNENTCACHESIZE) dynentcache[i].frame = 0;
     if(!dynentframe) dynentframe = 1;
 }
 
-VARF(dynentsize, 4, 7, 12, cleardynentcache());
+static inline bool islargedynent(const dynentbounds &b)
+{
+    return b.bbmax.x - b.bbmin.x > (1<<dynentsize);
+}
 
-#define DYNENTHASH(x, y) (((((x)^(y))<<5) + (((x)^(y))>>5)) & (DYNENTCACHESIZE - 1))
+static inline bool sortdynentbounds(const dynentbounds &x, const dynentbounds &y)
+{
+    return x.bbmin.x < y.bbmin.x;
+}
+
+// sweepindex >= 0 is a slot in the sweep, < 0 is ~slot in the large list
+static inline dynentbounds *finddynentbounds(physent *d)
+{
+    if(d->sweepindex >= 0)
+    {
+        if(dynentsweep.inrange(d->sweepindex) && dynentsweep[d->sweepindex].d == d) return &dynentsweep[d->sweepindex];
+    }
+    else if(dynentlarge.inrange(~d->sweepindex) && dynentlarge[~d->sweepindex].d == d) return &dynentlarge[~d->sweepindex];
+    return NULL;
+}
 
-const vector<physent *> &checkdynentcache(int x, int y)
+// moves an entry back into place after its bounds changed, normally only a few steps
+static void resortdynent(int i)
 {
-    dynentcacheentry &dec = dynentcache[DYNENTHASH(x, y)];
-    if(dec.x == x && dec.y == y && dec.frame == dynentframe) return dec.dynents;
-    dec.x = x;
-    dec.y = y;
-    dec.frame = dynentframe;
-    dec.dynents.shrink(0);
-    int numdyns = game::numdynents(), dsize = 1<<dynentsize, dx = x<<dynentsize, dy = y<<dynentsize;
+    while(i > 0 && dynentsweep[i-1].bbmin.x > dynentsweep[i].bbmin.x)
+    {
+        swap(dynentsweep[i-1], dynentsweep[i]);
+        dynentsweep[i].d->sweepindex = i;
+        i--;
+    }
+    while(i+1 < dynentsweep.length() && dynentsweep[i+1].bbmin.x < dynentsweep[i].bbmin.x)
+    {
+        swap(dynentsweep[i+1], dynentsweep[i]);
+        dynentsweep[i].d->sweepindex = i;
+        i++;
+    }
+    dynentsweep[i].d->sweepindex = i;
+}
+
+static void insertdynent(physent *d)
+{
+    dynentbounds b(d);
+    if(islargedynent(b))
+    {
+        d->sweepindex = ~dynentlarge.length();
+        dynentlarge.add(b);
+    }
+    else
+    {
+        dynentsweep.add(b);
+        resortdynent(dynentsweep.length()-1);
+    }
+}
+
+static void removedynent(physent *d)
+{
+    if(d->sweepindex >= 0)
+    {
+        dynentsweep.remove(d->sweepindex);
+        for(int i = d->sweepindex; i < dynentsweep.length(); i++) dynentsweep[i].d->sweepindex = i;
+    }
+    else
+    {
+        int i = ~d->sweepindex;
+        dynentlarge.removeunordered(i);
+        if(dynentlarge.inrange(i)) dynentlarge[i].d->sweepindex = ~i;
+    }
+}
+
+static void builddynents()
+{
+    if(dynentsweepframe == dynentframe) return;
+    dynentsweepframe = dynentframe;
+    dynentsweep.setsize(0);
+    dynentlarge.setsize(0);
+    int numdyns = game::numdynents();
     loopi(numdyns)
     {
         dynent *d = game::iterdynents(i);
-        if(d->state != CS_ALIVE ||
-           d->o.x+d->radius <= dx || d->o.x-d->radius >= dx+dsize ||
-           d->o.y+d->radius <= dy || d->o.y-d->radius >= dy+dsize)
-            continue;
-        dec.dynents.add(d);
+        if(d->state != CS_ALIVE) continue;
+        dynentbounds b(d);
+        if(islargedynent(b))
+        {
+            d->sweepindex = ~dynentlarge.length();
+            dynentlarge.add(b);
+        }
+        else dynentsweep.add(b);
     }
-    return dec.dynents;
+    dynentsweep.sort(sortdynentbounds);
+    loopv(dynentsweep) dynentsweep[i].d->sweepindex = i;
 }
 
-#define loopdynentcache(curx, cury, o, radius) \
-    for(int curx = max(int(o.x-radius), 0)>>dynentsize, endx = min(int(o.x+radius), worldsize-1)>>dynentsize; curx <= endx; curx++) \
-    for(int cury = max(int(o.y-radius), 0)>>dynentsize, endy = min(int(o.y+radius), worldsize-1)>>dynentsize; cury <= endy; cury++)
-
 void updatedynentcache(physent *d)
 {
-    loopdynentcache(x, y, d->o, d->radius)
+    // not built yet this frame, the lazy build will pick up the new position
+    if(dynentsweepframe != dynentframe) return;
+    dynentbounds *b = finddynentbounds(d);
+    if(!b)
+    {
+        if(d->state == CS_ALIVE) insertdynent(d);
+        return;
+    }
+    bool large = d->sweepindex < 0;
+    b->calc();
+    if(islargedynent(*b) != large)
     {
-        dynentcacheentry &dec = dynentcache[DYNENTHASH(x, y)];
-        if(dec.x != x || dec.y != y || dec.frame != dynentframe || dec.dynents.find(d) >= 0) continue;
-        dec.dynents.add(d);
+        removedynent(d);
+        insertdynent(d);
     }
+    else if(!large) resortdynent(d->sweepindex);
+}
+
+int finddynents(const vec &bbmin, const vec &bbmax, vector<physent *> &ents)
+{
+    builddynents();
+    int numents = ents.length();
+    // nothing in the sweep is wider than a cell, so the first candidate starts no earlier than that
+    float sweepmin = bbmin.x - (1<<dynentsize);
+    int lo = 0, hi = dynentsweep.length();
+    while(lo < hi)
+    {
+        int mid = (lo + hi)/2;
+        if(dynentsweep[mid].bbmin.x < sweepmin) lo = mid + 1;
+        else hi = mid;
+    }
+    for(int i = lo; i < dynentsweep.length(); i++)
+    {
+        const dynentbounds &b = dynentsweep[i];
+        if(b.bbmin.x > bbmax.x) break;
+        if(b.overlaps(bbmin, bbmax)) ents.add(b.d);
+    }
+    loopv(dynentlarge) if(dynentlarge[i].overlaps(bbmin, bbmax)) ents.add(dynentlarge[i].d);
+    return ents.length() - numents;
+}
+
+int finddynents(const vec &o, float radius, vector<physent *> &ents)
+{
+    int numents = ents.length();
+    finddynents(vec(o).sub(radius), vec(o).add(radius), ents);
+    int kept = numents;
+    for(int i = numents; i < ents.length(); i++)
+    {
+        physent *d = ents[i];
+        vec closest(clamp(o.x, d->o.x-d->radius, d->o.x+d->radius),
+                    clamp(o.y, d->o.y-d->radius, d->o.y+d->radius),
+                    clamp(o.z, d->o.z-d->eyeheight, d->o.z+d->aboveeye));
+        if(closest.squaredist(o) <= radius*radius) ents[kept++] = d;
+    }
+    ents.setsize(kept);
+    return kept - numents;
 }
 
 bool overlapsdynent(const vec &o, float radius)
 {
-    loopdynentcache(x, y, o, radius)
+    static vector<physent *> dynents;
+    dynents.setsize(0);
+    finddynents(vec(o.x-radius, o.y-radius, -1e16f), vec(o.x+radius, o.y+radius, 1e16f), dynents);
+    loopv(dynents)
     {
-        const vector<physent *> &dynents = checkdynentcache(x, y);
-        loopv(dynents)
-        {
-            physent *d = dynents[i];
-            if(o.dist(d->o)-d->radius < radius) return true;
-        }
+        physent *d = dynents[i];
+        if(o.dist(d->o)-d->radius < radius) return true;
     }
     return false;
 }
@@ -593,7 +999,7 @@ static inline bool plcollide(physent *d, const vec &dir, physent *o)
     E entvol(d);
     O obvol(o);
     vec cp;
-    if(mpr::collide(entvol, obvol, NULL, NULL, &cp))
+    if(mpr::cachedcollide(entvol, obvol, NULL, NULL, &cp))
     {
         vec wn = vec(cp).sub(obvol.center());
         collidewall = obvol.contactface(wn, dir.iszero() ? vec(wn).neg() : dir);
@@ -603,40 +1009,46 @@ static inline bool plcollide(physent *d, const vec &dir, physent *o)
     return false;
 }
 
-bool plcollide(physent *d, const vec &dir)    // collide with player
+static physent *findplcollide(physent *d, const vec &dir)
 {
-    if(d->type==ENT_CAMERA || d->state!=CS_ALIVE) return false;
-    loopdynentcache(x, y, d->o, d->radius)
+    if(d->type==ENT_CAMERA || d->state!=CS_ALIVE) return NULL;
+    static vector<physent *> dynents;
+    dynents.setsize(0);
+    finddynents(vec(d->o.x-d->radius, d->o.y-d->radius, d->o.z-d->eyeheight), vec(d->o.x+d->radius, d->o.y+d->radius, d->o.z+d->aboveeye), dynents);
+    loopv(dynents)
     {
-        const vector<physent *> &dynents = checkdynentcache(x, y);
-        loopv(dynents)
+        physent *o = dynents[i];
+        if(o==d || d->o.reject(o->o, d->radius+o->radius)) continue;
+        switch(d->collidetype)
         {
-            physent *o = dynents[i];
-            if(o==d || d->o.reject(o->o, d->radius+o->radius)) continue;
-            switch(d->collidetype)
-            {
-                case COLLIDE_ELLIPSE:
-                    if(o->collidetype == COLLIDE_ELLIPSE)
-                    {
-                        if(!ellipsecollide(d, dir, o->o, vec(0, 0, 0), o->yaw, o->xradius, o->yradius, o->aboveeye, o->eyeheight)) continue;
-                    }
-                    else if(!ellipseboxcollide(d, dir, o->o, vec(0, 0, 0), o->yaw, o->xradius, o->yradius, o->aboveeye, o->eyeheight)) continue;
-                    break;
-                case COLLIDE_OBB:
-                    if(o->collidetype == COLLIDE_ELLIPSE)
-                    {
-                        if(!plcollide<mpr::EntOBB, mpr::EntCylinder>(d, dir, o)) continue;
-                    }
-                    else if(!plcollide<mpr::EntOBB, mpr::EntOBB>(d, dir, o)) continue;
-                    break;
-                default: continue;
-            }
-            collideplayer = o;
-            game::collidedynent(((gameent *)d)->clientnum, ((gameent *)o)->clientnum, collidewall);
-            return true;
+            case COLLIDE_ELLIPSE:
+                if(o->collidetype == COLLIDE_ELLIPSE)
+                {
+                    if(!ellipsecollide(d, dir, o->o, vec(0, 0, 0), o->yaw, o->xradius, o->yradius, o->aboveeye, o->eyeheight)) continue;
+                }
+                else if(!ellipseboxcollide(d, dir, o->o, vec(0, 0, 0), o->yaw, o->xradius, o->yradius, o->aboveeye, o->eyeheight)) continue;
+                break;
+            case COLLIDE_OBB:
+                if(o->collidetype == COLLIDE_ELLIPSE)
+                {
+                    if(!plcollide<mpr::EntOBB, mpr::EntCylinder>(d, dir, o)) continue;
+                }
+                else if(!plcollide<mpr::EntOBB, mpr::EntOBB>(d, dir, o)) continue;
+                break;
+            default: continue;
         }
+        return o;
     }
-    return false;
+    return NULL;
+}
+
+bool plcollide(physent *d, const vec &dir)    // collide with player
+{
+    physent *o = findplcollide(d, dir);
+    if(!o) return false;
+    collideplayer = o;
+    game::collidedynent(((gameent *)d)->clientnum, ((gameent *)o)->clientnum, collidewall);
+    return true;
 }
 
 void rotatebb(vec &center, vec &radius, int yaw, int pitch, int roll)
@@ -656,7 +1068,7 @@ static inline bool mmcollide(physent *d, const vec &dir, const extentity &e, con
     E entvol(d);
     M mdlvol(e.o, center, radius, yaw, pitch, roll);
     vec cp;
-    if(mpr::collide(entvol, mdlvol, NULL, NULL, &cp))
+    if(mpr::cachedcollide(entvol, mdlvol, NULL, NULL, &cp))
     {
         vec wn = vec(cp).sub(mdlvol.center());
         collidewall = mdlvol.contactface(wn, dir.iszero() ? vec(wn).neg() : dir);
@@ -806,7 +1218,7 @@ bool areacollide(physent *d, const vec &dir, float cutoff, const extentity &e) {
     }
     return false;
 collision:
-    game::collideextent(((gameent *)d)->clientnum, e.uid);
+    firephysevent(d, PHYSEVENT_EXTENT, false, 0, 0, e.uid);
     return e.attr[6];
 }
 
@@ -825,6 +1237,9 @@ bool mmcollide(physent *d, const vec &dir, float cutoff, octaentities &oc) // co
         }
         model *m = entities::getcollidemodel(e);
         if(!m) {
+            // loading models needs the main thread, let the serial pass redo this entity, other jobs just skip it
+            if(curphysjob) { curphysjob->serial = true; continue; }
+            if(curjobthread >= 0) continue;
             model *om = entities::getmodel(e);
             if (!om) continue;
             if (om->collidemodel) m = loadmodel(om->collidemodel);
@@ -842,7 +1257,11 @@ bool mmcollide(physent *d, const vec &dir, float cutoff, octaentities &oc) // co
         int yaw = e.attr[0], pitch = e.attr[1], roll = e.attr[2]; // OF
         if(mcol == COLLIDE_TRI || testtricol)
         {
-            if(!m->bih && !m->setBIH()) continue;
+            if(!m->bih)
+            {
+                if(curphysjob) { curphysjob->serial = true; continue; }
+                if(curjobthread >= 0 || !m->setBIH()) continue;
+            }
             switch(testtricol ? testtricol : d->collidetype)
             {
                 case COLLIDE_ELLIPSE:
@@ -887,7 +1306,7 @@ bool mmcollide(physent *d, const vec &dir, float cutoff, octaentities &oc) // co
         /* OF - collision handling; "return false" replaced with gotos above */
         continue;
 collision:
-        game::collideextent(((gameent *)d)->clientnum, e.uid);
+        firephysevent(d, PHYSEVENT_EXTENT, false, 0, 0, e.uid);
         return true;
     }
     return false;
@@ -1020,7 +1439,7 @@ static bool cubecollidesolid(physent *d, const vec &dir, float cutoff, const cub
         return false;
 
     E entvol(d);
-    bool collided = mpr::collide(mpr::SolidCube(co, size), entvol);
+    bool collided = mpr::cachedcollide(mpr::SolidCube(co, size), entvol);
     if(!collided) return false;
 
     collidewall = vec(0, 0, 0);
@@ -1051,7 +1470,7 @@ static bool cubecollideplanes(physent *d, const vec &dir, float cutoff, const cu
         return false;
 
     E entvol(d);
-    bool collided = mpr::collide(mpr::CubePlanes(p), entvol);
+    bool collided = mpr::cachedcollide(mpr::CubePlanes(p), entvol);
     if(!collided) return false;
 
     collidewall = vec(0, 0, 0);
@@ -1170,7 +1589,8 @@ bool collide(physent *d, const vec &dir, float cutoff, bool playercol)
     ivec bo(int(d->o.x-d->radius), int(d->o.y-d->radius), int(d->o.z-d->eyeheight)),
          bs(int(d->o.x+d->radius), int(d->o.y+d->radius), int(d->o.z+d->aboveeye));
     bs.add(1);  // guard space for rounding errors
-    return octacollide(d, dir, cutoff, bo, bs) || (playercol && plcollide(d, dir)); // collide with world
+    // physics jobs leave dynents to the serial pass in moveplayers
+    return octacollide(d, dir, cutoff, bo, bs) || (playercol && !curphysjob && plcollide(d, dir)); // collide with world
 }
 
 void recalcdir(physent *d, const vec &oldvel, vec &dir)
@@ -1781,7 +2201,7 @@ void modifyvelocity(physent *pl, bool local, bool water, bool floating, int curt
             pl->vel.z = max(pl->vel.z, pl->jumpvel); // physics impulse upwards
             if(water) { pl->vel.x /= 8.0f; pl->vel.y /= 8.0f; } // dampen velocity change even harder, gives correct water feel
 
-            game::physicstrigger(pl, local, 1, 0);
+            firephysevent(pl, PHYSEVENT_TRIGGER, local, 1, 0);
         }
     }
     if(!floating && pl->physstate == PHYS_FALL) pl->timeinair += curtime;
@@ -1895,11 +2315,11 @@ bool moveplayer(physent *pl, int moveres, bool local, int curtime)
         loopi(moveres) if(!move(pl, d) && ++collisions<5) i--; // discrete steps collision detection & sliding
         if(timeinair > 800 && !pl->timeinair && !water) // if we land after long time must have been a high jump, make thud sound
         {
-            game::physicstrigger(pl, local, -1, 0);
+            firephysevent(pl, PHYSEVENT_TRIGGER, local, -1, 0);
         }
     }
 
-    if(pl->state==CS_ALIVE) updatedynentcache(pl);
+    if(pl->state==CS_ALIVE && !curphysjob) updatedynentcache(pl);
 
     // automatically apply smooth roll when strafing
 
@@ -1913,14 +2333,14 @@ bool moveplayer(physent *pl, int moveres, bool local, int curtime)
         material = lookupmaterial(vec(pl->o.x, pl->o.y, pl->o.z + (pl->aboveeye - pl->eyeheight)/2));
         water = isliquid(material&MATF_VOLUME);
     }
-    if(!pl->inwater && water) game::physicstrigger(pl, local, 0, -1, material&MATF_VOLUME);
-    else if(pl->inwater && !water) game::physicstrigger(pl, local, 0, 1, pl->inwater);
+    if(!pl->inwater && water) firephysevent(pl, PHYSEVENT_TRIGGER, local, 0, -1, material&MATF_VOLUME);
+    else if(pl->inwater && !water) firephysevent(pl, PHYSEVENT_TRIGGER, local, 0, 1, pl->inwater);
     pl->inwater = water ? material&MATF_VOLUME : MAT_AIR;
 
     if (material&MAT_DEATH)
-        lua::L->call_external("physics_in_deadly", "ii", ((gameent *)pl)->clientnum, material&MATF_VOLUME);
+        firephysevent(pl, PHYSEVENT_DEADLY, local, 0, 0, material&MATF_VOLUME);
     else if (pl->o.z < 0)
-        lua::L->call_external("physics_off_map", "i", ((gameent *)pl)->clientnum);
+        firephysevent(pl, PHYSEVENT_OFFMAP, local);
     return true;
 }
 
@@ -1973,6 +2393,123 @@ void moveplayer(physent *pl, int moveres, bool local)
     }
 }
 
+VARP(physthreads, 0, 0, 16);
+VAR(physjobmin, 1, 64, 4096);
+
+static vector<physjob> physjobs;
+static int physjobmoveres = 1;
+static bool physjoblocal = false;
+
+static void movephysjob(void *data, int job, int thread)
+{
+    physjob &j = physjobs[job];
+    curphysjob = &j;
+    moveplayer(j.d, physjobmoveres, physjoblocal);
+    curphysjob = NULL;
+}
+
+struct physsweep
+{
+    vec bbmin, bbmax;
+    int job;
+};
+
+static vector<physsweep> physsweeps;
+
+static inline bool sortphyssweep(const physsweep &x, const physsweep &y)
+{
+    return x.bbmin.x < y.bbmin.x;
+}
+
+// any two batched entities whose paths come close enough to touch are left to the serial pass,
+// since each job only saw the other where it started
+static void sweepphysjobs(int numents)
+{
+    physsweeps.setsize(0);
+    loopi(numents)
+    {
+        physjob &j = physjobs[i];
+        physent *d = j.d;
+        if(j.serial || d->type==ENT_CAMERA || d->state!=CS_ALIVE) continue;
+        physsweep &s = physsweeps.add();
+        s.bbmin = vec(min(d->o.x, j.saved.o.x) - d->radius, min(d->o.y, j.saved.o.y) - d->radius, min(d->o.z, j.saved.o.z) - d->eyeheight);
+        s.bbmax = vec(max(d->o.x, j.saved.o.x) + d->radius, max(d->o.y, j.saved.o.y) + d->radius, max(d->o.z, j.saved.o.z) + d->aboveeye);
+        s.job = i;
+    }
+    physsweeps.sort(sortphyssweep);
+    loopv(physsweeps)
+    {
+        physsweep &s = physsweeps[i];
+        for(int k = i+1; k < physsweeps.length() && physsweeps[k].bbmin.x <= s.bbmax.x; k++)
+        {
+            physsweep &t = physsweeps[k];
+            if(t.bbmin.y > s.bbmax.y || t.bbmax.y < s.bbmin.y || t.bbmin.z > s.bbmax.z || t.bbmax.z < s.bbmin.z) continue;
+            physjobs[s.job].serial = physjobs[t.job].serial = true;
+        }
+    }
+}
+
+// tests the path a job moved along against the other dynents, checked every radius so nothing is passed through
+static bool sweepplcollide(physent *d, const vec &from)
+{
+    vec to = d->o, step = vec(to).sub(from);
+    int steps = max(int(ceil(step.magnitude() / max(d->radius, 1.0f))), 1);
+    bool hit = false;
+    for(int i = 1; i <= steps && !hit; i++)
+    {
+        d->o = vec(step).mul(float(i)/steps).add(from);
+        if(findplcollide(d, vec(0, 0, 0))) hit = true;
+    }
+    d->o = to;
+    return hit;
+}
+
+// moves a batch of entities, with enough of them the world collision runs on the job pool and only
+// dynent collision and the game callbacks are resolved afterwards, in the order the entities were given
+void moveplayers(physent **ents, int numents, int moveres, bool local)
+{
+    int threads = jobthreadcount(physthreads);
+    if(numents < physjobmin || threads <= 1 || physsteps <= 0)
+    {
+        loopi(numents) moveplayer(ents[i], moveres, local);
+        return;
+    }
+
+    while(physjobs.length() < numents) physjobs.add();
+    loopi(numents)
+    {
+        physjob &j = physjobs[i];
+        j.d = ents[i];
+        j.saved = *ents[i];
+        j.events.setsize(0);
+        j.serial = false;
+    }
+    physjobmoveres = moveres;
+    physjoblocal = local;
+    runjobs(movephysjob, NULL, numents, threads);
+
+    // publish every new position before testing overlaps so each test sees where everyone ended up
+    loopi(numents) if(ents[i]->state==CS_ALIVE) updatedynentcache(ents[i]);
+    sweepphysjobs(numents);
+    loopi(numents)
+    {
+        physjob &j = physjobs[i];
+        physent *d = j.d;
+        if(!j.serial && !sweepplcollide(d, j.saved.o))
+        {
+            loopvk(j.events) dispatchphysevent(d, j.events[k]);
+            continue;
+        }
+        // redo the whole step serially from where it started, which also collides against other dynents;
+        // the sweep was resorted since the job started, so the entity keeps its current slot in it
+        int sweepindex = d->sweepindex;
+        *d = j.saved;
+        d->sweepindex = sweepindex;
+        if(d->state==CS_ALIVE) updatedynentcache(d);
+        moveplayer(d, moveres, local);
+    }
+}
+
 bool bounce(physent *d, float elasticity, float waterfric, float grav)
 {
     if(physsteps <= 0)
@@ -2059,7 +2596,7 @@ static inline bool platformcollide(physent *d, const vec &dir, physent *o)
     E entvol(d);
     O obvol(o);
     vec cp;
-    if(mpr::collide(entvol, obvol, NULL, NULL, &cp))
+    if(mpr::cachedcollide(entvol, obvol, NULL, NULL, &cp))
     {
         vec wn = vec(cp).sub(obvol.center());
         return !obvol.contactface(wn, dir.iszero() ? vec(wn).neg() : dir).iszero();
@@ -2103,16 +2640,15 @@ bool moveplatform(physent *p, const vec &dir)
 
     static vector<platforment> ents;
     ents.setsize(0);
-    for(int x = int(max(p->o.x-p->radius-PLATFORMBORDER, 0.0f))>>dynentsize, ex = int(min(p->o.x+p->radius+PLATFORMBORDER, worldsize-1.0f))>>dynentsize; x <= ex; x++)
-    for(int y = int(max(p->o.y-p->radius-PLATFORMBORDER, 0.0f))>>dynentsize, ey = int(min(p->o.y+p->radius+PLATFORMBORDER, worldsize-1.0f))>>dynentsize; y <= ey; y++)
+    static vector<physent *> dynents;
+    dynents.setsize(0);
+    finddynents(vec(p->o.x-p->radius-PLATFORMBORDER, p->o.y-p->radius-PLATFORMBORDER, p->o.z+p->aboveeye),
+                vec(p->o.x+p->radius+PLATFORMBORDER, p->o.y+p->radius+PLATFORMBORDER, 1e16f), dynents);
+    loopv(dynents)
     {
-        const vector<physent *> &dynents = checkdynentcache(x, y);
-        loopv(dynents)
-        {
-            physent *d = dynents[i];
-            if(p==d || d->o.z-d->eyeheight < p->o.z+p->aboveeye || p->o.reject(d->o, p->radius+PLATFORMBORDER+d->radius) || ents.find(d) >= 0) continue;
-            ents.add(d);
-        }
+        physent *d = dynents[i];
+        if(p==d || d->o.z-d->eyeheight < p->o.z+p->aboveeye || p->o.reject(d->o, p->radius+PLATFORMBORDER+d->radius)) continue;
+        ents.add(d);
     }
     static vector<platforment *> passengers, colliders;
     passengers.setsize(0);
@@ -2171,7 +2707,7 @@ bool moveplatform(physent *p, const vec &dir)
             physent *d = passengers[i]->d;
             d->o.add(dir);
             d->newpos.add(dir);
-            if(dir.x || dir.y) updatedynentcache(d);
+            if(!dir.iszero()) updatedynentcache(d);
         }
     }
     else loopv(passengers) // move any stacked passengers who aren't colliding with non-passengers
@@ -2182,7 +2718,7 @@ bool moveplatform(physent *p, const vec &dir)
         physent *d = ent->d;
         d->o.add(dir);
         d->newpos.add(dir);
-        if(dir.x || dir.y) updatedynentcache(d);
+        if(!dir.iszero()) updatedynentcache(d);
 
         for(int n = ent->stacks; n>=0; n = collisions[n].next)
         {
@@ -2193,7 +2729,7 @@ bool moveplatform(physent *p, const vec &dir)
 
     p->o.add(dir);
     p->newpos.add(dir);
-    if(dir.x || dir.y) updatedynentcache(p);
+    if(!dir.iszero()) updatedynentcache(p);
 
     return true;
 }
@@ -2260,3 +2796,74 @@ CLUAICOMMAND(ray_floor, float, (float x, float y, float z, float radius), {
 });
 
 CLUAICOMMAND(setgravity, void, (float grav), GRAVITY = grav;);
+
+// rays holds origin and direction per ray, out receives the distance and hit normal per ray
+CLUAICOMMAND(ray_batch, int, (const float *rays, int numrays, float radius, float *out), {
+    vector<vec> o;
+    vector<vec> dir;
+    vector<vec> normals;
+    vector<float> dists;
+    loopi(numrays)
+    {
+        const float *r = &rays[i*6];
+        o.add(vec(r[0], r[1], r[2]));
+        dir.add(vec(r[3], r[4], r[5]).normalize());
+    }
+    dists.pad(numrays);
+    normals.pad(numrays);
+    int hits = raycubes(o.getbuf(), dir.getbuf(), numrays, dists.getbuf(), normals.getbuf(), radius, RAY_CLIPMAT|RAY_POLY);
+    loopi(numrays)
+    {
+        float *r = &out[i*4];
+        r[0] = dists[i];
+        r[1] = normals[i].x;
+        r[2] = normals[i].y;
+        r[3] = normals[i].z;
+    }
+    return hits;
+});
+
+// rays holds origin and target per ray, out receives whether each target is visible
+CLUAICOMMAND(ray_batch_los, int, (const float *rays, int numrays, bool *out), {
+    vector<vec> o;
+    vector<vec> dest;
+    vector<uchar> visible;
+    loopi(numrays)
+    {
+        const float *r = &rays[i*6];
+        o.add(vec(r[0], r[1], r[2]));
+        dest.add(vec(r[3], r[4], r[5]));
+    }
+    visible.pad(numrays);
+    int numvisible = raycubeslos(o.getbuf(), dest.getbuf(), numrays, visible.getbuf());
+    loopi(numrays) out[i] = visible[i] != 0;
+    return numvisible;
+});
+
+static int pushdynents(lua_State *L, const vector<physent *> &ents)
+{
+    lua_createtable(L, ents.length(), 0);
+    loopv(ents)
+    {
+        lua_pushinteger(L, i);
+        lua_pushinteger(L, ((gameent *)ents[i])->clientnum);
+        lua_settable   (L, -3);
+    }
+    lua_pushinteger(L, ents.length());
+    return 2;
+}
+
+LUAICOMMAND(find_dynents, {
+    vec o(luaL_checknumber(L, 1), luaL_checknumber(L, 2), luaL_checknumber(L, 3));
+    vector<physent *> ents;
+    finddynents(o, luaL_checknumber(L, 4), ents);
+    return pushdynents(L, ents);
+});
+
+LUAICOMMAND(find_dynents_box, {
+    vec bbmin(luaL_checknumber(L, 1), luaL_checknumber(L, 2), luaL_checknumber(L, 3));
+    vec bbmax(luaL_checknumber(L, 4), luaL_checknumber(L, 5), luaL_checknumber(L, 6));
+    vector<physent *> ents;
+    finddynents(bbmin, bbmax, ents);
+    return pushdynents(L, ents);
+});
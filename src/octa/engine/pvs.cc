@@ -257,21 +257,54 @@ static inline bool htcmp(const pvsdata &x, const pvsdata &y)
     return x.len==y.len && !memcmp(&pvsbuf[x.offset], &pvsbuf[y.offset], x.len);
 }
 
-static SDL_mutex *pvsmutex = NULL;
 static hashtable<pvsdata, int> pvscompress;
 static vector<pvsdata> pvs;
 
-static SDL_mutex *viewcellmutex = NULL;
+static int addpvs(const uchar *data, int len)
+{
+    pvsdata key(pvsbuf.length(), len);
+    pvsbuf.put(data, len);
+    int *val = pvscompress.access(key);
+    if(val) pvsbuf.setsize(key.offset);
+    else
+    {
+        val = &pvscompress[key];
+        *val = pvs.length();
+        pvs.add(key);
+    }
+    return *val;
+}
+
+// dedups the view cells of a single worker thread, so no lock is needed until the final merge
+struct localpvskey
+{
+    const vector<uchar> *buf;
+    int offset, len;
+};
+
+static inline uint hthash(const localpvskey &k)
+{
+    uint h = 5381;
+    loopi(k.len) h = ((h<<5)+h)^(*k.buf)[k.offset+i];
+    return h;
+}
+
+static inline bool htcmp(const localpvskey &x, const localpvskey &y)
+{
+    return x.len==y.len && !memcmp(&(*x.buf)[x.offset], &(*y.buf)[y.offset], x.len);
+}
+
 struct viewcellrequest
 {
     int *result;
     ivec o;
     int size;
+    int worker, local, reuse;
 };
 static vector<viewcellrequest> viewcellrequests;
 
 static bool genpvs_canceled = false;
-static int numviewcells = 0;
+static SDL_atomic_t numviewcells, numlocalpvs;
 
 VAR(maxpvsblocker, 1, 512, 1<<16);
 VAR(pvsleafsize, 1, 64, 1024);
@@ -288,7 +321,7 @@ uint numwaterplanes = 0;
 
 struct pvsworker
 {
-    pvsworker() : thread(NULL), pvsnodes(new pvsnode[origpvsnodes.length()])
+    pvsworker(int index = 0) : thread(NULL), pvsnodes(new pvsnode[origpvsnodes.length()]), index(index), head(0), tail(0), lock(0)
     {
     }
     ~pvsworker()
@@ -299,6 +332,15 @@ struct pvsworker
     SDL_Thread *thread;
     pvsnode *pvsnodes;
 
+    // this worker's share of viewcellrequests, popped from the tail by the owner and stolen from the head by others
+    int index, head, tail;
+    SDL_SpinLock lock;
+
+    vector<uchar> localbuf;
+    hashtable<localpvskey, int> localcompress;
+    vector<pvsdata> localpvs;
+    vector<int> remap;
+
     shaftbb viewcellbb;
 
     pvsnode *levels[32];
@@ -772,42 +814,68 @@ struct pvsworker
         return buf;
     }
 
+    void putpvs(vector<uchar> &buf)
+    {
+        loopi(waterbytes) buf.add((wateroccluded>>(i*8))&0xFF);
+        buf.put(outbuf.getbuf(), outbuf.length());
+    }
+
     int genviewcell(const ivec &co, int size)
     {
         calcpvs(co, size);
 
-        if(pvsmutex) SDL_LockMutex(pvsmutex);
-        numviewcells++;
-        pvsdata key(pvsbuf.length(), waterbytes + outbuf.length());
-        loopi(waterbytes) pvsbuf.add((wateroccluded>>(i*8))&0xFF);
-        pvsbuf.put(outbuf.getbuf(), outbuf.length());
-        int *val = pvscompress.access(key);
-        if(val) pvsbuf.setsize(key.offset);
+        SDL_AtomicIncRef(&numviewcells);
+        localbuf.setsize(0);
+        putpvs(localbuf);
+        return addpvs(localbuf.getbuf(), localbuf.length());
+    }
+
+    int genlocalviewcell(const ivec &co, int size)
+    {
+        calcpvs(co, size);
+
+        localpvskey key = { &localbuf, localbuf.length(), waterbytes + outbuf.length() };
+        putpvs(localbuf);
+        int *val = localcompress.access(key);
+        if(val) localbuf.setsize(key.offset);
         else
         {
-            val = &pvscompress[key];
-            *val = pvs.length();
-            pvs.add(key);
+            val = &localcompress[key];
+            *val = localpvs.length();
+            localpvs.add(pvsdata(key.offset, key.len));
+            SDL_AtomicIncRef(&numlocalpvs);
         }
-        if(pvsmutex) SDL_UnlockMutex(pvsmutex);
+        SDL_AtomicIncRef(&numviewcells);
         return *val;
     }
 
-    static int run(void *data)
+    viewcellrequest *popviewcell()
     {
-        pvsworker *w = (pvsworker *)data;
-        SDL_LockMutex(viewcellmutex);
-        while(viewcellrequests.length())
-        {
-            viewcellrequest req = viewcellrequests.pop();
-            SDL_UnlockMutex(viewcellmutex);
-            int result = w->genviewcell(req.o, req.size);
-            SDL_LockMutex(viewcellmutex);
-            *req.result = result;
-        }
-        SDL_UnlockMutex(viewcellmutex);
-        return 0;
+        viewcellrequest *req = NULL;
+        SDL_AtomicLock(&lock);
+        if(tail > head) req = &viewcellrequests[--tail];
+        SDL_AtomicUnlock(&lock);
+        return req;
+    }
+
+    viewcellrequest *stealviewcell()
+    {
+        viewcellrequest *req = NULL;
+        SDL_AtomicLock(&lock);
+        if(tail > head) req = &viewcellrequests[head++];
+        SDL_AtomicUnlock(&lock);
+        return req;
     }
+
+    int remaining()
+    {
+        SDL_AtomicLock(&lock);
+        int n = tail - head;
+        SDL_AtomicUnlock(&lock);
+        return n;
+    }
+
+    static int run(void *data);
 };
 
 struct viewcellnode
@@ -840,9 +908,109 @@ static Uint32 genpvs_timer(Uint32 interval, void *param)
     return interval;
 }
 
+// the previous view cells while updating, so cells the changes can't affect keep their old data
+struct pvsreuse
+{
+    viewcellnode *viewcells;
+    vector<uchar> buf;
+    vector<pvsdata> pvs;
+    uint numwaterplanes;
+    int waterplanes[MAXWATERPVS];
+    ivec bbmin, bbmax;
+    int reused;
+
+    pvsreuse() : viewcells(NULL), numwaterplanes(0), reused(0) {}
+    ~pvsreuse() { DELETEP(viewcells); }
+};
+
+static pvsreuse *reusepvs = NULL;
+static ivec pvsdirtymin(INT_MAX, INT_MAX, INT_MAX), pvsdirtymax(INT_MIN, INT_MIN, INT_MIN);
+
+void changedpvs(const ivec &bbmin, const ivec &bbmax)
+{
+    pvsdirtymin.min(ivec(bbmin).sub(1));
+    pvsdirtymax.max(ivec(bbmax).add(1));
+}
+
+static inline bool pvsoccluded(uchar *buf, const ivec &bbmin, const ivec &bbmax);
+
+static int findreusablepvs(const ivec &o, int size)
+{
+    pvsreuse &r = *reusepvs;
+    if(o.x < r.bbmax.x && o.x+size > r.bbmin.x &&
+       o.y < r.bbmax.y && o.y+size > r.bbmin.y &&
+       o.z < r.bbmax.z && o.z+size > r.bbmin.z)
+        return -1;
+    viewcellnode *vc = r.viewcells;
+    for(int scale = worldscale-1; scale >= 0; scale--)
+    {
+        int i = octastep(o.x, o.y, o.z, scale);
+        if(vc->leafmask&(1<<i))
+        {
+            int id = vc->children[i].pvs;
+            if(id < 0 || 1<<scale != size) return -1;
+            // cells that couldn't see any of the changes can't have seen past them either
+            const pvsdata &d = r.pvs[id];
+            return pvsoccluded(&r.buf[d.offset + d.len%9], r.bbmin, r.bbmax) ? id : -1;
+        }
+        vc = vc->children[i].node;
+    }
+    return -1;
+}
+
+static int addreusedpvs(int id)
+{
+    const pvsdata &d = reusepvs->pvs[id];
+    reusepvs->reused++;
+    return addpvs(&reusepvs->buf[d.offset], d.len);
+}
+
+static SDL_atomic_t activepvsworkers;
+
+int pvsworker::run(void *data)
+{
+    pvsworker *w = (pvsworker *)data;
+    while(!genpvs_canceled)
+    {
+        viewcellrequest *req = w->popviewcell();
+        // no more work is ever added, so once every queue is empty this worker is done
+        for(int i = 1; !req && i < pvsworkers.length(); i++) req = pvsworkers[(w->index + i)%pvsworkers.length()]->stealviewcell();
+        if(!req) break;
+        if(req->reuse >= 0) { SDL_AtomicIncRef(&numviewcells); continue; }
+        req->worker = w->index;
+        req->local = w->genlocalviewcell(req->o, req->size);
+    }
+    SDL_AtomicAdd(&activepvsworkers, -1);
+    return 0;
+}
+
+// assigns global pvs ids in view cell order, so the result is the same as a single threaded run
+static void mergepvsworkers()
+{
+    loopv(pvsworkers)
+    {
+        pvsworker &w = *pvsworkers[i];
+        w.remap.setsize(0);
+        loopvj(w.localpvs) w.remap.add(-1);
+    }
+    loopv(viewcellrequests)
+    {
+        viewcellrequest &req = viewcellrequests[i];
+        if(req.reuse >= 0) { *req.result = addreusedpvs(req.reuse); continue; }
+        pvsworker &w = *pvsworkers[req.worker];
+        int &id = w.remap[req.local];
+        if(id < 0)
+        {
+            const pvsdata &d = w.localpvs[req.local];
+            id = addpvs(&w.localbuf[d.offset], d.len);
+        }
+        *req.result = id;
+    }
+}
+
 static int totalviewcells = 0;
 
-static void show_genpvs_progress(int unique = pvs.length(), int processed = numviewcells)
+static void show_genpvs_progress(int unique = pvs.length(), int processed = SDL_AtomicGet(&numviewcells))
 {
     float bar1 = float(processed) / float(totalviewcells>0 ? totalviewcells : 1);
 
@@ -927,10 +1095,16 @@ static void genviewcells(viewcellnode &p, cube *c, const ivec &co, int size, int
             if(isallclip(h.children)) continue;
         }
         else if(isentirelysolid(h) || (h.material&MATF_CLIP)==MAT_CLIP) continue;
+        int reuse = reusepvs ? findreusablepvs(o, size) : -1;
         if(pvsworkers.length())
         {
             if(genpvs_canceled) return;
-            p.children[i].pvs = pvsworkers[0]->genviewcell(o, size);
+            if(reuse >= 0)
+            {
+                SDL_AtomicIncRef(&numviewcells);
+                p.children[i].pvs = addreusedpvs(reuse);
+            }
+            else p.children[i].pvs = pvsworkers[0]->genviewcell(o, size);
             if(check_genpvs_progress) show_genpvs_progress();
         }
         else
@@ -939,6 +1113,7 @@ static void genviewcells(viewcellnode &p, cube *c, const ivec &co, int size, int
             req.result = &p.children[i].pvs;
             req.o = o;
             req.size = size;
+            req.reuse = reuse;
         }
     }
 }
@@ -948,6 +1123,55 @@ static int lockedwaterplanes[MAXWATERPVS];
 static uchar *curpvs = NULL, *lockedpvs = NULL;
 static int curwaterpvs = 0, lockedwaterpvs = 0;
 
+// the current view cell flattened into a dense grid, one bit per cell along x so a box tests whole rows at once
+#define PVSGRIDBITS 6
+#define PVSGRIDSIZE (1<<PVSGRIDBITS)
+
+VAR(pvsgrid, 0, 1, 1);
+
+static ullong pvshidden[PVSGRIDSIZE*PVSGRIDSIZE], pvsvisible[PVSGRIDSIZE*PVSGRIDSIZE]; // cell has some hidden/visible part
+static uchar *pvsgridbuf = NULL;
+static int pvsgridshift = 0;
+
+static void markpvsgrid(const ivec &o, int size, bool hidden)
+{
+    ivec lo = ivec(o).shr(pvsgridshift), hi = ivec(o).add(size-1).shr(pvsgridshift);
+    ullong mask = (~0ULL>>(63-(hi.x-lo.x)))<<lo.x;
+    ullong *rows = hidden ? pvshidden : pvsvisible;
+    for(int z = lo.z; z <= hi.z; z++) for(int y = lo.y; y <= hi.y; y++) rows[(z<<PVSGRIDBITS)|y] |= mask;
+}
+
+static void flattenpvs(const uchar *buf, const ivec &co, int size)
+{
+    uchar leafmask = buf[0];
+    loopi(8)
+    {
+        ivec o(i, co, size);
+        if(leafmask&(1<<i))
+        {
+            uchar leafvalues = buf[1+i];
+            if(!leafvalues || leafvalues==0xFF) markpvsgrid(o, size, leafvalues!=0);
+            else
+            {
+                int subsize = max(size>>1, 1);
+                loopj(8) markpvsgrid(ivec(j, o, subsize), subsize, (leafvalues>>j)&1);
+            }
+        }
+        else flattenpvs(buf+9*buf[1+i], o, size>>1);
+    }
+}
+
+static void updatepvsgrid()
+{
+    if(pvsgridbuf == curpvs) return;
+    pvsgridbuf = curpvs;
+    if(!curpvs) return;
+    pvsgridshift = max(worldscale - PVSGRIDBITS, 0);
+    memset(pvshidden, 0, sizeof(pvshidden));
+    memset(pvsvisible, 0, sizeof(pvsvisible));
+    flattenpvs(curpvs, ivec(0, 0, 0), worldsize>>1);
+}
+
 static inline pvsdata *lookupviewcell(const vec &p)
 {
     uint x = uint(floor(p.x)), y = uint(floor(p.y)), z = uint(floor(p.z));
@@ -967,6 +1191,7 @@ static inline pvsdata *lookupviewcell(const vec &p)
 
 static void lockpvs_(bool lock)
 {
+    pvsgridbuf = NULL;
     if(lockedpvs) DELETEA(lockedpvs);
     if(!lock) return;
     pvsdata *d = lookupviewcell(camera1->o);
@@ -1004,14 +1229,18 @@ void setviewcell(const vec &p)
         }
     }
     if(!usepvs || !usewaterpvs) curwaterpvs = 0;
+    updatepvsgrid();
 }
 
 void clearpvs()
 {
+    pvsdirtymin = ivec(INT_MAX, INT_MAX, INT_MAX);
+    pvsdirtymax = ivec(INT_MIN, INT_MIN, INT_MIN);
     DELETEP(viewcells);
     pvs.setsize(0);
     pvsbuf.setsize(0);
     curpvs = NULL;
+    pvsgridbuf = NULL;
     numwaterplanes = 0;
     lockpvs = 0;
     lockpvs_(false);
@@ -1113,6 +1342,17 @@ void genpvs(int *viewcellsize)
     clearpvs();
     calcpvsbounds();
     findwaterplanes();
+    if(reusepvs)
+    {
+        bool samewater = reusepvs->numwaterplanes == numwaterplanes;
+        loopi(numwaterplanes) if(reusepvs->waterplanes[i] != waterplanes[i].height) samewater = false;
+        if(!samewater)
+        {
+            conoutf("water changed, regenerating all view cells");
+            reusepvs->bbmin = ivec(0, 0, 0);
+            reusepvs->bbmax = ivec(worldsize, worldsize, worldsize);
+        }
+    }
 
     pvsnode &root = origpvsnodes.add();
     memset(root.edges.v, 0xFF, 3);
@@ -1121,7 +1361,8 @@ void genpvs(int *viewcellsize)
     genpvsnodes(worldroot);
 
     totalviewcells = countviewcells(worldroot, ivec(0, 0, 0), worldsize>>1, *viewcellsize>0 ? *viewcellsize : 32);
-    numviewcells = 0;
+    SDL_AtomicSet(&numviewcells, 0);
+    SDL_AtomicSet(&numlocalpvs, 0);
     genpvs_canceled = false;
     check_genpvs_progress = false;
     SDL_TimerID timer = 0;
@@ -1140,27 +1381,25 @@ void genpvs(int *viewcellsize)
     else
     {
         renderprogress(0, "creating threads");
-        if(!pvsmutex) pvsmutex = SDL_CreateMutex();
-        if(!viewcellmutex) viewcellmutex = SDL_CreateMutex();
+        int numrequests = viewcellrequests.length();
         loopi(numthreads)
         {
-            pvsworker *w = pvsworkers.add(new pvsworker);
-            w->thread = SDL_CreateThread(pvsworker::run, "pvs worker", w);
+            pvsworker *w = pvsworkers.add(new pvsworker(i));
+            w->head = int((long long)numrequests*i/numthreads);
+            w->tail = int((long long)numrequests*(i+1)/numthreads);
         }
+        SDL_AtomicSet(&activepvsworkers, numthreads);
+        loopv(pvsworkers) pvsworkers[i]->thread = SDL_CreateThread(pvsworker::run, "pvs worker", pvsworkers[i]);
         show_genpvs_progress(0, 0);
-        while(!genpvs_canceled)
+        while(!genpvs_canceled && SDL_AtomicGet(&activepvsworkers) > 0)
         {
             SDL_Delay(500);
-            SDL_LockMutex(viewcellmutex);
-            int unique = pvs.length(), processed = numviewcells, remaining = viewcellrequests.length();
-            SDL_UnlockMutex(viewcellmutex);
-            show_genpvs_progress(unique, processed);
-            if(!remaining) break;
+            // unique counts per thread until the merge, so may include cells duplicated across threads
+            show_genpvs_progress(SDL_AtomicGet(&numlocalpvs), SDL_AtomicGet(&numviewcells));
         }
-        SDL_LockMutex(viewcellmutex);
-        viewcellrequests.setsize(0);
-        SDL_UnlockMutex(viewcellmutex);
         loopv(pvsworkers) SDL_WaitThread(pvsworkers[i]->thread, NULL);
+        if(!genpvs_canceled) mergepvsworkers();
+        viewcellrequests.setsize(0);
     }
     pvsworkers.deletecontents();
 
@@ -1173,12 +1412,58 @@ void genpvs(int *viewcellsize)
         clearpvs();
         conoutf("genpvs aborted");
     }
-    else conoutf("generated %d unique view cells totaling %.1f kB and averaging %d B (%.1f seconds)",
+    else
+    {
+        conoutf("generated %d unique view cells totaling %.1f kB and averaging %d B (%.1f seconds)",
             pvs.length(), pvsbuf.length()/1024.0f, pvsbuf.length()/max(pvs.length(), 1), (end - start) / 1000.0f);
+        if(reusepvs) conoutf("reused %d of %d view cells", reusepvs->reused, totalviewcells);
+    }
 }
 
 COMMAND(genpvs, "i");
 
+// regenerates only the view cells that could see the geometry changed since the pvs was generated or loaded,
+// viewcellsize must match the one the pvs was generated with
+void updatepvs(int *viewcellsize)
+{
+    if(!viewcells)
+    {
+        conoutf(CON_ERROR, "no PVS to update, use genpvs");
+        return;
+    }
+    if(pvsdirtymin.x > pvsdirtymax.x)
+    {
+        conoutf("PVS is up to date");
+        return;
+    }
+
+    reusepvs = new pvsreuse;
+    swap(reusepvs->viewcells, viewcells);
+    reusepvs->buf.move(pvsbuf);
+    reusepvs->pvs.move(pvs);
+    reusepvs->numwaterplanes = numwaterplanes;
+    loopi(numwaterplanes) reusepvs->waterplanes[i] = waterplanes[i].height;
+    reusepvs->bbmin = ivec(pvsdirtymin).max(0);
+    reusepvs->bbmax = ivec(pvsdirtymax).min(worldsize);
+
+    genpvs(viewcellsize);
+
+    if(genpvs_canceled)
+    {
+        // keep the old, stale pvs rather than none at all
+        swap(viewcells, reusepvs->viewcells);
+        pvsbuf.move(reusepvs->buf);
+        pvs.move(reusepvs->pvs);
+        numwaterplanes = reusepvs->numwaterplanes;
+        loopi(numwaterplanes) waterplanes[i].height = reusepvs->waterplanes[i];
+        pvsdirtymin.min(reusepvs->bbmin);
+        pvsdirtymax.max(reusepvs->bbmax);
+    }
+    DELETEP(reusepvs);
+}
+
+COMMAND(updatepvs, "i");
+
 void pvsstats()
 {
     conoutf("%d unique view cells totaling %.1f kB and averaging %d B",
@@ -1224,17 +1509,80 @@ static inline bool pvsoccluded(uchar *buf, const ivec &bbmin, const ivec &bbmax)
     return pvsoccluded(buf, ivec(bbmin).mask(~((2<<scale)-1)), 1<<scale, bbmin, bbmax);
 }
 
+// 1 if the box is hidden, 0 if it touches a fully visible cell, -1 if only the tree can tell
+static inline int pvsgridoccluded(const ivec &bbmin, const ivec &bbmax)
+{
+    if((bbmin.x|bbmin.y|bbmin.z) < 0 || bbmax.x > worldsize || bbmax.y > worldsize || bbmax.z > worldsize ||
+       bbmax.x <= bbmin.x || bbmax.y <= bbmin.y || bbmax.z <= bbmin.z)
+        return -1;
+    ivec lo = ivec(bbmin).shr(pvsgridshift), hi = ivec(bbmax).sub(1).shr(pvsgridshift);
+    ullong mask = (~0ULL>>(63-(hi.x-lo.x)))<<lo.x, partial = 0;
+    for(int z = lo.z; z <= hi.z; z++) for(int y = lo.y; y <= hi.y; y++)
+    {
+        int row = (z<<PVSGRIDBITS)|y;
+        ullong visible = pvsvisible[row]&mask;
+        if(visible&~pvshidden[row]) return 0;
+        partial |= visible;
+    }
+    return partial ? -1 : 1;
+}
+
+static inline bool curpvsoccluded(const ivec &bbmin, const ivec &bbmax)
+{
+    if(pvsgrid)
+    {
+        int occluded = pvsgridoccluded(bbmin, bbmax);
+        if(occluded >= 0) return occluded!=0;
+    }
+    return pvsoccluded(curpvs, bbmin, bbmax);
+}
+
 bool pvsoccluded(const ivec &bbmin, const ivec &bbmax)
 {
-    return curpvs!=NULL && pvsoccluded(curpvs, bbmin, bbmax);
+    return curpvs!=NULL && curpvsoccluded(bbmin, bbmax);
 }
 
 bool pvsoccludedsphere(const vec &center, float radius)
 {
     if(curpvs==NULL) return false;
     ivec bbmin = vec(center).sub(radius), bbmax = vec(center).add(radius+1);
-    return pvsoccluded(curpvs, bbmin, bbmax);
+    return curpvsoccluded(bbmin, bbmax);
+}
+
+int pvsoccluded(const ivec *bbmin, const ivec *bbmax, int numboxes, uchar *occluded)
+{
+    if(curpvs==NULL)
+    {
+        memset(occluded, 0, numboxes);
+        return 0;
+    }
+    int count = 0;
+    loopi(numboxes) count += (occluded[i] = curpvsoccluded(bbmin[i], bbmax[i]) ? 1 : 0);
+    return count;
+}
+
+// compares the tree walk against the grid for the vertex arrays of the current view cell, e.g. "pvsgridbench 100"
+// the grid keeps to 64-bit row words: testing two rows per SSE2 op measured slower, as most boxes are decided
+// by their first row and the vector version has to gather both before it can exit
+static void pvsgridbench(int *n)
+{
+    if(!curpvs) { conoutf(CON_ERROR, "no view cell at the camera"); return; }
+    extern vector<vtxarray *> valist;
+    int rounds = *n > 0 ? *n : 100, oldgrid = pvsgrid;
+    double freq = SDL_GetPerformanceFrequency(), times[2];
+    int hidden[2] = { 0, 0 };
+    loopk(2)
+    {
+        pvsgrid = k;
+        Uint64 start = SDL_GetPerformanceCounter();
+        loopj(rounds) loopv(valist) hidden[k] += curpvsoccluded(valist[i]->bbmin, valist[i]->bbmax) ? 1 : 0;
+        times[k] = (SDL_GetPerformanceCounter() - start)/freq;
+    }
+    pvsgrid = oldgrid;
+    conoutf("%d vertex arrays x %d rounds, %d hidden%s", valist.length(), rounds, hidden[1]/rounds, hidden[0] != hidden[1] ? ", RESULTS DIFFER" : "");
+    conoutf("tree %.2f ms, grid %.2f ms (%.2fx)", times[0]*1000, times[1]*1000, times[1] > 0 ? times[0]/times[1] : 0.0);
 }
+COMMAND(pvsgridbench, "i");
 
 bool waterpvsoccluded(int height)
 {
@@ -33,7 +33,6 @@ struct ragdollskel
     struct rotfriction
     {
         int tri[2];
-        matrix3 middle;
     };
 
     struct joint
@@ -135,9 +134,10 @@ struct ragdolldata
     vec offset, center;
     float radius, timestep, scale;
     vert *verts;
-    matrix3 *tris;
+    matrix3 *tris, *rotfrictions;
     matrix4x3 *animjoints;
     dualquat *reljoints;
+    bool lod;
 
     ragdolldata(ragdollskel *skel, float scale = 1)
         : skel(skel),
@@ -152,8 +152,10 @@ struct ragdolldata
           scale(scale),
           verts(new vert[skel->verts.length()]),
           tris(new matrix3[skel->tris.length()]),
+          rotfrictions(skel->rotfrictions.empty() ? NULL : new matrix3[skel->rotfrictions.length()]),
           animjoints(!skel->animjoints || skel->joints.empty() ? NULL : new matrix4x3[skel->joints.length()]),
-          reljoints(skel->reljoints.empty() ? NULL : new dualquat[skel->reljoints.length()])
+          reljoints(skel->reljoints.empty() ? NULL : new dualquat[skel->reljoints.length()]),
+          lod(false)
     {
     }
 
@@ -161,6 +163,7 @@ struct ragdolldata
     {
         delete[] verts;
         delete[] tris;
+        if(rotfrictions) delete[] rotfrictions;
         if(animjoints) delete[] animjoints;
         if(reljoints) delete[] reljoints;
     }
@@ -241,7 +244,8 @@ struct ragdolldata
                 type = ENT_BOUNCE;
                 radius = xradius = yradius = eyeheight = aboveeye = 1;
             }
-        } v;
+        } vertents[MAXJOBTHREADS];
+        vertent &v = vertents[max(curjobthread, 0)];
         v.o = pos;
         if(v.radius != radius) v.radius = v.xradius = v.yradius = v.eyeheight = v.aboveeye = radius;
         return collide(&v, dir, 0, false);
@@ -254,6 +258,9 @@ struct ragdolldata
     parented transform = parent{invert(curtri) * origtrig} * (invert(parent{base2anim}) * base2anim)
 */
 
+// stays scalar: the limits gather and scatter verts through index lists, so testing four limits at
+// once with SSE only covers the sqrt and range check and measured slower (280 vs 340 ns for 47 limits),
+// and the whole pass is about 4% of a ragdoll step next to collidevert
 void ragdolldata::constraindist()
 {
     float invscale = 1.0f/scale;
@@ -336,7 +343,7 @@ void ragdolldata::calcrotfriction()
     loopv(skel->rotfrictions)
     {
         ragdollskel::rotfriction &r = skel->rotfrictions[i];
-        r.middle.transposemul(tris[r.tri[0]], tris[r.tri[1]]);
+        rotfrictions[i].transposemul(tris[r.tri[0]], tris[r.tri[1]]);
     }
 }
 
@@ -348,7 +355,7 @@ void ragdolldata::applyrotfriction(float ts)
     {
         ragdollskel::rotfriction &r = skel->rotfrictions[i];
         matrix3 rot;
-        rot.mul(tris[r.tri[0]], r.middle);
+        rot.mul(tris[r.tri[0]], rotfrictions[i]);
         rot.multranspose(tris[r.tri[1]]);
 
         vec axis;
@@ -397,10 +404,12 @@ void ragdolldata::tryunstick(float speed)
 }
 
 VAR(ragdollconstrain, 1, 7, 100);
+VAR(ragdollconstrainlod, 1, 3, 100);
 
 void ragdolldata::constrain()
 {
-    loopi(ragdollconstrain)
+    int iterations = lod ? min(ragdollconstrainlod, ragdollconstrain) : ragdollconstrain;
+    loopi(iterations)
     {
         constraindist();
         loopvj(skel->verts)
@@ -446,6 +455,32 @@ FVAR(ragdollunstick, 0, 10, 1e3f);
 VAR(ragdollexpireoffset, 0, 2500, 30000);
 VAR(ragdollwaterexpireoffset, 0, 4000, 30000);
 
+// a ragdoll stepped on a job thread can't call into the game, its water transitions wait here
+struct ragdolljob
+{
+    dynent *d;
+    float dist;
+    int numtriggers;
+    int triggers[4][2];
+};
+
+static THREADLOCAL ragdolljob *curragdolljob = NULL;
+
+static inline void ragdolltrigger(dynent *d, int waterlevel, int material)
+{
+    if(curragdolljob)
+    {
+        if(curragdolljob->numtriggers < 4)
+        {
+            int *t = curragdolljob->triggers[curragdolljob->numtriggers++];
+            t[0] = waterlevel;
+            t[1] = material;
+        }
+        return;
+    }
+    game::physicstrigger(d, true, 0, waterlevel, material);
+}
+
 void ragdolldata::move(dynent *pl, float ts)
 {
     extern float GRAVITY;
@@ -454,12 +489,12 @@ void ragdolldata::move(dynent *pl, float ts)
 
     int material = lookupmaterial(vec(center.x, center.y, center.z + radius/2));
     bool water = isliquid(material&MATF_VOLUME);
-    if(!pl->inwater && water) game::physicstrigger(pl, true, 0, -1, material&MATF_VOLUME);
+    if(!pl->inwater && water) ragdolltrigger(pl, -1, material&MATF_VOLUME);
     else if(pl->inwater && !water)
     {
         material = lookupmaterial(center);
         water = isliquid(material&MATF_VOLUME);
-        if(!water) game::physicstrigger(pl, true, 0, 1, pl->inwater);
+        if(!water) ragdolltrigger(pl, 1, pl->inwater);
     }
     pl->inwater = water ? material&MATF_VOLUME : MAT_AIR;
 
@@ -511,27 +546,101 @@ void ragdolldata::move(dynent *pl, float ts)
 FVAR(ragdolleyesmooth, 0, 0.5f, 1);
 VAR(ragdolleyesmoothmillis, 1, 250, 10000);
 
-void moveragdoll(dynent *d)
+FVAR(ragdolllod, 0, 512, 1e5f);
+VAR(ragdollmaxactive, 0, 32, 1024);
+VAR(ragdollthreads, 0, 0, 16);
+
+static float calcragdolllod(dynent *d)
 {
-    if(!curtime || !d->ragdoll) return;
+    float dist = camera1->o.dist(d->ragdoll->center);
+    d->ragdoll->lod = ragdolllod > 0 && dist > ragdolllod;
+    return dist;
+}
+
+static inline bool ragdollmoving(dynent *d)
+{
+    return !d->ragdoll->collidemillis || lastmillis < d->ragdoll->collidemillis;
+}
 
-    if(!d->ragdoll->collidemillis || lastmillis < d->ragdoll->collidemillis)
+static void stepragdoll(dynent *d)
+{
+    int lastmove = d->ragdoll->lastmove;
+    while(d->ragdoll->lastmove + (lastmove == d->ragdoll->lastmove ? ragdolltimestepmin : ragdolltimestepmax) <= lastmillis)
     {
-        int lastmove = d->ragdoll->lastmove;
-        while(d->ragdoll->lastmove + (lastmove == d->ragdoll->lastmove ? ragdolltimestepmin : ragdolltimestepmax) <= lastmillis)
-        {
-            int timestep = min(ragdolltimestepmax, lastmillis - d->ragdoll->lastmove);
-            d->ragdoll->move(d, timestep/1000.0f);
-            d->ragdoll->lastmove += timestep;
-        }
+        int timestep = min(ragdolltimestepmax, lastmillis - d->ragdoll->lastmove);
+        d->ragdoll->move(d, timestep/1000.0f);
+        d->ragdoll->lastmove += timestep;
     }
+}
 
+static void updateragdolleye(dynent *d)
+{
     vec eye = d->ragdoll->skel->eye >= 0 ? d->ragdoll->verts[d->ragdoll->skel->eye].pos : d->ragdoll->center;
     eye.add(d->ragdoll->offset);
     float k = pow(ragdolleyesmooth, float(curtime)/ragdolleyesmoothmillis);
     d->o.lerp(eye, 1-k);
 }
 
+void moveragdoll(dynent *d)
+{
+    if(!curtime || !d->ragdoll) return;
+
+    calcragdolllod(d);
+    if(ragdollmoving(d)) stepragdoll(d);
+    updateragdolleye(d);
+}
+
+static vector<ragdolljob> ragdolljobs;
+
+static inline bool sortragdolljobs(const ragdolljob &x, const ragdolljob &y)
+{
+    return x.dist < y.dist;
+}
+
+static void moveragdolljob(void *data, int job, int thread)
+{
+    ragdolljob &j = ragdolljobs[job];
+    curragdolljob = &j;
+    stepragdoll(j.d);
+    curragdolljob = NULL;
+}
+
+// steps many ragdolls at once: distant ones get fewer constraint iterations, only the nearest
+// ragdollmaxactive are stepped at all, and the steps are spread over the job pool
+void moveragdolls(dynent **ds, int numds)
+{
+    if(!curtime) return;
+
+    ragdolljobs.setsize(0);
+    loopi(numds)
+    {
+        dynent *d = ds[i];
+        if(!d->ragdoll) continue;
+        float dist = calcragdolllod(d);
+        if(!ragdollmoving(d)) continue;
+        ragdolljob &j = ragdolljobs.add();
+        j.d = d;
+        j.dist = dist;
+        j.numtriggers = 0;
+    }
+    if(ragdollmaxactive && ragdolljobs.length() > ragdollmaxactive)
+    {
+        ragdolljobs.sort(sortragdolljobs);
+        // ragdolls over the cap hold still this frame instead of catching up on it later
+        for(int i = ragdollmaxactive; i < ragdolljobs.length(); i++) ragdolljobs[i].d->ragdoll->lastmove = lastmillis;
+        ragdolljobs.setsize(ragdollmaxactive);
+    }
+
+    runjobs(moveragdolljob, NULL, ragdolljobs.length(), ragdollthreads);
+
+    loopv(ragdolljobs)
+    {
+        ragdolljob &j = ragdolljobs[i];
+        loopk(j.numtriggers) game::physicstrigger(j.d, true, 0, j.triggers[k][0], j.triggers[k][1]);
+    }
+    loopi(numds) if(ds[i]->ragdoll) updateragdolleye(ds[i]);
+}
+
 void cleanragdoll(dynent *d)
 {
     DELETEP(d->ragdoll);
@@ -1608,12 +1608,15 @@ struct shadowmapinfo
     shadowcacheval *cached;
 };
 
+// cached placements outlive the frame they were rendered in: entries of lights that are not visible stay
+// reserved in the atlas while there is room for them, so a light coming back into view reuses its shadow map
 struct shadowcacheval
 {
     ushort x, y, size, sidemask;
+    int lastused;
 
     shadowcacheval() {}
-    shadowcacheval(const shadowmapinfo &sm) : x(sm.x), y(sm.y), size(sm.size), sidemask(sm.sidemask) {}
+    shadowcacheval(const shadowmapinfo &sm, int lastused) : x(sm.x), y(sm.y), size(sm.size), sidemask(sm.sidemask), lastused(lastused) {}
 };
 
 struct shadowcache : hashtable<shadowcachekey, shadowcacheval>
@@ -1634,7 +1637,15 @@ GLuint shadowatlastex = 0, shadowatlasfbo = 0;
 GLenum shadowatlastarget = GL_NONE;
 shadowcache shadowcache;
 bool shadowcachefull = false;
-int evictshadowcache = 0;
+int evictshadowcache = 0, shadowcacheframe = 0;
+int shadowcachehits = 0, shadowcachemisses = 0, shadowcacheevictions = 0, shadowcachedefrags = 0, shadowcacheinvalidations = 0;
+
+VAR(smcacheage, 0, 1800, 1000000);
+VAR(smcachefill, 0, 75, 100);
+VAR(smcachedefrag, 0, 8, 1024);
+
+static inline int shadowcachewidth(const shadowcachekey &k, const shadowcacheval &c) { return k.spot ? c.size : 3*c.size; }
+static inline int shadowcacheheight(const shadowcachekey &k, const shadowcacheval &c) { return k.spot ? c.size : 2*c.size; }
 
 static inline void setsmnoncomparemode() // use texture gather
 {
@@ -1862,11 +1873,45 @@ vector<shadowmapinfo> shadowmaps;
 void clearshadowcache()
 {
     shadowmaps.setsize(0);
+    shadowcache.reset();
 
     clearradiancehintscache();
     clearshadowmeshes();
 }
 
+static vector<shadowcachekey> staleshadows;
+
+// drops only the cached shadow maps of lights whose radius reaches into the changed box
+void clearshadowcache(const ivec &bbmin, const ivec &bbmax)
+{
+    staleshadows.setsize(0);
+    loopi(shadowcache.size) for(void *ec = shadowcache.chains[i]; ec; ec = shadowcache.enumnext(ec))
+    {
+        const shadowcachekey &k = shadowcache.enumkey(ec);
+        if(k.o.x + k.radius >= bbmin.x && k.o.x - k.radius <= bbmax.x &&
+           k.o.y + k.radius >= bbmin.y && k.o.y - k.radius <= bbmax.y &&
+           k.o.z + k.radius >= bbmin.z && k.o.z - k.radius <= bbmax.z)
+            staleshadows.add(k);
+    }
+    loopv(staleshadows) shadowcache.remove(staleshadows[i]);
+    shadowcacheinvalidations += staleshadows.length();
+
+    // the maps of the last frame may point at removed entries, so they no longer get written back
+    shadowmaps.setsize(0);
+
+    clearradiancehintscache();
+    clearshadowmeshes();
+}
+
+static void shadowcachestats(int *reset)
+{
+    conoutf("shadow cache: %d entries, %d hits, %d misses, %.1f%% hit rate, %d evictions, %d defrags, %d invalidations",
+        shadowcache.numelems, shadowcachehits, shadowcachemisses, 100.0f*shadowcachehits/max(shadowcachehits + shadowcachemisses, 1),
+        shadowcacheevictions, shadowcachedefrags, shadowcacheinvalidations);
+    if(*reset) shadowcachehits = shadowcachemisses = shadowcacheevictions = shadowcachedefrags = shadowcacheinvalidations = 0;
+}
+COMMAND(shadowcachestats, "i");
+
 static shadowmapinfo *addshadowmap(ushort x, ushort y, int size, int &idx, int light = -1, shadowcacheval *cached = NULL)
 {
     idx = shadowmaps.length();
@@ -2074,6 +2119,13 @@ int calcbbcsmsplits(const ivec &bbmin, const ivec &bbmax)
     return mask;
 }
 
+int getcsmcullplanes(plane *cull)
+{
+    if(!csmcull) return 0;
+    loopi(csmsplits) memcpy(&cull[i*4], csm.splits[i].cull, 4*sizeof(plane));
+    return csmsplits;
+}
+
 int calcspherecsmsplits(const vec &center, float radius)
 {
     int mask = (1<<csmsplits)-1;
@@ -2192,6 +2244,13 @@ int calcbbrsmsplits(const ivec &bbmin, const ivec &bbmax)
     return 1;
 }
 
+bool getrsmcullplanes(plane *cull)
+{
+    if(!rsmcull) return false;
+    memcpy(cull, rsm.cull, 4*sizeof(plane));
+    return true;
+}
+
 int calcspherersmsplits(const vec &center, float radius)
 {
     if(!rsmcull) return 1;
@@ -2506,16 +2565,23 @@ void loaddeferredlightshaders()
     else deferredlightshader = loaddeferredlightshader();
 }
 
+// lights without spots first, then shadowed ones, then nearest scissor depth and distance,
+// kept as a compact key per light so sorting does not touch the lightinfos
+struct lightsortkey
+{
+    int group;
+    float sz1, dist;
+};
+
+static vector<lightsortkey> lightsortkeys;
+
 static inline bool sortlights(int x, int y)
 {
-    const lightinfo &xl = lights[x], &yl = lights[y];
-    if(!xl.spot) { if(yl.spot) return true; }
-    else if(!yl.spot) return false;
-    if(!xl.noshadow()) { if(yl.noshadow()) return true; }
-    else if(!yl.noshadow()) return false;
-    if(xl.sz1 < yl.sz1) return true;
-    else if(xl.sz1 > yl.sz1) return false;
-    return xl.dist - xl.radius < yl.dist - yl.radius;
+    const lightsortkey &xk = lightsortkeys[x], &yk = lightsortkeys[y];
+    if(xk.group != yk.group) return xk.group < yk.group;
+    if(xk.sz1 != yk.sz1) return xk.sz1 < yk.sz1;
+    if(xk.dist != yk.dist) return xk.dist < yk.dist;
+    return x < y;
 }
 
 VAR(lighttilealignw, 1, 16, 256);
@@ -2533,33 +2599,50 @@ void calctilesize()
     lighttileh = min(lighttileviewh, lighttilemaxh);
 }
 
+// evicts the cached maps in one quadrant of the atlas after it ran full, so the following frames can repack
+// that region; maps still in use are only dropped up to the defrag budget since each costs a re-render
+static void defragshadowcache()
+{
+    int evictx = ((evictshadowcache%SHADOWCACHE_EVICT)*shadowatlaspacker.w)/SHADOWCACHE_EVICT,
+        evicty = ((evictshadowcache/SHADOWCACHE_EVICT)*shadowatlaspacker.h)/SHADOWCACHE_EVICT,
+        evictx2 = (((evictshadowcache%SHADOWCACHE_EVICT)+1)*shadowatlaspacker.w)/SHADOWCACHE_EVICT,
+        evicty2 = (((evictshadowcache/SHADOWCACHE_EVICT)+1)*shadowatlaspacker.h)/SHADOWCACHE_EVICT,
+        budget = smcachedefrag;
+    staleshadows.setsize(0);
+    enumeratekt(shadowcache, shadowcachekey, k, shadowcacheval, c,
+    {
+        int w = shadowcachewidth(k, c);
+        int h = shadowcacheheight(k, c);
+        if(c.x >= evictx2 || c.x + w <= evictx || c.y >= evicty2 || c.y + h <= evicty) continue;
+        if(c.lastused == shadowcacheframe)
+        {
+            if(budget <= 0) continue;
+            budget--;
+            shadowcachedefrags++;
+        }
+        else shadowcacheevictions++;
+        staleshadows.add(k);
+    });
+    loopv(staleshadows) shadowcache.remove(staleshadows[i]);
+
+    evictshadowcache = (evictshadowcache + 1)%(SHADOWCACHE_EVICT*SHADOWCACHE_EVICT);
+    shadowcachefull = false;
+}
+
 void resetlights()
 {
-    shadowcache.reset();
     if(smcache)
     {
-        int evictx = ((evictshadowcache%SHADOWCACHE_EVICT)*shadowatlaspacker.w)/SHADOWCACHE_EVICT,
-            evicty = ((evictshadowcache/SHADOWCACHE_EVICT)*shadowatlaspacker.h)/SHADOWCACHE_EVICT,
-            evictx2 = (((evictshadowcache%SHADOWCACHE_EVICT)+1)*shadowatlaspacker.w)/SHADOWCACHE_EVICT,
-            evicty2 = (((evictshadowcache/SHADOWCACHE_EVICT)+1)*shadowatlaspacker.h)/SHADOWCACHE_EVICT;
         loopv(shadowmaps)
         {
             shadowmapinfo &sm = shadowmaps[i];
             if(sm.light < 0) continue;
-            lightinfo &l = lights[sm.light];
-            if(sm.cached && shadowcachefull)
-            {
-                int w = l.spot ? sm.size : sm.size*3, h = l.spot ? sm.size : sm.size*2;
-                if(sm.x < evictx2 && sm.x + w > evictx && sm.y < evicty2 && sm.y + h > evicty) continue;
-            }
-            shadowcache[l] = sm;
-        }
-        if(shadowcachefull)
-        {
-            evictshadowcache = (evictshadowcache + 1)%(SHADOWCACHE_EVICT*SHADOWCACHE_EVICT);
-            shadowcachefull = false;
+            shadowcache[lights[sm.light]] = shadowcacheval(sm, shadowcacheframe);
         }
+        if(shadowcachefull) defragshadowcache();
+        shadowcacheframe++;
     }
+    else if(shadowcache.numelems) shadowcache.reset();
 
     lights.setsize(0);
     lightorder.setsize(0);
@@ -3379,9 +3462,112 @@ void viewlightscissor()
     gle::disable();
 }
 
-void collectlights()
+VARP(lightthreads, 0, 0, 16);
+VAR(lightjobmin, 1, 128, 65536);
+
+extern plane vfcP[5];
+extern float vfcDfog;
+
+// the frame's light sources as flat arrays, so visibility culling, scissoring and tiling can run
+// over ranges of them on the job threads before they become lightinfos
+struct lightsourcelist
 {
-    if(lights.length()) return;
+    vector<int> ent, flags, spot;
+    vector<float> x, y, z, radius;
+    vector<vec> color, dir;
+    vector<uchar> viscull, culled;
+
+    int length() const { return ent.length(); }
+
+    void clear()
+    {
+        ent.setsize(0); flags.setsize(0); spot.setsize(0);
+        x.setsize(0); y.setsize(0); z.setsize(0); radius.setsize(0);
+        color.setsize(0); dir.setsize(0);
+        viscull.setsize(0); culled.setsize(0);
+    }
+
+    void add(int e, const vec &o, float r, const vec &c, int f, const vec &d, int s, bool vis)
+    {
+        ent.add(e); flags.add(f); spot.add(s);
+        x.add(o.x); y.add(o.y); z.add(o.z); radius.add(r);
+        color.add(c); dir.add(d);
+        viscull.add(vis ? 1 : 0); culled.add(0);
+    }
+};
+
+static lightsourcelist lightsources;
+static vector<int> lightsurvivors;
+static vector<lightrect> lighttilerects;
+
+struct lightjob
+{
+    void (*fn)(int start, int end);
+    int num, chunk;
+};
+
+static void runlightjob(void *data, int job, int thread)
+{
+    const lightjob &j = *(const lightjob *)data;
+    int start = job*j.chunk;
+    j.fn(start, min(start + j.chunk, j.num));
+}
+
+static void runlightjobs(void (*fn)(int start, int end), int num, int threads)
+{
+    if(num <= 0) return;
+    threads = jobthreadcount(threads);
+    if(threads <= 1 || num < lightjobmin) { fn(0, num); return; }
+    lightjob j;
+    j.fn = fn;
+    j.num = num;
+    j.chunk = max((num + 4*threads - 1)/(4*threads), 16);
+    runjobs(runlightjob, &j, (num + j.chunk - 1)/j.chunk, threads);
+}
+
+static void fogculllights(int start, int end)
+{
+    const float *x = lightsources.x.getbuf(), *y = lightsources.y.getbuf(), *z = lightsources.z.getbuf(), *r = lightsources.radius.getbuf();
+    const uchar *viscull = lightsources.viscull.getbuf();
+    uchar *culled = lightsources.culled.getbuf();
+    for(int i = start; i < end; i++) culled[i] = 0;
+    loopk(5)
+    {
+        const plane &p = vfcP[k];
+        for(int i = start; i < end; i++) culled[i] |= p.x*x[i] + p.y*y[i] + p.z*z[i] + p.offset < -r[i] ? 1 : 0;
+    }
+    const plane &p = vfcP[4];
+    for(int i = start; i < end; i++)
+    {
+        culled[i] |= p.x*x[i] + p.y*y[i] + p.z*z[i] + p.offset > vfcDfog + r[i] ? 1 : 0;
+        culled[i] &= viscull[i];
+    }
+}
+
+static void initlights(int start, int end)
+{
+    for(int i = start; i < end; i++)
+    {
+        int src = lightsurvivors[i];
+        lightinfo &l = lights[i];
+        l = lightinfo(vec(lightsources.x[src], lightsources.y[src], lightsources.z[src]), lightsources.color[src], lightsources.radius[src],
+                      lightsources.flags[src], lightsources.dir[src], lightsources.spot[src]);
+        l.ent = lightsources.ent[src];
+        lightsortkey &k = lightsortkeys[i];
+        k.group = (l.spot ? 2 : 0) | (l.noshadow() ? 1 : 0);
+        k.sz1 = l.sz1;
+        k.dist = l.dist - l.radius;
+    }
+}
+
+static void tilelights(int start, int end)
+{
+    for(int i = start; i < end; i++) lighttilerects[i] = lightrect(lights[lightorder[i]]);
+}
+
+static void gatherlights()
+{
+    lightsources.clear();
 
     // point lights processed here
     const vector<extentity *> &ents = entities::getents();
@@ -3389,15 +3575,14 @@ void collectlights()
     {
         const extentity *e = ents[i];
         if(e->type != ET_LIGHT || e->attr[0] <= 0) continue;
-
-        if(smviscull)
+        vec dir(0, 0, 0);
+        int spot = 0;
+        if(e->attached && e->attached->type == ET_SPOTLIGHT)
         {
-            if(isfoggedsphere(e->attr[0], e->o)) continue;
-            if(pvsoccludedsphere(e->o, e->attr[0])) continue;
+            dir = vec(e->attached->o).sub(e->o).normalize();
+            spot = clamp(int(e->attached->attr[0]), 1, 89);
         }
-
-        lightinfo &l = lights.add(lightinfo(i, *e));
-        if(l.validscissor()) lightorder.add(lights.length()-1);
+        lightsources.add(i, e->o, e->attr[0], vec(e->attr[1], e->attr[2], e->attr[3]).max(0), e->attr[4], dir, spot, smviscull!=0);
     }
 
     int numdynlights = 0;
@@ -3412,12 +3597,106 @@ void collectlights()
         float radius;
         int spot, flags;
         if(!getdynlight(i, o, radius, color, dir, spot, flags)) continue;
+        lightsources.add(-1, o, radius, vec(color).mul(255).max(0), flags, dir, spot, false);
+    }
+}
 
-        lightinfo &l = lights.add(lightinfo(o, vec(color).mul(255).max(0), radius, flags, dir, spot));
-        if(l.validscissor()) lightorder.add(lights.length()-1);
+// culls the gathered sources, builds their lightinfos and the sorted light order, starting from no lights
+static void buildlights(int threads)
+{
+    int numsources = lightsources.length();
+    runlightjobs(fogculllights, numsources, threads);
+
+    static vector<ivec> cullmin, cullmax;
+    static vector<int> cullidx;
+    static vector<uchar> occluded;
+    cullmin.setsize(0);
+    cullmax.setsize(0);
+    cullidx.setsize(0);
+    loopi(numsources) if(lightsources.viscull[i] && !lightsources.culled[i])
+    {
+        vec o(lightsources.x[i], lightsources.y[i], lightsources.z[i]);
+        float radius = lightsources.radius[i];
+        cullmin.add(ivec(vec(o).sub(radius)));
+        cullmax.add(ivec(vec(o).add(radius+1)));
+        cullidx.add(i);
+    }
+    if(cullidx.length())
+    {
+        occluded.setsize(0);
+        loopv(cullidx) occluded.add(0);
+        pvsoccluded(cullmin.getbuf(), cullmax.getbuf(), cullidx.length(), occluded.getbuf());
+        loopv(cullidx) if(occluded[i]) lightsources.culled[cullidx[i]] = 1;
+    }
+
+    lightsurvivors.setsize(0);
+    loopi(numsources) if(!lightsources.culled[i]) lightsurvivors.add(i);
+
+    int numlights = lightsurvivors.length();
+    lights.pad(numlights);
+    lightsortkeys.setsize(0);
+    lightsortkeys.pad(numlights);
+    runlightjobs(initlights, numlights, threads);
+
+    loopi(numlights) if(lights[i].validscissor()) lightorder.add(i);
+
+    parallelsort(lightorder.getbuf(), lightorder.length(), sortlights, threads, lightjobmin);
+}
+
+struct parkedshadow
+{
+    shadowcachekey key;
+    shadowcacheval *val;
+};
+
+static vector<parkedshadow> parkedshadows;
+
+static inline bool parkedshadowcmp(const parkedshadow &x, const parkedshadow &y)
+{
+    return x.val->lastused > y.val->lastused;
+}
+
+// keeps the atlas regions of cached lights that are not visible this frame reserved, most recently used
+// first, until the fill budget runs out or they get too old; everything after that is evicted
+static void parkshadowcache()
+{
+    parkedshadows.setsize(0);
+    enumeratekt(shadowcache, shadowcachekey, k, shadowcacheval, c,
+    {
+        if(c.lastused == shadowcacheframe) continue;
+        parkedshadow &p = parkedshadows.add();
+        p.key = k;
+        p.val = &c;
+    });
+    if(parkedshadows.empty()) return;
+    parkedshadows.sort(parkedshadowcmp);
+
+    int budget = (shadowatlaspacker.w*shadowatlaspacker.h/100)*smcachefill - smused;
+    staleshadows.setsize(0);
+    loopv(parkedshadows)
+    {
+        const shadowcachekey &k = parkedshadows[i].key;
+        shadowcacheval &c = *parkedshadows[i].val;
+        int w = shadowcachewidth(k, c), h = shadowcacheheight(k, c);
+        if(shadowcacheframe - c.lastused > smcacheage || w*h > budget)
+        {
+            budget = 0;
+            staleshadows.add(k);
+            continue;
+        }
+        budget -= w*h;
+        shadowatlaspacker.reserve(c.x, c.y, w, h);
     }
+    loopv(staleshadows) shadowcache.remove(staleshadows[i]);
+    shadowcacheevictions += staleshadows.length();
+}
 
-    lightorder.sort(sortlights);
+void collectlights()
+{
+    if(lights.length()) return;
+
+    gatherlights();
+    buildlights(lightthreads);
 
     bool queried = false;
     if(!drawtex && smquery && oqfrags && oqlights) loopv(lightorder)
@@ -3453,42 +3732,53 @@ void collectlights()
 
     smused = 0;
 
-    if(smcache && !smnoshadow && shadowcache.numelems) loop(mismatched, 2) loopv(lightorder)
+    if(smcache && !smnoshadow && shadowcache.numelems) loop(mismatched, 2)
     {
-        int idx = lightorder[i];
-        lightinfo &l = lights[idx];
-        if(l.noshadow()) continue;
+        if(mismatched) parkshadowcache();
 
-        shadowcacheval *cached = shadowcache.access(l);
-        if(!cached) continue;
+        loopv(lightorder)
+        {
+            int idx = lightorder[i];
+            lightinfo &l = lights[idx];
+            if(l.noshadow()) continue;
 
-        float prec = smprec, lod;
-        int w, h;
-        if(l.spot) { w = 1; h = 1; prec *= tan360(l.spot); lod = smspotprec; }
-        else { w = 3; h = 2; lod = smcubeprec; }
-        lod *= clamp(l.radius * prec / sqrtf(max(1.0f, l.dist/l.radius)), float(smminsize), float(smmaxsize));
-        int size = clamp(int(ceil((lod * shadowatlaspacker.w) / SHADOWATLAS_SIZE)), 1, shadowatlaspacker.w / w);
-        w *= size;
-        h *= size;
+            shadowcacheval *cached = shadowcache.access(l);
+            if(!cached) continue;
 
-        if(mismatched)
-        {
-            if(cached->size == size) continue;
+            float prec = smprec, lod;
+            int w, h;
+            if(l.spot) { w = 1; h = 1; prec *= tan360(l.spot); lod = smspotprec; }
+            else { w = 3; h = 2; lod = smcubeprec; }
+            lod *= clamp(l.radius * prec / sqrtf(max(1.0f, l.dist/l.radius)), float(smminsize), float(smmaxsize));
+            int size = clamp(int(ceil((lod * shadowatlaspacker.w) / SHADOWATLAS_SIZE)), 1, shadowatlaspacker.w / w);
+            w *= size;
+            h *= size;
 
-            ushort x = USHRT_MAX, y = USHRT_MAX;
-            if(!shadowatlaspacker.insert(x, y, w, h)) continue;
-            addshadowmap(x, y, size, l.shadowmap, idx);
-        }
-        else
-        {
-            if(cached->size != size) continue;
+            if(mismatched)
+            {
+                if(cached->size == size) continue;
 
-            ushort x = cached->x, y = cached->y;
-            shadowatlaspacker.reserve(x, y, w, h);
-            addshadowmap(x, y, size, l.shadowmap, idx, cached);
-        }
+                // the old placement was not reserved, so it must not survive into the next frame
+                shadowcache.remove(l);
 
-        smused += w*h;
+                ushort x = USHRT_MAX, y = USHRT_MAX;
+                if(!shadowatlaspacker.insert(x, y, w, h)) continue;
+                addshadowmap(x, y, size, l.shadowmap, idx);
+                shadowcachemisses++;
+            }
+            else
+            {
+                cached->lastused = shadowcacheframe;
+                if(cached->size != size) continue;
+
+                ushort x = cached->x, y = cached->y;
+                shadowatlaspacker.reserve(x, y, w, h);
+                addshadowmap(x, y, size, l.shadowmap, idx, cached);
+                shadowcachehits++;
+            }
+
+            smused += w*h;
+        }
     }
 }
 
@@ -3508,8 +3798,8 @@ struct batchrect : lightrect
     ushort idx;
 
     batchrect() {}
-    batchrect(const lightinfo &l, ushort idx)
-      : lightrect(l),
+    batchrect(const lightrect &r, const lightinfo &l, ushort idx)
+      : lightrect(r),
         group((l.shadowmap < 0 ? BF_NOSHADOW : 0) | (l.spot > 0 ? BF_SPOTLIGHT : 0)),
         idx(idx)
     {}
@@ -3627,12 +3917,16 @@ static void batchlights()
     lightbatchesused = lightbatches.length();
 }
 
-void packlights()
+static void packlights(int threads)
 {
     lightsvisible = lightsoccluded = 0;
     lightpassesused = 0;
     batchrects.setsize(0);
 
+    lighttilerects.setsize(0);
+    lighttilerects.pad(lightorder.length());
+    runlightjobs(tilelights, lightorder.length(), threads);
+
     loopv(lightorder)
     {
         int idx = lightorder[i];
@@ -3665,9 +3959,10 @@ void packlights()
                 smused += w*h;
             }
             else if(smcache) shadowcachefull = true;
+            if(smcache) shadowcachemisses++;
         }
 
-        batchrects.add(batchrect(l, i));
+        batchrects.add(batchrect(lighttilerects[i], l, i));
     }
 
     lightsvisible = lightorder.length() - lightsoccluded;
@@ -3675,6 +3970,79 @@ void packlights()
     batchlights();
 }
 
+void packlights()
+{
+    packlights(lightthreads);
+}
+
+static uint lighttestseed = 0;
+
+static inline float lighttestrand(float scale)
+{
+    lighttestseed = lighttestseed*1664525 + 1013904223;
+    return (lighttestseed>>8)*(scale/16777216.0f);
+}
+
+// fills the light sources with a reproducible synthetic set around the camera, unshadowed
+// so packing them never touches the shadow atlas
+static void genlighttest(int numlights, float spread)
+{
+    lightsources.clear();
+    lighttestseed = 1;
+    loopi(numlights)
+    {
+        vec o = vec(lighttestrand(2) - 1, lighttestrand(2) - 1, lighttestrand(2) - 1).mul(spread).add(camera1->o);
+        float radius = 16 + lighttestrand(240);
+        vec color(lighttestrand(255), lighttestrand(255), lighttestrand(255)), dir(0, 0, 0);
+        int spot = 0;
+        if(lighttestrand(1) < 0.25f)
+        {
+            dir = vec(lighttestrand(2) - 1, lighttestrand(2) - 1, lighttestrand(2) - 1);
+            if(dir.iszero()) dir = vec(0, 0, -1);
+            dir.normalize();
+            spot = 10 + int(lighttestrand(70));
+        }
+        lightsources.add(-1, o, radius, color, L_NOSHADOW, dir, spot, true);
+    }
+}
+
+// runs light culling, sorting, tiling and batching on synthetic lights without any gl work,
+// once on a single thread and once on the job threads, and checks both agree
+void lighttest(int *numlights, int *iterations, float *spread)
+{
+    if(lights.length()) { conoutf(CON_ERROR, "lights are already collected for this frame"); return; }
+    int num = clamp(*numlights > 0 ? *numlights : 1024, 1, USHRT_MAX-1), iters = max(*iterations, 1), threads = jobthreadcount(lightthreads);
+    float dist = *spread > 0 ? *spread : 1024;
+    double elapsed[2] = { 0, 0 };
+    vector<int> order[2];
+    int batches[2] = { 0, 0 };
+    loop(pass, 2)
+    {
+        loopi(iters)
+        {
+            genlighttest(num, dist);
+            Uint64 start = SDL_GetPerformanceCounter();
+            buildlights(pass ? threads : 1);
+            packlights(pass ? threads : 1);
+            elapsed[pass] += double(SDL_GetPerformanceCounter() - start) / double(SDL_GetPerformanceFrequency());
+            if(!i)
+            {
+                order[pass] = lightorder;
+                batches[pass] = lightbatches.length();
+            }
+            lights.setsize(0);
+            lightorder.setsize(0);
+            lightbatches.setsize(0);
+        }
+    }
+    lightsources.clear();
+    bool match = batches[0] == batches[1] && order[0].length() == order[1].length() &&
+                 (order[0].empty() || !memcmp(order[0].getbuf(), order[1].getbuf(), order[0].length()*sizeof(int)));
+    conoutf("lighttest: %d lights, %d visible, %d batches; 1 thread %.3f ms, %d threads %.3f ms; results %s",
+        num, order[1].length(), batches[1], 1000*elapsed[0]/iters, threads, 1000*elapsed[1]/iters, match ? "match" : "differ");
+}
+COMMAND(lighttest, "iif");
+
 static inline void nogiquad(int x, int y, int w, int h)
 {
     gle::attribf(x, y+h);
@@ -86,6 +86,206 @@ int isvisiblecube(const ivec &o, int size)
     return v;
 }
 
+///////// batched culling of flattened va bounds ///////////
+
+// the cube, full bounds and shadow caster bounds of every va are kept as centers and half extents
+// in flat per-component arrays indexed by vtxarray::cullidx, so a single pass can test four vas
+// at a time against several frusta with floatlanes, and large passes are split across the job
+// threads; the recursive walks below then only read back the results
+
+enum { VABOUNDS_CUBE = 0, VABOUNDS_BB, VABOUNDS_SHADOW, NUMVABOUNDS };
+
+#define MAXVACULLVIEWS 8
+#define VACULLCHUNK 256
+
+VAR(vabatchcull, 0, 1, 1);
+VARP(vacullthreads, 0, 0, 16);
+VAR(vaculljobmin, 0, 2048, 1<<20);
+
+static float *vabounds = NULL, *vaculldists = NULL;
+static uchar *vacullbuf = NULL;
+static int numvabounds = 0, vaboundsstride = 0;
+static bool vaboundsdirty = true;
+static const uchar *vacullresult = NULL;
+static int vacullviews = 0;
+
+void invalidatevabounds()
+{
+    vaboundsdirty = true;
+}
+
+static void cleanupvabounds()
+{
+    DELETEA(vabounds);
+    DELETEA(vaculldists);
+    DELETEA(vacullbuf);
+    numvabounds = vaboundsstride = 0;
+    vaboundsdirty = true;
+}
+
+static inline float *getvabounds(int type)
+{
+    return &vabounds[type*6*vaboundsstride];
+}
+
+static inline void setvabounds(int type, int idx, const ivec &bbmin, const ivec &bbmax)
+{
+    float *b = getvabounds(type);
+    loopk(3)
+    {
+        b[k*vaboundsstride + idx] = 0.5f*(bbmin[k] + bbmax[k]);
+        b[(k+3)*vaboundsstride + idx] = 0.5f*(bbmax[k] - bbmin[k]);
+    }
+}
+
+static bool updatevabounds()
+{
+    if(!vaboundsdirty) return numvabounds > 0;
+    vaboundsdirty = false;
+    numvabounds = valist.length();
+    int stride = (numvabounds + VACULLCHUNK-1)&~(VACULLCHUNK-1);
+    if(stride > vaboundsstride)
+    {
+        DELETEA(vabounds);
+        DELETEA(vaculldists);
+        DELETEA(vacullbuf);
+        vaboundsstride = stride;
+        vabounds = new float[NUMVABOUNDS*6*vaboundsstride];
+        // the kernels read the padding too, keep it finite
+        memset(vabounds, 0, NUMVABOUNDS*6*vaboundsstride*sizeof(float));
+        vaculldists = new float[vaboundsstride];
+        vacullbuf = new uchar[MAXVACULLVIEWS*vaboundsstride];
+    }
+    loopv(valist)
+    {
+        vtxarray *va = valist[i];
+        va->cullidx = i;
+        setvabounds(VABOUNDS_CUBE, i, va->o, ivec(va->o).add(va->size));
+        setvabounds(VABOUNDS_BB, i, va->bbmin, va->bbmax);
+        if(va->children.length() || va->mapmodels.length()) setvabounds(VABOUNDS_SHADOW, i, va->bbmin, va->bbmax);
+        else setvabounds(VABOUNDS_SHADOW, i, va->geommin, va->geommax);
+    }
+    return numvabounds > 0;
+}
+
+struct vacullview
+{
+    plane p[5];
+    int numplanes;
+    float fog;      // culling distance along the last plane
+};
+
+// the arrays are padded out to VACULLCHUNK vas, so the kernels may run past end into the padding
+static void cullvabounds(const vacullview &view, const float *b, int start, int end, uchar *flags)
+{
+    const float *cx = &b[0], *cy = &b[vaboundsstride], *cz = &b[2*vaboundsstride],
+                *ex = &b[3*vaboundsstride], *ey = &b[4*vaboundsstride], *ez = &b[5*vaboundsstride];
+    floatlanes px[5], py[5], pz[5], po[5], ax[5], ay[5], az[5], zero(0.0f);
+    loopj(view.numplanes)
+    {
+        const plane &p = view.p[j];
+        px[j] = floatlanes(p.x);
+        py[j] = floatlanes(p.y);
+        pz[j] = floatlanes(p.z);
+        po[j] = floatlanes(p.offset);
+        ax[j] = floatlanes(fabs(p.x));
+        ay[j] = floatlanes(fabs(p.y));
+        az[j] = floatlanes(fabs(p.z));
+    }
+    bool fog = view.fog < 1e16f;
+    floatlanes fogoffset(view.p[view.numplanes-1].offset - view.fog);
+    for(int i = start; i < end; i += 4)
+    {
+        floatlanes x(&cx[i]), y(&cy[i]), z(&cz[i]), rx(&ex[i]), ry(&ey[i]), rz(&ez[i]);
+        int outside = 0, partial = 0, fogged = 0;
+        loopj(view.numplanes)
+        {
+            floatlanes d = px[j]*x + py[j]*y + pz[j]*z, r = ax[j]*rx + ay[j]*ry + az[j]*rz;
+            if(fog && j == view.numplanes-1)
+            {
+                floatlanes f = d + fogoffset;
+                fogged = zero.lt(f - r);
+                partial |= zero.lt(f + r);
+            }
+            d = d + po[j];
+            outside |= (d + r).lt(zero);
+            partial |= (d - r).lt(zero);
+        }
+        loopk(4) flags[i+k] = outside&(1<<k) ? VFC_NOT_VISIBLE : (fogged&(1<<k) ? VFC_FOGGED : (partial&(1<<k) ? VFC_PART_VISIBLE : VFC_FULL_VISIBLE));
+    }
+}
+
+static void distvabounds(const vec &o, const float *b, int start, int end, float *dists)
+{
+    const float *cx = &b[0], *cy = &b[vaboundsstride], *cz = &b[2*vaboundsstride],
+                *ex = &b[3*vaboundsstride], *ey = &b[4*vaboundsstride], *ez = &b[5*vaboundsstride];
+    floatlanes ox(o.x), oy(o.y), oz(o.z);
+    for(int i = start; i < end; i += 4)
+    {
+        floatlanes dx = ((floatlanes(&cx[i]) - ox).abs() - floatlanes(&ex[i])).clamp0(),
+                   dy = ((floatlanes(&cy[i]) - oy).abs() - floatlanes(&ey[i])).clamp0(),
+                   dz = ((floatlanes(&cz[i]) - oz).abs() - floatlanes(&ez[i])).clamp0();
+        (dx*dx + dy*dy + dz*dz).sqrt().store(&dists[i]);
+    }
+}
+
+static void spotvabounds(const vec &o, const vec &dir, int spot, const float *b, int start, int end, uchar *flags)
+{
+    const float *cx = &b[0], *cy = &b[vaboundsstride], *cz = &b[2*vaboundsstride],
+                *ex = &b[3*vaboundsstride], *ey = &b[4*vaboundsstride], *ez = &b[5*vaboundsstride];
+    const vec2 &sc = sincos360[spot];
+    floatlanes ox(o.x), oy(o.y), oz(o.z), dx(dir.x), dy(dir.y), dz(dir.z), sx2(sc.x*sc.x), sy(sc.y);
+    for(int i = start; i < end; i += 4)
+    {
+        floatlanes x = floatlanes(&cx[i]) - ox, y = floatlanes(&cy[i]) - oy, z = floatlanes(&cz[i]) - oz,
+                   rx(&ex[i]), ry(&ey[i]), rz(&ez[i]),
+                   cdist = dx*x + dy*y + dz*z,
+                   cradius = (rx*rx + ry*ry + rz*rz).sqrt() + sy*cdist;
+        int inside = (sx2*(x*x + y*y + z*z - cdist*cdist)).le(cradius*cradius);
+        loopk(4) flags[i+k] = (inside>>k)&1;
+    }
+}
+
+struct vacullpass
+{
+    int bounds, numviews;
+    const vacullview *views;
+    bool dist;
+    vec origin, dir;
+    int spot;
+
+    vacullpass() : bounds(VABOUNDS_CUBE), numviews(0), views(NULL), dist(false), origin(0, 0, 0), dir(0, 0, 0), spot(-1) {}
+};
+
+static void vaculljob(void *data, int job, int thread)
+{
+    const vacullpass &p = *(const vacullpass *)data;
+    int start = job*VACULLCHUNK, end = min(start + VACULLCHUNK, numvabounds);
+    loopi(p.numviews) cullvabounds(p.views[i], getvabounds(p.bounds), start, end, &vacullbuf[i*vaboundsstride]);
+    if(p.dist) distvabounds(p.origin, getvabounds(VABOUNDS_BB), start, end, vaculldists);
+    if(p.spot >= 0) spotvabounds(p.origin, p.dir, p.spot, getvabounds(VABOUNDS_SHADOW), start, end, vacullbuf);
+}
+
+static void runvacull(vacullpass &p)
+{
+    int numjobs = (numvabounds + VACULLCHUNK-1)/VACULLCHUNK;
+    if(numvabounds < vaculljobmin) loopi(numjobs) vaculljob(&p, i, 0);
+    else runjobs(vaculljob, &p, numjobs, vacullthreads);
+}
+
+// combines per-split results the same way calcbbcsmsplits does: a box fully inside a split needs no later ones
+static inline int vacullsplits(int idx, int numsplits)
+{
+    int mask = (1<<numsplits)-1;
+    loopi(numsplits)
+    {
+        int vfc = vacullbuf[i*vaboundsstride + idx];
+        if(vfc == VFC_NOT_VISIBLE) mask &= ~(1<<i);
+        else if(vfc == VFC_FULL_VISIBLE) { mask &= (2<<i)-1; break; }
+    }
+    return mask;
+}
+
 static inline float vadist(vtxarray *va, const vec &p)
 {
     return p.dist_to_bb(va->bbmin, va->bbmax);
@@ -133,7 +333,7 @@ static inline void findvisiblevas(vector<vtxarray *> &vas)
     {
         vtxarray &v = *vas[i];
         int prevvfc = v.curvfc;
-        v.curvfc = fullvis ? VFC_FULL_VISIBLE : isvisiblecube(v.o, v.size);
+        v.curvfc = fullvis ? VFC_FULL_VISIBLE : (vacullresult ? vacullresult[v.cullidx] : isvisiblecube(v.o, v.size));
         if(v.curvfc != VFC_NOT_VISIBLE)
         {
             if(pvsoccluded(v.o, v.size))
@@ -165,7 +365,21 @@ static inline void findvisiblevas(vector<vtxarray *> &vas)
 void findvisiblevas()
 {
     memset(vasort, 0, sizeof(vasort));
+    if(vabatchcull && updatevabounds())
+    {
+        vacullview view;
+        memcpy(view.p, vfcP, sizeof(vfcP));
+        view.numplanes = 5;
+        view.fog = vfcDfog;
+        vacullpass p;
+        p.bounds = VABOUNDS_CUBE;
+        p.views = &view;
+        p.numviews = 1;
+        runvacull(p);
+        vacullresult = vacullbuf;
+    }
     findvisiblevas<false, false>(varoot);
+    vacullresult = NULL;
     sortvisiblevas();
 }
 
@@ -212,9 +426,11 @@ void visiblecubes(bool cull)
     {
         setvfcP();
         findvisiblevas();
+        buildswocclusion();
     }
     else
     {
+        resetswocclusion();
         memset(vfcP, 0, sizeof(vfcP));
         vfcDfog = farplane;
         memset(vfcDnear, 0, sizeof(vfcDnear));
@@ -428,7 +644,7 @@ void findvisiblemms(const vector<extentity *> &ents)
     for(vtxarray *va = visibleva; va; va = va->next) if(va->occluded < OCCLUDE_BB && va->curvfc < VFC_FOGGED) loopv(va->mapmodels)
     {
         octaentities *oe = va->mapmodels[i];
-        if(isfoggedcube(oe->o, oe->size) || pvsoccluded(oe->bbmin, oe->bbmax)) continue;
+        if(isfoggedcube(oe->o, oe->size) || pvsoccluded(oe->bbmin, oe->bbmax) || swoccluded(oe->bbmin, oe->bbmax)) continue;
 
         bool occluded = oe->query && oe->query->owner == oe && checkquery(oe->query);
         if(occluded)
@@ -480,7 +696,7 @@ void rendermapmodels()
     findvisiblemms(ents);
 
     static int skipoq = 0;
-    bool doquery = oqfrags && oqmm;
+    bool doquery = oqfrags && oqmm && swocclusion != 1;
 
     for(octaentities *oe = visiblemms; oe; oe = oe->next) if(oe->distance>=0)
     {
@@ -887,7 +1103,7 @@ void findshadowvas(vector<vtxarray *> &vas)
     loopv(vas)
     {
         vtxarray &v = *vas[i];
-        float dist = vadist(&v, shadoworigin);
+        float dist = vacullresult ? vaculldists[v.cullidx] : vadist(&v, shadoworigin);
         if(dist < shadowradius || !smdistcull)
         {
             v.shadowmask = !smbbcull ? 0x3F : (v.children.length() || v.mapmodels.length() ?
@@ -907,7 +1123,7 @@ void findcsmshadowvas(vector<vtxarray *> &vas)
         ivec bbmin, bbmax;
         if(v.children.length() || v.mapmodels.length()) { bbmin = v.bbmin; bbmax = v.bbmax; }
         else { bbmin = v.geommin; bbmax = v.geommax; }
-        v.shadowmask = calcbbcsmsplits(bbmin, bbmax);
+        v.shadowmask = vacullresult ? vacullsplits(v.cullidx, vacullviews) : calcbbcsmsplits(bbmin, bbmax);
         if(v.shadowmask)
         {
             float dist = shadowdir.project_bb(bbmin, bbmax) - shadowbias;
@@ -925,7 +1141,7 @@ void findrsmshadowvas(vector<vtxarray *> &vas)
         ivec bbmin, bbmax;
         if(v.children.length() || v.mapmodels.length()) { bbmin = v.bbmin; bbmax = v.bbmax; }
         else { bbmin = v.geommin; bbmax = v.geommax; }
-        v.shadowmask = calcbbrsmsplits(bbmin, bbmax);
+        v.shadowmask = vacullresult ? (vacullresult[v.cullidx] != VFC_NOT_VISIBLE ? 1 : 0) : calcbbrsmsplits(bbmin, bbmax);
         if(v.shadowmask)
         {
             float dist = shadowdir.project_bb(bbmin, bbmax) - shadowbias;
@@ -940,21 +1156,63 @@ void findspotshadowvas(vector<vtxarray *> &vas)
     loopv(vas)
     {
         vtxarray &v = *vas[i];
-        float dist = vadist(&v, shadoworigin);
+        float dist = vacullresult ? vaculldists[v.cullidx] : vadist(&v, shadoworigin);
         if(dist < shadowradius || !smdistcull)
         {
-            v.shadowmask = !smbbcull || (v.children.length() || v.mapmodels.length() ?
+            v.shadowmask = !smbbcull || (vacullresult ? vacullresult[v.cullidx] : (v.children.length() || v.mapmodels.length() ?
                                 bbinsidespot(shadoworigin, shadowdir, shadowspot, v.bbmin, v.bbmax) :
-                                bbinsidespot(shadoworigin, shadowdir, shadowspot, v.geommin, v.geommax)) ? 1 : 0;
+                                bbinsidespot(shadoworigin, shadowdir, shadowspot, v.geommin, v.geommax))) ? 1 : 0;
             addshadowva(&v, dist);
             if(v.children.length()) findspotshadowvas(v.children);
         }
     }
 }
 
+// culls every va for the current shadow pass in one batch; all cascade splits are tested together
+static void batchshadowvas()
+{
+    vacullpass p;
+    vacullview views[MAXVACULLVIEWS];
+    plane cull[4*MAXVACULLVIEWS];
+    switch(shadowmapping)
+    {
+        case SM_REFLECT:
+            if(!getrsmcullplanes(cull)) return;
+            vacullviews = 1;
+            break;
+        case SM_CASCADE:
+            vacullviews = getcsmcullplanes(cull);
+            if(!vacullviews || vacullviews > MAXVACULLVIEWS) return;
+            break;
+        case SM_CUBEMAP:
+            p.dist = true;
+            vacullviews = 0;
+            break;
+        case SM_SPOT:
+            p.dist = true;
+            if(smbbcull) { p.spot = shadowspot; p.dir = shadowdir; }
+            vacullviews = 0;
+            break;
+        default: return;
+    }
+    loopi(vacullviews)
+    {
+        memcpy(views[i].p, &cull[i*4], 4*sizeof(plane));
+        views[i].numplanes = 4;
+        views[i].fog = 1e16f;
+    }
+    p.bounds = VABOUNDS_SHADOW;
+    p.views = views;
+    p.numviews = vacullviews;
+    p.origin = shadoworigin;
+    runvacull(p);
+    vacullresult = vacullbuf;
+}
+
 void findshadowvas()
 {
     memset(vasort, 0, sizeof(vasort));
+    if(vabatchcull && updatevabounds()) batchshadowvas();
     switch(shadowmapping)
     {
         case SM_REFLECT: findrsmshadowvas(varoot); break;
@@ -962,6 +1220,7 @@ void findshadowvas()
         case SM_CASCADE: findcsmshadowvas(varoot); break;
         case SM_SPOT: findspotshadowvas(varoot); break;
     }
+    vacullresult = NULL;
     sortshadowvas();
 }
 
@@ -1146,13 +1405,25 @@ struct geombatch
     VSlot &vslot;
     int offset;
     vtxarray *va;
-    int next, batch;
 
     geombatch(const elementset &es, int offset, vtxarray *va)
-      : es(es), vslot(lookupvslot(es.texture)), offset(offset), va(va),
-        next(-1), batch(-1)
+      : es(es), vslot(lookupvslot(es.texture)), offset(offset), va(va)
     {}
 
+    // packs the order of compare() into 64 bits, most significant first: vertex buffer, bottom layer and its
+    // 4096 unit region, shader, texture, envmap and orientation; the fields are truncated, so equal keys are
+    // confirmed with compare() before batches are merged
+    ullong sortkey() const
+    {
+        ullong key = ullong(va->vbuf&0xFFFF)<<48;
+        if(es.layer&LAYER_BOTTOM) key |= (1ULL<<47) | (ullong((va->o.x>>12)&0x1F)<<42) | (ullong((va->o.y>>12)&0x1F)<<37);
+        key |= ullong(vslot.slot->shader->program&0x3FF)<<27;
+        key |= ullong(es.texture)<<11;
+        key |= ullong(es.envmap&0xFF)<<3;
+        key |= es.orient&7;
+        return key;
+    }
+
     int compare(const geombatch &b) const
     {
         if(va->vbuf < b.va->vbuf) return -1;
@@ -1182,8 +1453,22 @@ struct geombatch
     }
 };
 
+struct batchkey
+{
+    ullong key;
+    int index;
+};
+
 static vector<geombatch> geombatches;
-static int firstbatch = -1, numbatches = 0;
+static vector<batchkey> batchkeys, batchsorttmp;
+
+// sorts the queued keys so batches sharing render state form contiguous runs
+static batchkey *sortbatchkeys()
+{
+    batchsorttmp.setsize(0);
+    batchsorttmp.pad(batchkeys.length());
+    return radixsort(batchkeys.getbuf(), batchsorttmp.getbuf(), batchkeys.length());
+}
 
 static void mergetexs(renderstate &cur, vtxarray *va, elementset *texs = NULL, int numtexs = 0, int offset = 0)
 {
@@ -1200,65 +1485,13 @@ static void mergetexs(renderstate &cur, vtxarray *va, elementset *texs = NULL, i
         }
     }
 
-    if(firstbatch < 0)
-    {
-        firstbatch = geombatches.length();
-        numbatches = numtexs;
-        loopi(numtexs-1)
-        {
-            geombatches.add(geombatch(texs[i], offset, va)).next = i+1;
-            offset += texs[i].length;
-        }
-        geombatches.add(geombatch(texs[numtexs-1], offset, va));
-        return;
-    }
-
-    int prevbatch = -1, curbatch = firstbatch, curtex = 0;
-    do
+    loopi(numtexs)
     {
-        geombatch &b = geombatches.add(geombatch(texs[curtex], offset, va));
-        offset += texs[curtex].length;
-        int dir = -1;
-        while(curbatch >= 0)
-        {
-            dir = b.compare(geombatches[curbatch]);
-            if(dir <= 0) break;
-            prevbatch = curbatch;
-            curbatch = geombatches[curbatch].next;
-        }
-        if(!dir)
-        {
-            int last = curbatch, next;
-            for(;;)
-            {
-                next = geombatches[last].batch;
-                if(next < 0) break;
-                last = next;
-            }
-            if(last==curbatch)
-            {
-                b.batch = curbatch;
-                b.next = geombatches[curbatch].next;
-                if(prevbatch < 0) firstbatch = geombatches.length()-1;
-                else geombatches[prevbatch].next = geombatches.length()-1;
-                curbatch = geombatches.length()-1;
-            }
-            else
-            {
-                b.batch = next;
-                geombatches[last].batch = geombatches.length()-1;
-            }
-        }
-        else
-        {
-            numbatches++;
-            b.next = curbatch;
-            if(prevbatch < 0) firstbatch = geombatches.length()-1;
-            else geombatches[prevbatch].next = geombatches.length()-1;
-            prevbatch = geombatches.length()-1;
-        }
+        batchkey &k = batchkeys.add();
+        k.index = geombatches.length();
+        k.key = geombatches.add(geombatch(texs[i], offset, va)).sortkey();
+        offset += texs[i].length;
     }
-    while(++curtex < numtexs);
 }
 
 static inline void enablevattribs(renderstate &cur, bool all = true)
@@ -1511,34 +1744,32 @@ static inline void updateshader(T &cur)
     }
 }
 
-static void renderbatch(renderstate &cur, int pass, geombatch &b)
+static void renderbatch(renderstate &cur, int pass, const batchkey *run, int numrun)
 {
     gbatches++;
-    for(geombatch *curbatch = &b;; curbatch = &geombatches[curbatch->batch])
+    loopi(numrun)
     {
-        ushort len = curbatch->es.length;
+        geombatch &b = geombatches[run[i].index];
+        ushort len = b.es.length;
         if(len)
         {
-            drawtris(len, (ushort *)0 + curbatch->va->eoffset + curbatch->offset, curbatch->es.minvert, curbatch->es.maxvert);
+            drawtris(len, (ushort *)0 + b.va->eoffset + b.offset, b.es.minvert, b.es.maxvert);
             vtris += len/3;
         }
-        if(curbatch->batch < 0) break;
     }
 }
 
 static void resetbatches()
 {
     geombatches.setsize(0);
-    firstbatch = -1;
-    numbatches = 0;
+    batchkeys.setsize(0);
 }
 
 static void renderbatches(renderstate &cur, int pass)
 {
     cur.slot = NULL;
     cur.vslot = NULL;
-    int curbatch = firstbatch;
-    if(curbatch >= 0)
+    if(geombatches.length())
     {
         if(!cur.depthmask) { cur.depthmask = true; glDepthMask(GL_TRUE); }
         if(!cur.colormask) { cur.colormask = true; glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE); }
@@ -1548,10 +1779,11 @@ static void renderbatches(renderstate &cur, int pass)
             enablevattribs(cur);
         }
     }
-    while(curbatch >= 0)
+    batchkey *sorted = sortbatchkeys();
+    for(int i = 0, numkeys = batchkeys.length(), numrun; i < numkeys; i += numrun)
     {
-        geombatch &b = geombatches[curbatch];
-        curbatch = b.next;
+        geombatch &b = geombatches[sorted[i].index];
+        for(numrun = 1; i + numrun < numkeys && sorted[i + numrun].key == sorted[i].key && !b.compare(geombatches[sorted[i + numrun].index]); numrun++);
 
         if(cur.vbuf != b.va->vbuf) changevbuf(cur, pass, b.va);
         if(pass == RENDERPASS_GBUFFER || pass == RENDERPASS_RSM) changebatchtmus(cur, pass, b);
@@ -1567,7 +1799,7 @@ static void renderbatches(renderstate &cur, int pass)
             updateshader(cur);
         }
 
-        renderbatch(cur, pass, b);
+        renderbatch(cur, pass, &sorted[i], numrun);
     }
 
     resetbatches();
@@ -1665,6 +1897,7 @@ void renderva(renderstate &cur, vtxarray *va, int pass = RENDERPASS_GBUFFER, boo
 void cleanupva()
 {
     clearvas(worldroot);
+    cleanupvabounds();
     clearqueries();
     cleanupbb();
     cleanupgrass();
@@ -1687,7 +1920,7 @@ VAR(oqgeom, 0, 1, 1);
 
 void rendergeom()
 {
-    bool doOQ = oqfrags && oqgeom && !drawtex, multipassing = false;
+    bool doOQ = oqfrags && oqgeom && !drawtex && swocclusion != 1, multipassing = false;
     renderstate cur;
 
     int blends = 0;
@@ -1703,6 +1936,12 @@ void rendergeom()
                     va->occluded = OCCLUDE_PARENT;
                     continue;
                 }
+                if(swoccluded(va->bbmin, va->bbmax))
+                {
+                    va->query = NULL;
+                    va->occluded = OCCLUDE_BB;
+                    continue;
+                }
                 va->occluded = va->query && va->query->owner == va && checkquery(va->query) ? min(va->occluded+1, int(OCCLUDE_BB)) : OCCLUDE_NOTHING;
                 va->query = newquery(va);
                 if(!va->query || !va->occluded)
@@ -1752,6 +1991,7 @@ void rendergeom()
         if(geombatches.length()) { renderbatches(cur, RENDERPASS_GBUFFER); glFlush(); }
         for(vtxarray *va = visibleva; va; va = va->next) if(va->texs && va->occluded >= OCCLUDE_GEOM)
         {
+            if(va->occluded == OCCLUDE_BB && !va->query) continue;
             if((va->parent && va->parent->occluded >= OCCLUDE_BB) || (va->query && checkquery(va->query)))
             {
                 va->occluded = OCCLUDE_BB;
@@ -1775,6 +2015,7 @@ void rendergeom()
         for(vtxarray *va = visibleva; va; va = va->next) if(va->texs)
         {
             va->query = NULL;
+            if(swoccluded(va->bbmin, va->bbmax)) { va->occluded = OCCLUDE_BB; continue; }
             va->occluded = pvsoccluded(va->geommin, va->geommax) ? OCCLUDE_GEOM : OCCLUDE_NOTHING;
             if(va->occluded >= OCCLUDE_GEOM) continue;
             blends += va->blends;
@@ -2086,13 +2327,22 @@ struct decalbatch
     DecalSlot &slot;
     int offset;
     vtxarray *va;
-    int next, batch;
 
     decalbatch(const elementset &es, int offset, vtxarray *va)
-      : es(es), slot(lookupdecalslot(es.texture)), offset(offset), va(va),
-        next(-1), batch(-1)
+      : es(es), slot(lookupdecalslot(es.texture)), offset(offset), va(va)
     {}
 
+    // vertex buffer, shader, texture, envmap and reused vslot, truncated like geombatch::sortkey()
+    ullong sortkey() const
+    {
+        ullong key = ullong(va->vbuf&0xFFFF)<<48;
+        key |= ullong(slot.shader->program&0xFF)<<40;
+        key |= ullong(es.texture)<<24;
+        key |= ullong(es.envmap&0xFF)<<16;
+        key |= es.reuse;
+        return key;
+    }
+
     int compare(const decalbatch &b) const
     {
         if(va->vbuf < b.va->vbuf) return -1;
@@ -2118,72 +2368,19 @@ static void mergedecals(decalrenderer &cur, vtxarray *va)
     elementset *texs = va->decalelems;
     int numtexs = va->decaltexs, offset = 0;
 
-    if(firstbatch < 0)
+    loopi(numtexs)
     {
-        firstbatch = decalbatches.length();
-        numbatches = numtexs;
-        loopi(numtexs-1)
-        {
-            decalbatches.add(decalbatch(texs[i], offset, va)).next = i+1;
-            offset += texs[i].length;
-        }
-        decalbatches.add(decalbatch(texs[numtexs-1], offset, va));
-        return;
+        batchkey &k = batchkeys.add();
+        k.index = decalbatches.length();
+        k.key = decalbatches.add(decalbatch(texs[i], offset, va)).sortkey();
+        offset += texs[i].length;
     }
-
-    int prevbatch = -1, curbatch = firstbatch, curtex = 0;
-    do
-    {
-        decalbatch &b = decalbatches.add(decalbatch(texs[curtex], offset, va));
-        offset += texs[curtex].length;
-        int dir = -1;
-        while(curbatch >= 0)
-        {
-            dir = b.compare(decalbatches[curbatch]);
-            if(dir <= 0) break;
-            prevbatch = curbatch;
-            curbatch = decalbatches[curbatch].next;
-        }
-        if(!dir)
-        {
-            int last = curbatch, next;
-            for(;;)
-            {
-                next = decalbatches[last].batch;
-                if(next < 0) break;
-                last = next;
-            }
-            if(last==curbatch)
-            {
-                b.batch = curbatch;
-                b.next = decalbatches[curbatch].next;
-                if(prevbatch < 0) firstbatch = decalbatches.length()-1;
-                else decalbatches[prevbatch].next = decalbatches.length()-1;
-                curbatch = decalbatches.length()-1;
-            }
-            else
-            {
-                b.batch = next;
-                decalbatches[last].batch = decalbatches.length()-1;
-            }
-        }
-        else
-        {
-            numbatches++;
-            b.next = curbatch;
-            if(prevbatch < 0) firstbatch = decalbatches.length()-1;
-            else decalbatches[prevbatch].next = decalbatches.length()-1;
-            prevbatch = decalbatches.length()-1;
-        }
-    }
-    while(++curtex < numtexs);
 }
 
 static void resetdecalbatches()
 {
     decalbatches.setsize(0);
-    firstbatch = -1;
-    numbatches = 0;
+    batchkeys.setsize(0);
 }
 
 static void changevbuf(decalrenderer &cur, int pass, vtxarray *va)
@@ -2282,29 +2479,29 @@ static inline void changeshader(decalrenderer &cur, int pass, decalbatch &b)
     cur.globals = GlobalShaderParamState::nextversion;
 }
 
-static void renderdecalbatch(decalrenderer &cur, int pass, decalbatch &b)
+static void renderdecalbatch(decalrenderer &cur, int pass, const batchkey *run, int numrun)
 {
     gbatches++;
-    for(decalbatch *curbatch = &b;; curbatch = &decalbatches[curbatch->batch])
+    loopi(numrun)
     {
-        ushort len = curbatch->es.length;
+        decalbatch &b = decalbatches[run[i].index];
+        ushort len = b.es.length;
         if(len)
         {
-            drawtris(len, (ushort *)0 + curbatch->va->decaloffset + curbatch->offset, curbatch->es.minvert, curbatch->es.maxvert);
+            drawtris(len, (ushort *)0 + b.va->decaloffset + b.offset, b.es.minvert, b.es.maxvert);
             vtris += len/3;
         }
-        if(curbatch->batch < 0) break;
     }
 }
 
 static void renderdecalbatches(decalrenderer &cur, int pass)
 {
     cur.slot = NULL;
-    int curbatch = firstbatch;
-    while(curbatch >= 0)
+    batchkey *sorted = sortbatchkeys();
+    for(int i = 0, numkeys = batchkeys.length(), numrun; i < numkeys; i += numrun)
     {
-        decalbatch &b = decalbatches[curbatch];
-        curbatch = b.next;
+        decalbatch &b = decalbatches[sorted[i].index];
+        for(numrun = 1; i + numrun < numkeys && sorted[i + numrun].key == sorted[i].key && !b.compare(decalbatches[sorted[i + numrun].index]); numrun++);
 
         if(pass && !b.slot.shader->numvariants(0)) continue;
 
@@ -2319,8 +2516,8 @@ static void renderdecalbatches(decalrenderer &cur, int pass)
         {
             updateshader(cur);
         }
- 
-        renderdecalbatch(cur, pass, b);
+
+        renderdecalbatch(cur, pass, &sorted[i], numrun);
     }
 
     resetdecalbatches();
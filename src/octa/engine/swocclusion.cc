@@ -0,0 +1,513 @@
+// swocclusion.cc: software occlusion culling against a low resolution depth buffer rasterized on the cpu
+
+#include "engine.hh"
+
+// occluders are the entirely solid cubes of the world, with full octants merged into their parent,
+// grouped by the vtxarray they belong to; each frame the ones of the nearest visible vas are drawn
+// conservatively into a small depth buffer: a texel is only written when the box covers all of it,
+// with the farthest depth the box surface has anywhere on it, and boxes are only rejected when their
+// nearest depth lies behind the whole max-depth hierarchy under their screen rectangle
+
+extern vector<vtxarray *> valist;
+extern vtxarray *visibleva;
+
+static void cleanupswocclusion();
+
+VAR(swocclusion, 0, 0, 2); // 1 = instead of occlusion queries, 2 = in front of occlusion queries
+VARF(swocclusionsize, 64, 256, 1024, cleanupswocclusion());
+VAR(swoccluders, 0, 512, 8192);
+VAR(swoccludermin, 1, 4, 256);
+VARF(swoccluderminsize, 1, 8, 1024, invalidateswoccluders());
+
+struct swoccluder
+{
+    vtxarray *va;
+    ivec o;
+    int size;
+
+    swoccluder() {}
+    swoccluder(vtxarray *va, const ivec &o, int size) : va(va), o(o), size(size) {}
+};
+
+static vector<swoccluder> swoccluderboxes;
+static bool swoccludersdirty = true;
+
+#define SWOCC_MAXLEVELS 12
+
+static float *swdepth = NULL;
+static int swwidth = 0, swheight = 0, swlevels = 0, swleveloffset[SWOCC_MAXLEVELS], swlevelw[SWOCC_MAXLEVELS], swlevelh[SWOCC_MAXLEVELS];
+static bool swdepthready = false;
+static uint swrasterized = 0, swtested = 0, swculled = 0;
+static double swbuildtime = 0;
+
+void invalidateswoccluders()
+{
+    swoccludersdirty = true;
+}
+
+static void cleanupswocclusion()
+{
+    DELETEA(swdepth);
+    swwidth = swheight = swlevels = 0;
+    swdepthready = false;
+}
+
+static inline void addswoccluder(vtxarray *va, const ivec &o, int size)
+{
+    if(va && size >= swoccluderminsize) swoccluderboxes.add(swoccluder(va, o, size));
+}
+
+// returns whether the whole octant is occluder material so the parent can use a single box for it
+static bool genswoccluders(cube *c, const ivec &co, int size, vtxarray *va)
+{
+    bool solid[8];
+    int numsolid = 0;
+    loopi(8)
+    {
+        ivec o(i, co, size);
+        vtxarray *cva = c[i].ext && c[i].ext->va ? c[i].ext->va : va;
+        if(c[i].children) solid[i] = genswoccluders(c[i].children, o, size>>1, cva);
+        else solid[i] = isentirelysolid(c[i]) && !(c[i].material&MAT_ALPHA);
+        if(solid[i] && cva != va)
+        {
+            addswoccluder(cva, o, size);
+            solid[i] = false;
+        }
+        if(solid[i]) numsolid++;
+    }
+    if(numsolid == 8) return true;
+    if(numsolid) loopi(8) if(solid[i]) addswoccluder(va, ivec(i, co, size), size);
+    return false;
+}
+
+static inline bool swoccludercmp(const swoccluder &x, const swoccluder &y)
+{
+    if(x.va != y.va) return x.va < y.va;
+    return x.size > y.size;
+}
+
+static void updateswoccluders()
+{
+    if(!swoccludersdirty) return;
+    swoccludersdirty = false;
+    swoccluderboxes.setsize(0);
+    loopv(valist) valist[i]->occluders = valist[i]->numoccluders = 0;
+    genswoccluders(worldroot, ivec(0, 0, 0), worldsize>>1, NULL);
+    swoccluderboxes.sort(swoccludercmp);
+    loopv(swoccluderboxes)
+    {
+        vtxarray *va = swoccluderboxes[i].va;
+        if(!va->numoccluders) va->occluders = i;
+        va->numoccluders++;
+    }
+}
+
+static void setupswdepth()
+{
+    int w = swocclusionsize, h = clamp(int(w*float(screenh)/max(screenw, 1)), 16, w);
+    if(swdepth && swwidth == w && swheight == h) return;
+    cleanupswocclusion();
+    swwidth = w;
+    swheight = h;
+    int total = 0;
+    while(swlevels < SWOCC_MAXLEVELS)
+    {
+        swleveloffset[swlevels] = total;
+        swlevelw[swlevels] = w;
+        swlevelh[swlevels] = h;
+        total += w*h;
+        swlevels++;
+        if(w <= 1 && h <= 1) break;
+        w = max((w+1)>>1, 1);
+        h = max((h+1)>>1, 1);
+    }
+    swdepth = new float[total];
+}
+
+struct swoccvert
+{
+    float x, y, z;
+};
+
+static inline bool swoccprojectbox(const vec &bbmin, const vec &bbmax, swoccvert *v)
+{
+    loopi(8)
+    {
+        vec4 p;
+        camprojmatrix.transform(vec(i&1 ? bbmax.x : bbmin.x, i&2 ? bbmax.y : bbmin.y, i&4 ? bbmax.z : bbmin.z), p);
+        if(p.w < nearplane) return false;
+        float invw = 1/p.w;
+        v[i].x = (p.x*invw*0.5f + 0.5f)*swwidth;
+        v[i].y = (p.y*invw*0.5f + 0.5f)*swheight;
+        v[i].z = p.z*invw;
+    }
+    return true;
+}
+
+// the same projection four corners at a time, for the queries that only need the screen bounds:
+// the lanes are the x/y corner combinations, the two halves are bbmin.z and bbmax.z
+static inline bool swoccprojectcorners(const vec &bbmin, const vec &bbmax, floatlanes *x, floatlanes *y, floatlanes *z)
+{
+    const float cx[4] = { bbmin.x, bbmax.x, bbmin.x, bbmax.x }, cy[4] = { bbmin.y, bbmin.y, bbmax.y, bbmax.y };
+    const matrix4 &m = camprojmatrix;
+    floatlanes px(cx), py(cy), near(nearplane), half(0.5f), one(1.0f), w = floatlanes(float(swwidth)), h = floatlanes(float(swheight)),
+               bx = floatlanes(m.a.x)*px + floatlanes(m.b.x)*py, by = floatlanes(m.a.y)*px + floatlanes(m.b.y)*py,
+               bz = floatlanes(m.a.z)*px + floatlanes(m.b.z)*py, bw = floatlanes(m.a.w)*px + floatlanes(m.b.w)*py;
+    loopk(2)
+    {
+        floatlanes pz(k ? bbmax.z : bbmin.z),
+                   tw = bw + floatlanes(m.c.w)*pz + floatlanes(m.d.w);
+        if(tw.lt(near)) return false;
+        floatlanes invw = one/tw;
+        x[k] = ((bx + floatlanes(m.c.x)*pz + floatlanes(m.d.x))*invw*half + half)*w;
+        y[k] = ((by + floatlanes(m.c.y)*pz + floatlanes(m.d.y))*invw*half + half)*h;
+        z[k] = (bz + floatlanes(m.c.z)*pz + floatlanes(m.d.z))*invw;
+    }
+    return true;
+}
+
+struct swoccedge
+{
+    float a, b, c;
+};
+
+static inline float swocccross(const swoccvert &o, const swoccvert &a, const swoccvert &b)
+{
+    return (a.x - o.x)*(b.y - o.y) - (a.y - o.y)*(b.x - o.x);
+}
+
+static inline bool swoccvertcmp(const swoccvert &a, const swoccvert &b)
+{
+    return a.x < b.x || (a.x == b.x && a.y < b.y);
+}
+
+// counter-clockwise convex hull of the projected corners
+static int swocchull(swoccvert *v, swoccvert *hull)
+{
+    insertionsort(v, 8, swoccvertcmp);
+    int n = 0;
+    loopi(8)
+    {
+        while(n >= 2 && swocccross(hull[n-2], hull[n-1], v[i]) <= 0) n--;
+        hull[n++] = v[i];
+    }
+    for(int i = 6, lower = n+1; i >= 0; i--)
+    {
+        while(n >= lower && swocccross(hull[n-2], hull[n-1], v[i]) <= 0) n--;
+        hull[n++] = v[i];
+    }
+    return n-1;
+}
+
+static void rasterswoccluder(const ivec &o, int size, int depth = 0)
+{
+    swoccvert v[8], hull[16];
+    if(!swoccprojectbox(vec(o), vec(o).add(size), v))
+    {
+        // boxes crossing the near plane are split a few times so close walls and floors still occlude
+        if(depth < 3 && size > 1) loopi(8) rasterswoccluder(ivec(i, o, size>>1), size>>1, depth+1);
+        return;
+    }
+
+    float xmin = v[0].x, xmax = v[0].x, ymin = v[0].y, ymax = v[0].y;
+    loopi(7) { xmin = min(xmin, v[i+1].x); xmax = max(xmax, v[i+1].x); ymin = min(ymin, v[i+1].y); ymax = max(ymax, v[i+1].y); }
+    if(xmax < 0 || ymax < 0 || xmin > swwidth || ymin > swheight) return;
+    if(xmax - xmin < swoccludermin || ymax - ymin < swoccludermin) return;
+
+    // the surface seen through a texel is the last front face plane the view ray crosses,
+    // and each face plane's depth is affine in screen space
+    float planes[3][3];
+    int numplanes = 0;
+    loopk(3)
+    {
+        int side;
+        if(camera1->o[k] < o[k]) side = 0;
+        else if(camera1->o[k] > o[k] + size) side = 1;
+        else continue;
+        int k1 = (k+1)%3, k2 = (k+2)%3, base = side<<k;
+        const swoccvert &a = v[base], &b = v[base | (1<<k1)], &c = v[base | (1<<k2)];
+        float bx = b.x - a.x, by = b.y - a.y, bz = b.z - a.z, cx = c.x - a.x, cy = c.y - a.y, cz = c.z - a.z,
+              det = bx*cy - cx*by;
+        if(fabs(det) < 1e-6f) continue;
+        float dzdx = (bz*cy - cz*by)/det, dzdy = (cz*bx - bz*cx)/det;
+        planes[numplanes][0] = dzdx;
+        planes[numplanes][1] = dzdy;
+        planes[numplanes][2] = a.z - dzdx*a.x - dzdy*a.y + 0.5f*(fabs(dzdx) + fabs(dzdy));
+        numplanes++;
+    }
+    if(!numplanes) return;
+    for(int i = numplanes; i < 3; i++) memcpy(planes[i], planes[0], sizeof(planes[0]));
+
+    int n = swocchull(v, hull);
+    if(n < 3) return;
+
+    swoccedge edges[16];
+    loopi(n)
+    {
+        const swoccvert &p0 = hull[i], &p1 = hull[i+1];
+        swoccedge &e = edges[i];
+        e.a = p0.y - p1.y;
+        e.b = p1.x - p0.x;
+        e.c = -(e.a*p0.x + e.b*p0.y) - 0.5f*(fabs(e.a) + fabs(e.b));
+    }
+
+    int y0 = max(int(ceilf(ymin)), 0), y1 = min(int(floorf(ymax)), swheight) - 1;
+    float *depth0 = swdepth;
+    for(int y = y0; y <= y1; y++)
+    {
+        float yc = y + 0.5f, left = 0, right = swwidth;
+        loopi(n)
+        {
+            const swoccedge &e = edges[i];
+            float d = e.b*yc + e.c;
+            if(e.a > 0) left = max(left, -d/e.a - 0.5f);
+            else if(e.a < 0) right = min(right, -d/e.a - 0.5f);
+            else if(d < 0) { left = right + 1; break; }
+        }
+        int x0 = max(int(ceilf(left)), 0), x1 = min(int(floorf(right)), swwidth-1);
+        if(x0 > x1) continue;
+        float *row = &depth0[y*swwidth],
+              c0 = planes[0][1]*yc + planes[0][2], c1 = planes[1][1]*yc + planes[1][2], c2 = planes[2][1]*yc + planes[2][2];
+        int x = x0;
+        if(x1 - x0 >= 3)
+        {
+            // four texels at a time, the rest of the span below
+            static const float offsets[4] = { 0.5f, 1.5f, 2.5f, 3.5f };
+            floatlanes xc = floatlanes(offsets) + floatlanes(float(x)), four(4.0f),
+                       dx0(planes[0][0]), dx1(planes[1][0]), dx2(planes[2][0]), l0(c0), l1(c1), l2(c2);
+            for(; x + 3 <= x1; x += 4, xc = xc + four)
+            {
+                floatlanes z = (dx0*xc + l0).max(dx1*xc + l1).max(dx2*xc + l2);
+                floatlanes(&row[x]).min(z).store(&row[x]);
+            }
+        }
+        for(; x <= x1; x++)
+        {
+            float xc = x + 0.5f, z = max(max(planes[0][0]*xc + c0, planes[1][0]*xc + c1), planes[2][0]*xc + c2);
+            row[x] = min(row[x], z);
+        }
+    }
+    swrasterized++;
+}
+
+static void buildswdepthlevels()
+{
+    for(int l = 1; l < swlevels; l++)
+    {
+        const float *src = &swdepth[swleveloffset[l-1]];
+        float *dst = &swdepth[swleveloffset[l]];
+        int sw = swlevelw[l-1], sh = swlevelh[l-1], dw = swlevelw[l], dh = swlevelh[l];
+        loopj(dh)
+        {
+            const float *r0 = &src[min(2*j, sh-1)*sw], *r1 = &src[min(2*j+1, sh-1)*sw];
+            float *d = &dst[j*dw];
+            loopi(dw)
+            {
+                int x0 = min(2*i, sw-1), x1 = min(2*i+1, sw-1);
+                d[i] = max(max(r0[x0], r0[x1]), max(r1[x0], r1[x1]));
+            }
+        }
+    }
+}
+
+void resetswocclusion()
+{
+    swdepthready = false;
+}
+
+void buildswocclusion()
+{
+    swdepthready = false;
+    if(!swocclusion || drawtex) return;
+    Uint64 start = SDL_GetPerformanceCounter();
+    updateswoccluders();
+    setupswdepth();
+    float *depth0 = swdepth;
+    loopi(swwidth*swheight) depth0[i] = 1e16f;
+    int budget = swoccluders;
+    for(vtxarray *va = visibleva; va && budget > 0; va = va->next) if(va->numoccluders && va->curvfc < VFC_FOGGED)
+    {
+        loopi(va->numoccluders)
+        {
+            const swoccluder &oc = swoccluderboxes[va->occluders + i];
+            rasterswoccluder(oc.o, oc.size);
+            if(--budget <= 0) break;
+        }
+    }
+    buildswdepthlevels();
+    swdepthready = true;
+    swbuildtime += double(SDL_GetPerformanceCounter() - start) / double(SDL_GetPerformanceFrequency());
+}
+
+bool swoccluded(const ivec &bbmin, const ivec &bbmax)
+{
+    if(!swdepthready || !swocclusion) return false;
+    floatlanes x[2], y[2], z[2];
+    if(!swoccprojectcorners(vec(bbmin), vec(bbmax), x, y, z)) return false;
+    float xmin = x[0].min(x[1]).hmin(), xmax = x[0].max(x[1]).hmax(),
+          ymin = y[0].min(y[1]).hmin(), ymax = y[0].max(y[1]).hmax(),
+          zmin = z[0].min(z[1]).hmin();
+    int x0 = max(int(floorf(xmin)), 0), x1 = min(int(ceilf(xmax)), swwidth) - 1,
+        y0 = max(int(floorf(ymin)), 0), y1 = min(int(ceilf(ymax)), swheight) - 1;
+    if(x0 > x1 || y0 > y1) return false;
+    swtested++;
+
+    // pick the level where the rectangle spans at most 4 texels each way
+    int level = 0;
+    while(level+1 < swlevels && max(x1 - x0, y1 - y0) >= 4<<level) level++;
+    x0 >>= level; x1 >>= level; y0 >>= level; y1 >>= level;
+    const float *depth = &swdepth[swleveloffset[level]];
+    int w = swlevelw[level];
+    for(int y = y0; y <= y1; y++)
+    {
+        const float *row = &depth[y*w];
+        float farthest = row[x0];
+        for(int x = x0+1; x <= x1; x++) farthest = max(farthest, row[x]);
+        if(farthest >= zmin) return false;
+    }
+    swculled++;
+    return true;
+}
+
+static void swocclusionstats(int *reset)
+{
+    conoutf("software occlusion: %d occluder boxes, %u rasterized, %u tested, %u culled (%.1f%%), %.3f s building",
+        swoccluderboxes.length(), swrasterized, swtested, swculled, 100.0f*swculled/max(swtested, 1u), swbuildtime);
+    if(*reset) { swrasterized = swtested = swculled = 0; swbuildtime = 0; }
+}
+COMMAND(swocclusionstats, "i");
+
+static uint swocctestseed = 0;
+
+static inline int swocctestrand(int n)
+{
+    swocctestseed = swocctestseed*1664525 + 1013904223;
+    return int((swocctestseed>>8)%uint(n));
+}
+
+// nearest entry distance along the ray into any of the test occluders
+static bool swocctestray(const vector<swoccluder> &boxes, const vec &o, const vec &ray, float &dist)
+{
+    bool hit = false;
+    loopv(boxes)
+    {
+        float f;
+        int orient;
+        if(rayboxintersect(vec(boxes[i].o), vec(boxes[i].size), o, ray, f, orient) && f >= 0 && (!hit || f < dist))
+        {
+            dist = f;
+            hit = true;
+        }
+    }
+    return hit;
+}
+
+// checks the rasterizer and the queries against ray casts on a synthetic scene in front of a fixed camera,
+// without any gl work: every written texel must lie behind the occluder surface everywhere inside it,
+// and every point sampled on a culled box must be hidden behind some occluder
+void swocclusiontest(int *numboxes, int *numqueries)
+{
+    if(!camera1) return;
+    int nboxes = clamp(*numboxes > 0 ? *numboxes : 256, 1, 65536), nqueries = clamp(*numqueries > 0 ? *numqueries : 1024, 1, 65536);
+
+    matrix4 oldcamprojmatrix = camprojmatrix;
+    vec oldcamera = camera1->o;
+    int oldswocclusion = swocclusion;
+    uint oldrasterized = swrasterized, oldtested = swtested, oldculled = swculled;
+
+    vec eye(2048, 2048, 2048);
+    matrix4 view = viewmatrix, proj;
+    view.translate(vec(eye).neg());
+    proj.perspective(90, 1, nearplane, 8192);
+    camprojmatrix.mul(proj, view);
+    camera1->o = eye;
+    swocclusion = 1;
+    setupswdepth();
+
+    matrix4 invcamproj;
+    invcamproj.invert(camprojmatrix);
+    vec fwd = invcamproj.perspectivetransform(vec(0, 0, 1)).sub(eye).normalize(),
+        right = invcamproj.perspectivetransform(vec(1, 0, 1)).sub(eye).normalize(),
+        up = invcamproj.perspectivetransform(vec(0, 1, 1)).sub(eye).normalize();
+
+    swocctestseed = 1;
+    vector<swoccluder> boxes;
+    while(boxes.length() < nboxes)
+    {
+        int size = 8<<swocctestrand(4);
+        vec c = vec(fwd).mul(64 + swocctestrand(960)).add(eye)
+                .add(vec(right).mul(swocctestrand(1024) - 512)).add(vec(up).mul(swocctestrand(1024) - 512));
+        ivec o = ivec(c).mask(~(size-1));
+        if(eye.x >= o.x - 1 && eye.x <= o.x + size + 1 && eye.y >= o.y - 1 && eye.y <= o.y + size + 1 && eye.z >= o.z - 1 && eye.z <= o.z + size + 1) continue;
+        boxes.add(swoccluder(NULL, o, size));
+    }
+
+    Uint64 start = SDL_GetPerformanceCounter();
+    loopi(swwidth*swheight) swdepth[i] = 1e16f;
+    loopv(boxes) rasterswoccluder(boxes[i].o, boxes[i].size);
+    buildswdepthlevels();
+    swdepthready = true;
+    double rastertime = double(SDL_GetPerformanceCounter() - start) / double(SDL_GetPerformanceFrequency());
+
+    int written = 0, texelerrors = 0;
+    loopj(swheight) loopi(swwidth)
+    {
+        float z = swdepth[j*swwidth + i];
+        if(z >= 1e16f) continue;
+        written++;
+        loopk(5)
+        {
+            float sx = i + (k < 4 ? (k&1 ? 0.95f : 0.05f) : 0.5f), sy = j + (k < 4 ? (k&2 ? 0.95f : 0.05f) : 0.5f),
+                  nx = 2*sx/swwidth - 1, ny = 2*sy/swheight - 1;
+            vec from = invcamproj.perspectivetransform(vec(nx, ny, -1)),
+                ray = invcamproj.perspectivetransform(vec(nx, ny, 1)).sub(from).normalize();
+            float dist;
+            if(!swocctestray(boxes, from, ray, dist) || camprojmatrix.perspectivetransform(vec(ray).mul(dist).add(from)).z > z + 1e-5f)
+            {
+                texelerrors++;
+                break;
+            }
+        }
+    }
+
+    int culled = 0, queryerrors = 0;
+    double querytime = 0;
+    loopi(nqueries)
+    {
+        int size = 4<<swocctestrand(5);
+        vec c = vec(fwd).mul(64 + swocctestrand(1984)).add(eye)
+                .add(vec(right).mul(swocctestrand(2048) - 1024)).add(vec(up).mul(swocctestrand(2048) - 1024));
+        ivec bbmin = ivec(c), bbmax = ivec(bbmin).add(size);
+        start = SDL_GetPerformanceCounter();
+        bool occluded = swoccluded(bbmin, bbmax);
+        querytime += double(SDL_GetPerformanceCounter() - start) / double(SDL_GetPerformanceFrequency());
+        if(!occluded) continue;
+        culled++;
+        loop(x, 5) loop(y, 5) loop(z, 5)
+        {
+            if(x%4 && y%4 && z%4) continue; // only the surface of the box
+            vec p = vec(x, y, z).mul(size/4.0f).add(vec(bbmin)), ray = vec(p).sub(eye), ndc = camprojmatrix.perspectivetransform(p);
+            if(fabs(ndc.x) > 1 || fabs(ndc.y) > 1) continue; // off screen points aren't seen anyway
+            float pdist = ray.magnitude(), dist;
+            ray.div(pdist);
+            if(!swocctestray(boxes, eye, ray, dist) || dist >= pdist)
+            {
+                queryerrors++;
+                goto nextquery;
+            }
+        }
+    nextquery:;
+    }
+
+    camprojmatrix = oldcamprojmatrix;
+    camera1->o = oldcamera;
+    swocclusion = oldswocclusion;
+    swrasterized = oldrasterized;
+    swtested = oldtested;
+    swculled = oldculled;
+    swdepthready = false;
+
+    conoutf("swocclusiontest: %d boxes rasterized in %.3f ms, %d of %d texels covered, %d too near; %d of %d queries culled in %.3f ms, %d wrongly",
+        nboxes, 1000*rastertime, written, swwidth*swheight, texelerrors, culled, nqueries, 1000*querytime, queryerrors);
+}
+COMMAND(swocclusiontest, "ii");
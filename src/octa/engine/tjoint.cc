@@ -0,0 +1,367 @@
+// tjoint.cc: finds t-joints where a cube edge ends partway along a neighbour's edge
+
+#include "engine.hh"
+
+vector<tjoint> tjoints;
+
+VARFP(filltjoints, 0, 1, 1, allchanged());
+
+static int tjointprogress = 0;
+#define progress(s)     if((tjointprogress++&0xFFF)==0) renderprogress(tjointprogress/(float)allocnodes, s);
+
+struct edgegroup
+{
+    ivec slope, origin;
+    int axis;
+};
+
+static inline uint hthash(const edgegroup &g)
+{
+    return g.slope.x^g.slope.y^g.slope.z^g.origin.x^g.origin.y^g.origin.z;
+}
+
+static inline bool htcmp(const edgegroup &x, const edgegroup &y)
+{
+    return x.slope==y.slope && x.origin==y.origin;
+}
+
+enum
+{
+    CE_START = 1<<0,
+    CE_END   = 1<<1,
+    CE_FLIP  = 1<<2,
+    CE_DUP   = 1<<3
+};
+
+struct cubeedge
+{
+    cube *c;
+    int next, offset;
+    ushort size;
+    uchar index, flags;
+};
+
+// edge groups are split into a fixed number of shards by hash, so grouping and the t-joint search can run per shard
+// while every group still sees its edges in tree order, no matter how many threads are used
+#define NUMEDGESHARDS 16
+
+struct tjointsplit
+{
+    cube *c;
+    ushort offset;
+    uchar edge, flip;
+};
+
+struct edgeshard
+{
+    vector<cubeedge> edges;
+    hashtable<edgegroup, int> groups;
+    vector<tjointsplit> splits;
+
+    edgeshard() : groups(1<<10) {}
+};
+
+static edgeshard edgeshards[NUMEDGESHARDS];
+
+static inline int edgeshardindex(const edgegroup &g)
+{
+    return (hthash(g)*0x9E3779B1U)>>(32-4);
+}
+
+static void addcubeedge(edgeshard &s, const edgegroup &g, cubeedge &ce)
+{
+    bool insert = true;
+    int *exists = s.groups.access(g);
+    if(exists)
+    {
+        int prev = -1, cur = *exists;
+        while(cur >= 0)
+        {
+            cubeedge &p = s.edges[cur];
+            if(p.flags&CE_DUP ?
+                ce.offset>=p.offset && ce.offset+ce.size<=p.offset+p.size :
+                ce.offset==p.offset && ce.size==p.size)
+            {
+                p.flags |= CE_DUP;
+                insert = false;
+                break;
+            }
+            else if(ce.offset >= p.offset)
+            {
+                if(ce.offset == p.offset+p.size) ce.flags &= ~CE_START;
+                prev = cur;
+                cur = p.next;
+            }
+            else break;
+        }
+        if(insert)
+        {
+            ce.next = cur;
+            while(cur >= 0)
+            {
+                cubeedge &p = s.edges[cur];
+                if(ce.offset+ce.size==p.offset) { ce.flags &= ~CE_END; break; }
+                cur = p.next;
+            }
+            if(prev>=0) s.edges[prev].next = s.edges.length();
+            else *exists = s.edges.length();
+        }
+    }
+    else s.groups[g] = s.edges.length();
+
+    if(insert) s.edges.add(ce);
+}
+
+struct rawcubeedge
+{
+    edgegroup g;
+    cubeedge ce;
+};
+
+struct edgejob
+{
+    cube *c;
+    ivec o;
+    int size, neighbourdepth;
+    const cube *neighbourstack[32];
+    vector<rawcubeedge> edges[NUMEDGESHARDS];
+};
+
+static vector<edgejob> edgejobs;
+static THREADLOCAL edgejob *curedgejob = NULL;
+
+void gencubeedges(cube &c, const ivec &co, int size)
+{
+    ivec pos[MAXFACEVERTS];
+    int vis;
+    loopi(6) if((vis = visibletris(c, i, co, size)))
+    {
+        int numverts = c.ext ? c.ext->surfaces[i].numverts&MAXFACEVERTS : 0;
+        if(numverts)
+        {
+            vertinfo *verts = c.ext->verts() + c.ext->surfaces[i].verts;
+            ivec vo = ivec(co).mask(~0xFFF).shl(3);
+            loopj(numverts)
+            {
+                vertinfo &v = verts[j];
+                pos[j] = ivec(v.x, v.y, v.z).add(vo);
+            }
+        }
+        else if(c.merged&(1<<i)) continue;
+        else
+        {
+            ivec v[4];
+            genfaceverts(c, i, v);
+            int order = vis&4 || (!flataxisface(c, i) && faceconvexity(v) < 0) ? 1 : 0;
+            ivec vo = ivec(co).shl(3);
+            pos[numverts++] = v[order].mul(size).add(vo);
+            if(vis&1) pos[numverts++] = v[order+1].mul(size).add(vo);
+            pos[numverts++] = v[order+2].mul(size).add(vo);
+            if(vis&2) pos[numverts++] = v[(order+3)&3].mul(size).add(vo);
+        }
+        loopj(numverts)
+        {
+            int e1 = j, e2 = j+1 < numverts ? j+1 : 0;
+            ivec d = pos[e2];
+            d.sub(pos[e1]);
+            if(d.iszero()) continue;
+            int axis = abs(d.x) > abs(d.y) ? (abs(d.x) > abs(d.z) ? 0 : 2) : (abs(d.y) > abs(d.z) ? 1 : 2);
+            if(d[axis] < 0)
+            {
+                d.neg();
+                swap(e1, e2);
+            }
+            reduceslope(d);
+
+            int t1 = pos[e1][axis]/d[axis],
+                t2 = pos[e2][axis]/d[axis];
+            edgegroup g;
+            g.origin = ivec(pos[e1]).sub(ivec(d).mul(t1));
+            g.slope = d;
+            g.axis = axis;
+            cubeedge ce;
+            ce.c = &c;
+            ce.offset = t1;
+            ce.size = t2 - t1;
+            ce.index = i*(MAXFACEVERTS+1)+j;
+            ce.flags = CE_START | CE_END | (e1!=j ? CE_FLIP : 0);
+            ce.next = -1;
+
+            int shard = edgeshardindex(g);
+            if(curedgejob)
+            {
+                rawcubeedge &r = curedgejob->edges[shard].add();
+                r.g = g;
+                r.ce = ce;
+            }
+            else addcubeedge(edgeshards[shard], g, ce);
+        }
+    }
+}
+
+void gencubeedges(cube *c = worldroot, const ivec &co = ivec(0, 0, 0), int size = worldsize>>1)
+{
+    if(!curedgejob) progress("fixing t-joints...");
+    neighbourstack[++neighbourdepth] = c;
+    loopi(8)
+    {
+        ivec o(i, co, size);
+        if(c[i].ext) c[i].ext->tjoints = -1;
+        if(c[i].children) gencubeedges(c[i].children, o, size>>1);
+        else if(!isempty(c[i])) gencubeedges(c[i], o, size);
+    }
+    --neighbourdepth;
+}
+
+// splits the walk into jobs in tree order, so merging their edges in job order matches a serial walk
+static void findedgejobs(cube *c, const ivec &co, int size, int jobsize)
+{
+    progress("fixing t-joints...");
+    neighbourstack[++neighbourdepth] = c;
+    loopi(8)
+    {
+        ivec o(i, co, size);
+        if(c[i].ext) c[i].ext->tjoints = -1;
+        if(c[i].children && size > jobsize) findedgejobs(c[i].children, o, size>>1, jobsize);
+        else if(c[i].children || !isempty(c[i]))
+        {
+            edgejob &j = edgejobs.add();
+            j.c = &c[i];
+            j.o = o;
+            j.size = size;
+            j.neighbourdepth = neighbourdepth;
+            memcpy(j.neighbourstack, neighbourstack, (neighbourdepth+1)*sizeof(const cube *));
+        }
+    }
+    --neighbourdepth;
+}
+
+static void genedgejob(void *data, int index, int thread)
+{
+    edgejob &j = edgejobs[index];
+    int oldneighbourdepth = neighbourdepth;
+    neighbourdepth = j.neighbourdepth;
+    memcpy(neighbourstack, j.neighbourstack, (neighbourdepth+1)*sizeof(const cube *));
+    curedgejob = &j;
+
+    cube &c = *j.c;
+    if(c.children) gencubeedges(c.children, j.o, j.size>>1);
+    else gencubeedges(c, j.o, j.size);
+
+    curedgejob = NULL;
+    neighbourdepth = oldneighbourdepth;
+}
+
+static void groupedgeshard(void *data, int shard, int thread)
+{
+    edgeshard &s = edgeshards[shard];
+    loopv(edgejobs)
+    {
+        vector<rawcubeedge> &edges = edgejobs[i].edges[shard];
+        loopvj(edges) addcubeedge(s, edges[j].g, edges[j].ce);
+    }
+}
+
+static void addtjoint(edgeshard &s, const edgegroup &g, const cubeedge &e, int offset)
+{
+    int vcoord = (g.slope[g.axis]*offset + g.origin[g.axis]) & 0x7FFF;
+    tjointsplit &t = s.splits.add();
+    t.c = e.c;
+    t.offset = vcoord / g.slope[g.axis];
+    t.edge = e.index;
+    t.flip = e.flags&CE_FLIP ? 1 : 0;
+}
+
+static void linktjoint(const tjointsplit &t)
+{
+    tjoint &tj = tjoints.add();
+    tj.offset = t.offset;
+    tj.edge = t.edge;
+
+    int prev = -1, cur = ext(*t.c).tjoints;
+    while(cur >= 0)
+    {
+        tjoint &o = tjoints[cur];
+        if(tj.edge < o.edge || (tj.edge==o.edge && (t.flip ? tj.offset > o.offset : tj.offset < o.offset))) break;
+        prev = cur;
+        cur = o.next;
+    }
+
+    tj.next = cur;
+    if(prev < 0) t.c->ext->tjoints = tjoints.length()-1;
+    else tjoints[prev].next = tjoints.length()-1;
+}
+
+static void findtjoints(edgeshard &s, int cur, const edgegroup &g)
+{
+    int active = -1;
+    while(cur >= 0)
+    {
+        cubeedge &e = s.edges[cur];
+        int prevactive = -1, curactive = active;
+        while(curactive >= 0)
+        {
+            cubeedge &a = s.edges[curactive];
+            if(a.offset+a.size <= e.offset)
+            {
+                if(prevactive >= 0) s.edges[prevactive].next = a.next;
+                else active = a.next;
+            }
+            else
+            {
+                prevactive = curactive;
+                if(!(a.flags&CE_DUP))
+                {
+                    if(e.flags&CE_START && e.offset > a.offset && e.offset < a.offset+a.size)
+                        addtjoint(s, g, a, e.offset);
+                    if(e.flags&CE_END && e.offset+e.size > a.offset && e.offset+e.size < a.offset+a.size)
+                        addtjoint(s, g, a, e.offset+e.size);
+                }
+                if(!(e.flags&CE_DUP))
+                {
+                    if(a.flags&CE_START && a.offset > e.offset && a.offset < e.offset+e.size)
+                        addtjoint(s, g, e, a.offset);
+                    if(a.flags&CE_END && a.offset+a.size > e.offset && a.offset+a.size < e.offset+e.size)
+                        addtjoint(s, g, e, a.offset+a.size);
+                }
+            }
+            curactive = a.next;
+        }
+        int next = e.next;
+        e.next = active;
+        active = cur;
+        cur = next;
+    }
+}
+
+static void findshardtjoints(void *data, int shard, int thread)
+{
+    edgeshard &s = edgeshards[shard];
+    enumeratekt(s.groups, edgegroup, g, int, e, findtjoints(s, e, g));
+}
+
+void findtjoints()
+{
+    tjointprogress = 0;
+    int threads = jobthreadcount(vathreads);
+    if(threads > 1)
+    {
+        findedgejobs(worldroot, ivec(0, 0, 0), worldsize>>1, min(0x1000, worldsize>>3));
+        runjobs(genedgejob, NULL, edgejobs.length(), threads);
+        runjobs(groupedgeshard, NULL, NUMEDGESHARDS, threads);
+        edgejobs.shrink(0);
+    }
+    else gencubeedges();
+    runjobs(findshardtjoints, NULL, NUMEDGESHARDS, threads);
+
+    // link in shard order, every cube edge belongs to a single group so its t-joints stay in the same order
+    tjoints.setsize(0);
+    loopi(NUMEDGESHARDS)
+    {
+        edgeshard &s = edgeshards[i];
+        loopvj(s.splits) linktjoint(s.splits[j]);
+        s.splits.setsize(0);
+        s.edges.setsize(0);
+        s.groups.clear();
+    }
+}
@@ -107,7 +107,11 @@ void modifyoctaentity(int flags, int id, extentity &e, cube *c, const ivec &cor,
             modifyoctaentity(flags, id, e, c[i].children, o, size>>1, bo, br, leafsize, va);
         else if(flags&MODOE_ADD)
         {
-            if(!c[i].ext || !c[i].ext->ents) ext(c[i]).ents = new octaentities(o, size);
+            if(!c[i].ext || !c[i].ext->ents)
+            {
+                ext(c[i]).ents = new octaentities(o, size);
+                invalidatelinearocta();
+            }
             octaentities &oe = *c[i].ext->ents;
             switch(e.type)
             {
@@ -282,6 +286,7 @@ void freeoctaentities(cube &c)
     {
         delete c.ext->ents;
         c.ext->ents = NULL;
+        invalidatelinearocta();
     }
 }
 
@@ -637,6 +642,8 @@ void entdrag(const vec &ray)
     entmoving = 2;
 }
 
+// entity selection and radius drawing, there is nothing to draw in the mapcompiler
+#ifndef MAPCOMPILER
 VAR(showentradius, 0, 1, 1);
 
 void renderentring(const extentity &e, float radius, int axis)
@@ -971,6 +978,7 @@ void renderentselection(const vec &o, const vec &ray, bool entmoving)
 
     gle::disable();
 }
+#endif
 
 bool enttoggle(int id)
 {
@@ -1409,6 +1417,7 @@ bool emptymap(int scale, bool force, const char *mname, bool usecfg)    // main
 
     texmru.shrink(0);
     freeocta(worldroot);
+    releasecubes();
     worldroot = newcubes(F_EMPTY);
     loopi(4) solidfaces(worldroot[i]);
 
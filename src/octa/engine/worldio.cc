@@ -60,125 +60,128 @@ struct polysurfacecompat
 
 static int savemapprogress = 0;
 
-void savec(cube *c, const ivec &o, int size, stream *f, bool nolms)
-{
-    if((savemapprogress++&0xFFF)==0) renderprogress(float(savemapprogress)/allocnodes, "saving octree...");
+void savechildren(cube *c, const ivec &o, int size, stream *f, bool nolms);
 
-    loopi(8)
+void savec(cube &c, const ivec &co, int size, stream *f, bool nolms)
+{
+    if(c.children)
     {
-        ivec co(i, o, size);
-        if(c[i].children)
-        {
-            f->putchar(OCTSAV_CHILDREN);
-            savec(c[i].children, co, size>>1, f, nolms);
-        }
+        f->putchar(OCTSAV_CHILDREN);
+        savechildren(c.children, co, size>>1, f, nolms);
+    }
+    else
+    {
+        int oflags = 0, surfmask = 0, totalverts = 0;
+        if(c.material!=MAT_AIR) oflags |= 0x40;
+        if(isempty(c)) f->putchar(oflags | OCTSAV_EMPTY);
         else
         {
-            int oflags = 0, surfmask = 0, totalverts = 0;
-            if(c[i].material!=MAT_AIR) oflags |= 0x40;
-            if(isempty(c[i])) f->putchar(oflags | OCTSAV_EMPTY);
-            else
+            if(!nolms)
             {
-                if(!nolms)
+                if(c.merged) oflags |= 0x80;
+                if(c.ext) loopj(6)
                 {
-                    if(c[i].merged) oflags |= 0x80;
-                    if(c[i].ext) loopj(6)
-                    {
-                        const surfaceinfo &surf = c[i].ext->surfaces[j];
-                        if(!surf.used()) continue;
-                        oflags |= 0x20;
-                        surfmask |= 1<<j;
-                        totalverts += surf.totalverts();
-                    }
+                    const surfaceinfo &surf = c.ext->surfaces[j];
+                    if(!surf.used()) continue;
+                    oflags |= 0x20;
+                    surfmask |= 1<<j;
+                    totalverts += surf.totalverts();
                 }
+            }
 
-                if(isentirelysolid(c[i])) f->putchar(oflags | OCTSAV_SOLID);
-                else
-                {
-                    f->putchar(oflags | OCTSAV_NORMAL);
-                    f->write(c[i].edges, 12);
-                }
+            if(isentirelysolid(c)) f->putchar(oflags | OCTSAV_SOLID);
+            else
+            {
+                f->putchar(oflags | OCTSAV_NORMAL);
+                f->write(c.edges, 12);
             }
+        }
 
-            loopj(6) f->putlil<ushort>(c[i].texture[j]);
+        loopj(6) f->putlil<ushort>(c.texture[j]);
 
-            if(oflags&0x40) f->putlil<ushort>(c[i].material);
-            if(oflags&0x80) f->putchar(c[i].merged);
-            if(oflags&0x20)
+        if(oflags&0x40) f->putlil<ushort>(c.material);
+        if(oflags&0x80) f->putchar(c.merged);
+        if(oflags&0x20)
+        {
+            f->putchar(surfmask);
+            f->putchar(totalverts);
+            loopj(6) if(surfmask&(1<<j))
             {
-                f->putchar(surfmask);
-                f->putchar(totalverts);
-                loopj(6) if(surfmask&(1<<j))
+                surfaceinfo surf = c.ext->surfaces[j];
+                vertinfo *verts = c.ext->verts() + surf.verts;
+                int layerverts = surf.numverts&MAXFACEVERTS, numverts = surf.totalverts(),
+                    vertmask = 0, vertorder = 0,
+                    dim = dimension(j), vc = C[dim], vr = R[dim];
+                if(numverts)
                 {
-                    surfaceinfo surf = c[i].ext->surfaces[j];
-                    vertinfo *verts = c[i].ext->verts() + surf.verts;
-                    int layerverts = surf.numverts&MAXFACEVERTS, numverts = surf.totalverts(),
-                        vertmask = 0, vertorder = 0,
-                        dim = dimension(j), vc = C[dim], vr = R[dim];
-                    if(numverts)
+                    if(c.merged&(1<<j))
                     {
-                        if(c[i].merged&(1<<j))
+                        vertmask |= 0x04;
+                        if(layerverts == 4)
                         {
-                            vertmask |= 0x04;
-                            if(layerverts == 4)
+                            ivec v[4] = { verts[0].getxyz(), verts[1].getxyz(), verts[2].getxyz(), verts[3].getxyz() };
+                            loopk(4)
                             {
-                                ivec v[4] = { verts[0].getxyz(), verts[1].getxyz(), verts[2].getxyz(), verts[3].getxyz() };
-                                loopk(4)
+                                const ivec &v0 = v[k], &v1 = v[(k+1)&3], &v2 = v[(k+2)&3], &v3 = v[(k+3)&3];
+                                if(v1[vc] == v0[vc] && v1[vr] == v2[vr] && v3[vc] == v2[vc] && v3[vr] == v0[vr])
                                 {
-                                    const ivec &v0 = v[k], &v1 = v[(k+1)&3], &v2 = v[(k+2)&3], &v3 = v[(k+3)&3];
-                                    if(v1[vc] == v0[vc] && v1[vr] == v2[vr] && v3[vc] == v2[vc] && v3[vr] == v0[vr])
-                                    {
-                                        vertmask |= 0x01;
-                                        vertorder = k;
-                                        break;
-                                    }
+                                    vertmask |= 0x01;
+                                    vertorder = k;
+                                    break;
                                 }
                             }
                         }
-                        else
-                        {
-                            int vis = visibletris(c[i], j, co, size);
-                            if(vis&4 || faceconvexity(c[i], j) < 0) vertmask |= 0x01;
-                            if(layerverts < 4 && vis&2) vertmask |= 0x02;
-                        }
-                        bool matchnorm = true;
-                        loopk(numverts)
-                        {
-                            const vertinfo &v = verts[k];
-                            if(v.norm) { vertmask |= 0x80; if(v.norm != verts[0].norm) matchnorm = false; }
-                        }
-                        if(matchnorm) vertmask |= 0x08;
                     }
-                    surf.verts = vertmask;
-                    f->write(&surf, sizeof(surf));
-                    bool hasxyz = (vertmask&0x04)!=0, hasnorm = (vertmask&0x80)!=0;
-                    if(layerverts == 4)
+                    else
                     {
-                        if(hasxyz && vertmask&0x01)
-                        {
-                            ivec v0 = verts[vertorder].getxyz(), v2 = verts[(vertorder+2)&3].getxyz();
-                            f->putlil<ushort>(v0[vc]); f->putlil<ushort>(v0[vr]);
-                            f->putlil<ushort>(v2[vc]); f->putlil<ushort>(v2[vr]);
-                            hasxyz = false;
-                        }
+                        int vis = visibletris(c, j, co, size);
+                        if(vis&4 || faceconvexity(c, j) < 0) vertmask |= 0x01;
+                        if(layerverts < 4 && vis&2) vertmask |= 0x02;
                     }
-                    if(hasnorm && vertmask&0x08) { f->putlil<ushort>(verts[0].norm); hasnorm = false; }
-                    if(hasxyz || hasnorm) loopk(layerverts)
+                    bool matchnorm = true;
+                    loopk(numverts)
                     {
-                        const vertinfo &v = verts[(k+vertorder)%layerverts];
-                        if(hasxyz)
-                        {
-                            ivec xyz = v.getxyz();
-                            f->putlil<ushort>(xyz[vc]); f->putlil<ushort>(xyz[vr]);
-                        }
-                        if(hasnorm) f->putlil<ushort>(v.norm);
+                        const vertinfo &v = verts[k];
+                        if(v.norm) { vertmask |= 0x80; if(v.norm != verts[0].norm) matchnorm = false; }
                     }
+                    if(matchnorm) vertmask |= 0x08;
+                }
+                surf.verts = vertmask;
+                f->write(&surf, sizeof(surf));
+                bool hasxyz = (vertmask&0x04)!=0, hasnorm = (vertmask&0x80)!=0;
+                if(layerverts == 4)
+                {
+                    if(hasxyz && vertmask&0x01)
+                    {
+                        ivec v0 = verts[vertorder].getxyz(), v2 = verts[(vertorder+2)&3].getxyz();
+                        f->putlil<ushort>(v0[vc]); f->putlil<ushort>(v0[vr]);
+                        f->putlil<ushort>(v2[vc]); f->putlil<ushort>(v2[vr]);
+                        hasxyz = false;
+                    }
+                }
+                if(hasnorm && vertmask&0x08) { f->putlil<ushort>(verts[0].norm); hasnorm = false; }
+                if(hasxyz || hasnorm) loopk(layerverts)
+                {
+                    const vertinfo &v = verts[(k+vertorder)%layerverts];
+                    if(hasxyz)
+                    {
+                        ivec xyz = v.getxyz();
+                        f->putlil<ushort>(xyz[vc]); f->putlil<ushort>(xyz[vr]);
+                    }
+                    if(hasnorm) f->putlil<ushort>(v.norm);
                 }
             }
         }
     }
 }
 
+void savechildren(cube *c, const ivec &o, int size, stream *f, bool nolms)
+{
+    if((savemapprogress++&0xFFF)==0) renderprogress(float(savemapprogress)/allocnodes, "saving octree...");
+
+    loopi(8) savec(c[i], ivec(i, o, size), size, f, nolms);
+}
+
 cube *loadchildren(stream *f, const ivec &co, int size, bool &failed);
 
 void loadc(stream *f, cube &c, const ivec &co, int size, bool &failed)
@@ -300,6 +303,96 @@ cube *loadchildren(stream *f, const ivec &co, int size, bool &failed)
     return c;
 }
 
+// since version 2 the octree is split into independently compressed chunks stored raw after the gzip stream
+#define MAPCHUNKDEPTH 2
+
+enum { OCTSAV_CHUNK = 1 };
+
+struct mapchunk
+{
+    cube *c;
+    ivec o;
+    int size;
+    uint offset, len, rawlen;
+    bool failed;
+};
+
+static vector<mapchunk> mapchunks;
+static uchar *mapchunkdata = NULL;
+
+static bool savechunks(cube *c, const ivec &co, int size, int depth, stream *f, vector<uchar> &data, bool nolms)
+{
+    loopi(8)
+    {
+        ivec o(i, co, size);
+        if(c[i].children && depth+1 < MAPCHUNKDEPTH)
+        {
+            f->putchar(OCTSAV_CHILDREN);
+            if(!savechunks(c[i].children, o, size>>1, depth+1, f, data, nolms)) return false;
+            continue;
+        }
+        f->putchar(OCTSAV_CHUNK);
+        vector<uchar> raw;
+        stream *s = openmemfile(raw, "wb");
+        savec(c[i], o, size, s, nolms);
+        delete s;
+        uLongf len = compressBound(raw.length());
+        uchar *buf = data.reserve(len).buf;
+        if(compress2(buf, &len, raw.getbuf(), raw.length(), Z_BEST_COMPRESSION) != Z_OK) return false;
+        data.advance(len);
+        mapchunk &ch = mapchunks.add();
+        ch.len = len;
+        ch.rawlen = raw.length();
+    }
+    return true;
+}
+
+static void loadchunks(stream *f, cube *c, const ivec &co, int size, bool &failed)
+{
+    loopi(8)
+    {
+        ivec o(i, co, size);
+        switch(f->getchar())
+        {
+            case OCTSAV_CHILDREN:
+                c[i].children = newcubes();
+                loadchunks(f, c[i].children, o, size>>1, failed);
+                break;
+
+            case OCTSAV_CHUNK:
+            {
+                mapchunk &ch = mapchunks.add();
+                ch.c = &c[i];
+                ch.o = o;
+                ch.size = size;
+                ch.failed = false;
+                break;
+            }
+
+            default: failed = true; return;
+        }
+        if(failed) return;
+    }
+}
+
+static void loadmapchunk(void *data, int index, int thread)
+{
+    mapchunk &ch = mapchunks[index];
+    vector<uchar> raw;
+    uLongf rawlen = ch.rawlen;
+    if(uncompress(raw.pad(ch.rawlen), &rawlen, mapchunkdata + ch.offset, ch.len) != Z_OK || rawlen != ch.rawlen) { ch.failed = true; return; }
+    stream *f = openmemfile(raw, "rb");
+    loadc(f, *ch.c, ch.o, ch.size, ch.failed);
+    delete f;
+}
+
+static int countnodes(cube *c)
+{
+    int n = 1;
+    loopi(8) if(c[i].children) n += countnodes(c[i].children);
+    return n;
+}
+
 VAR(dbgvars, 0, 0, 1);
 
 void savevslot(stream *f, VSlot &vs, int prev)
@@ -465,8 +558,8 @@ bool save_world(const char *mname, bool nolms)
     if(!*mname) mname = game::getclientmap();
     setmapfilenames(*mname ? mname : "untitled");
     if(savebak) backup(ofmname, bakname);
-    stream *f = opengzfile(ofmname, "wb");
-    if(!f) { conoutf(CON_WARN, "could not write map to %s", ofmname); return false; }
+    stream *raw = openfile(ofmname, "wb"), *f = raw ? opengzfile(NULL, "wb", raw) : NULL;
+    if(!f) { DELETEP(raw); conoutf(CON_WARN, "could not write map to %s", ofmname); return false; }
 
     int numvslots = vslots.length();
     if(!nolms && !multiplayer(false))
@@ -528,7 +621,23 @@ bool save_world(const char *mname, bool nolms)
     savevslots(f, numvslots);
 
     renderprogress(0, "saving octree...");
-    savec(worldroot, ivec(0, 0, 0), worldsize>>1, f, nolms);
+    vector<uchar> chunkdata;
+    mapchunks.setsize(0);
+    if(!savechunks(worldroot, ivec(0, 0, 0), worldsize>>1, 0, f, chunkdata, nolms))
+    {
+        mapchunks.setsize(0);
+        delete f;
+        delete raw;
+        conoutf(CON_ERROR, "could not compress octree for map %s", ofmname);
+        return false;
+    }
+    f->putlil<int>(mapchunks.length());
+    loopv(mapchunks)
+    {
+        f->putlil<uint>(mapchunks[i].len);
+        f->putlil<uint>(mapchunks[i].rawlen);
+    }
+    mapchunks.setsize(0);
 
     if(!nolms)
     {
@@ -537,6 +646,8 @@ bool save_world(const char *mname, bool nolms)
     if(shouldsaveblendmap()) { renderprogress(0, "saving blendmap..."); saveblendmap(f); }
 
     delete f;
+    raw->write(chunkdata.getbuf(), chunkdata.length());
+    delete raw;
     extern void writemediacfg(int level);
     writemediacfg(0);
     export_ents();
@@ -599,15 +710,16 @@ bool load_world(const char *mname, const char *cname)        // still supports a
     int loadingstart = SDL_GetTicks();
     setmapfilenames(mname, cname);
     const char *mapname = ofmname;
-    stream *f = opengzfile(mapname, "rb");
-    if(!f) { mapname = ogzname; f = opengzfile(mapname, "rb"); }
-    if(!f) { conoutf(CON_ERROR, "could not read map %s", ofmname); return false; }
+    stream *raw = openfile(mapname, "rb");
+    if(!raw) { mapname = ogzname; raw = openfile(mapname, "rb"); }
+    stream *f = raw ? openreadahead(opengzfile(NULL, "rb", raw)) : NULL;
+    if(!f) { DELETEP(raw); conoutf(CON_ERROR, "could not read map %s", ofmname); return false; }
 
     mapheader hdr;
     tmapheader thdr;
     int numents;
     bool foreign;
-    if(!loadmapheader(f, mapname, hdr, thdr, numents, foreign)) { delete f; return false; }
+    if(!loadmapheader(f, mapname, hdr, thdr, numents, foreign)) { delete f; delete raw; return false; }
 
     resetmap();
 
@@ -619,6 +731,7 @@ bool load_world(const char *mname, const char *cname)        // still supports a
 
     freeocta(worldroot);
     worldroot = NULL;
+    releasecubes();
 
     setvar("mapsize", hdr.worldsize, true, false);
     int worldscale = 0;
@@ -801,20 +914,67 @@ bool load_world(const char *mname, const char *cname)        // still supports a
 
     renderprogress(0, "loading octree...");
     bool failed = false;
-    worldroot = loadchildren(f, ivec(0, 0, 0), hdr.worldsize>>1, failed);
-    if(failed) conoutf(CON_ERROR, "garbage in map");
+    if(hdr.version >= 2 && !foreign)
+    {
+        mapchunks.setsize(0);
+        worldroot = newcubes();
+        loadchunks(f, worldroot, ivec(0, 0, 0), hdr.worldsize>>1, failed);
+        uint chunkdatalen = 0;
+        if(!failed && f->getlil<int>() == mapchunks.length()) loopv(mapchunks)
+        {
+            mapchunk &ch = mapchunks[i];
+            ch.offset = chunkdatalen;
+            ch.len = f->getlil<uint>();
+            ch.rawlen = f->getlil<uint>();
+            chunkdatalen += ch.len;
+        }
+        else failed = true;
 
-    renderprogress(0, "validating...");
-    validatec(worldroot, hdr.worldsize>>1);
+        if(!failed)
+        {
+            if(hdr.numpvs > 0) loadpvs(f, hdr.numpvs);
+            if(hdr.blendmap) loadblendmap(f, hdr.blendmap);
+        }
+        mapcrc = f->getcrc();
+        delete f;
 
-    if(!failed)
-    {
-        if(hdr.numpvs > 0) loadpvs(f, hdr.numpvs);
-        if(hdr.blendmap) loadblendmap(f, hdr.blendmap);
+        if(!failed)
+        {
+            mapchunkdata = new uchar[max(chunkdatalen, 1U)];
+            if(!raw->seek(-stream::offset(chunkdatalen), SEEK_END) || raw->read(mapchunkdata, chunkdatalen) != chunkdatalen) failed = true;
+            else
+            {
+                mapcrc = crc32(mapcrc, mapchunkdata, chunkdatalen);
+                runjobs(loadmapchunk, NULL, mapchunks.length());
+                loopv(mapchunks) if(mapchunks[i].failed) failed = true;
+            }
+            DELETEA(mapchunkdata);
+        }
+        mapchunks.setsize(0);
+        allocnodes = countnodes(worldroot);
+        if(failed) conoutf(CON_ERROR, "garbage in map");
+
+        renderprogress(0, "validating...");
+        validatec(worldroot, hdr.worldsize>>1);
     }
+    else
+    {
+        worldroot = loadchildren(f, ivec(0, 0, 0), hdr.worldsize>>1, failed);
+        if(failed) conoutf(CON_ERROR, "garbage in map");
 
-    mapcrc = f->getcrc();
-    delete f;
+        renderprogress(0, "validating...");
+        validatec(worldroot, hdr.worldsize>>1);
+
+        if(!failed)
+        {
+            if(hdr.numpvs > 0) loadpvs(f, hdr.numpvs);
+            if(hdr.blendmap) loadblendmap(f, hdr.blendmap);
+        }
+
+        mapcrc = f->getcrc();
+        delete f;
+    }
+    delete raw;
 
     extern void clear_texpacks(int n = 0); clear_texpacks();
 
@@ -833,12 +993,16 @@ bool load_world(const char *mname, const char *cname)        // still supports a
     logger::log(logger::DEBUG, "Requesting active entities...");
 //    game::addmsg(N_ACTIVEENTSREQUEST, "r"); // ask for players/logic entities
 
+#ifndef MAPCOMPILER
     preloadusedmapmodels(true);
     flushpreloadedmodels();
+#endif
 
     entitiesinoctanodes();
     attachentities();
+#ifndef MAPCOMPILER
     initlights();
+#endif
     allchanged(true);
 
     renderbackground("loading...", picname, mname, game::getmapinfo());
@@ -846,7 +1010,9 @@ bool load_world(const char *mname, const char *cname)        // still supports a
     logger::log(logger::DEBUG, "load_world complete.");
     logoutf("[[MAP LOADING]] - Success.");
 
+#ifndef MAPCOMPILER
     startmap(cname ? cname : mname);
+#endif
 
     return true;
 }
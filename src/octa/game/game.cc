@@ -162,6 +162,9 @@ namespace game
 
     void otherplayers(int curtime)
     {
+        static vector<physent *> movers, deadmovers;
+        movers.setsize(0);
+        deadmovers.setsize(0);
         loopv(players)
         {
             gameent *d = players[i];
@@ -180,10 +183,12 @@ namespace game
             {
                 crouchplayer(d, 10, false);
                 if(smoothmove && d->smoothmillis>0) predictplayer(d, true);
-                else moveplayer(d, 1, false);
+                else movers.add(d);
             }
-            else if(d->state==CS_DEAD && !d->ragdoll && lastmillis-d->lastdeath<2000) moveplayer(d, 1, true);
+            else if(d->state==CS_DEAD && !d->ragdoll && lastmillis-d->lastdeath<2000) deadmovers.add(d);
         }
+        moveplayers(movers.getbuf(), movers.length(), 1, false);
+        moveplayers(deadmovers.getbuf(), deadmovers.length(), 1, true);
     }
 
     struct dynentcollision {
@@ -627,7 +632,6 @@ namespace game
         float maxdist = to.dist(from, unitv);
         unitv.div(maxdist);
 
-        vec hitpos;
         int orient, ent;
         dist = rayent(from, unitv, 1e16f, RAY_CLIPMAT|RAY_ALPHAPOLY, 0, orient, ent);
 
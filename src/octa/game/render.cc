@@ -34,6 +34,8 @@ namespace game
     CLUAICOMMAND(ragdolls_clear, void, (), clearragdolls(););
 
     void moveragdolls() {
+        static vector<dynent *> moving;
+        moving.setsize(0);
         loopv(ragdolls)
         {
             gameent *d = ragdolls[i];
@@ -42,8 +44,9 @@ namespace game
                 delete ragdolls.remove(i--);
                 continue;
             }
-            moveragdoll(d);
+            moving.add(d);
         }
+        ::moveragdolls(moving.getbuf(), moving.length());
     }
 
     CLUAICOMMAND(ragdolls_move, void, (), moveragdolls(););
@@ -30,6 +30,10 @@
 #include <assert.h>
 #include <time.h>
 
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
 #include "ostd/types.hh"
 #include "ostd/new.hh"
 #include "ostd/algorithm.hh"
@@ -84,7 +84,7 @@ struct vec
         float v[3];
     };
 
-    vec() {}
+    vec() = default;
     explicit vec(int a) : x(a), y(a), z(a) {}
     explicit vec(float a) : x(a), y(a), z(a) {}
     vec(float a, float b, float c) : x(a), y(b), z(c) {}
@@ -1919,6 +1919,64 @@ struct squat
     }
 };
 
+// four floats processed side by side, SSE where available and plain loops otherwise
+struct floatlanes
+{
+#ifdef __SSE__
+    __m128 v;
+
+    floatlanes() {}
+    floatlanes(__m128 v) : v(v) {}
+    explicit floatlanes(float f) : v(_mm_set1_ps(f)) {}
+    explicit floatlanes(const float *f) : v(_mm_loadu_ps(f)) {}
+
+    void store(float *f) const { _mm_storeu_ps(f, v); }
+
+    floatlanes operator+(const floatlanes &o) const { return _mm_add_ps(v, o.v); }
+    floatlanes operator-(const floatlanes &o) const { return _mm_sub_ps(v, o.v); }
+    floatlanes operator*(const floatlanes &o) const { return _mm_mul_ps(v, o.v); }
+    floatlanes operator/(const floatlanes &o) const { return _mm_div_ps(v, o.v); }
+    floatlanes min(const floatlanes &o) const { return _mm_min_ps(v, o.v); }
+    floatlanes max(const floatlanes &o) const { return _mm_max_ps(v, o.v); }
+    floatlanes clamp0() const { return _mm_max_ps(v, _mm_setzero_ps()); }
+    floatlanes abs() const { return _mm_andnot_ps(_mm_set1_ps(-0.0f), v); }
+    floatlanes sqrt() const { return _mm_sqrt_ps(v); }
+
+    float hmin() const { __m128 m = _mm_min_ps(v, _mm_movehl_ps(v, v)); return _mm_cvtss_f32(_mm_min_ss(m, _mm_shuffle_ps(m, m, 1))); }
+    float hmax() const { __m128 m = _mm_max_ps(v, _mm_movehl_ps(v, v)); return _mm_cvtss_f32(_mm_max_ss(m, _mm_shuffle_ps(m, m, 1))); }
+
+    // bit i is set for lanes where this <= o (le) or this < o (lt)
+    int le(const floatlanes &o) const { return _mm_movemask_ps(_mm_cmple_ps(v, o.v)); }
+    int lt(const floatlanes &o) const { return _mm_movemask_ps(_mm_cmplt_ps(v, o.v)); }
+#else
+    float v[4];
+
+    floatlanes() {}
+    explicit floatlanes(float f) { loopi(4) v[i] = f; }
+    explicit floatlanes(const float *f) { loopi(4) v[i] = f[i]; }
+
+    void store(float *f) const { loopi(4) f[i] = v[i]; }
+
+    #define FLOATLANESOP(op, body) floatlanes op(const floatlanes &o) const { floatlanes r; loopi(4) r.v[i] = body; return r; }
+    FLOATLANESOP(operator+, v[i] + o.v[i])
+    FLOATLANESOP(operator-, v[i] - o.v[i])
+    FLOATLANESOP(operator*, v[i] * o.v[i])
+    FLOATLANESOP(operator/, v[i] / o.v[i])
+    FLOATLANESOP(min, ::min(v[i], o.v[i]))
+    FLOATLANESOP(max, ::max(v[i], o.v[i]))
+    #undef FLOATLANESOP
+    floatlanes clamp0() const { return max(floatlanes(0.0f)); }
+    floatlanes abs() const { floatlanes r; loopi(4) r.v[i] = fabs(v[i]); return r; }
+    floatlanes sqrt() const { floatlanes r; loopi(4) r.v[i] = sqrtf(v[i]); return r; }
+
+    float hmin() const { return ::min(::min(v[0], v[1]), ::min(v[2], v[3])); }
+    float hmax() const { return ::max(::max(v[0], v[1]), ::max(v[2], v[3])); }
+
+    int le(const floatlanes &o) const { int mask = 0; loopi(4) if(v[i] <= o.v[i]) mask |= 1<<i; return mask; }
+    int lt(const floatlanes &o) const { int mask = 0; loopi(4) if(v[i] < o.v[i]) mask |= 1<<i; return mask; }
+#endif
+};
+
 extern bool raysphereintersect(const vec &center, float radius, const vec &o, const vec &ray, float &dist);
 extern bool rayboxintersect(const vec &b, const vec &s, const vec &o, const vec &ray, float &dist, int &orient);
 extern bool linecylinderintersect(const vec &from, const vec &to, const vec &start, const vec &end, float radius, float &dist);
@@ -49,6 +49,8 @@ extern float raycube   (const vec &o, const vec &ray,     float radius = 0, int
 extern float raycubepos(const vec &o, const vec &ray, vec &hit, float radius = 0, int mode = RAY_CLIPMAT, int size = 0);
 extern float rayfloor  (const vec &o, vec &floor, int mode = 0, float radius = 0);
 extern bool  raycubelos(const vec &o, const vec &dest, vec &hitpos);
+extern int   raycubes  (const vec *o, const vec *ray, int numrays, float *dists, vec *normals = NULL, float radius = 0, int mode = RAY_CLIPMAT);
+extern int   raycubeslos(const vec *o, const vec *dest, int numrays, uchar *visible);
 
 extern int thirdperson;
 extern bool isthirdperson();
@@ -326,11 +328,12 @@ extern uint getmapcrc();
 extern void clearmapcrc();
 
 // physics
-extern vec collidewall;
-extern bool collideinside;
-extern physent *collideplayer;
+extern THREADLOCAL vec collidewall;
+extern THREADLOCAL bool collideinside;
+extern THREADLOCAL physent *collideplayer;
 
 extern void moveplayer(physent *pl, int moveres, bool local);
+extern void moveplayers(physent **ents, int numents, int moveres, bool local);
 extern bool moveplayer(physent *pl, int moveres, bool local, int curtime);
 extern void crouchplayer(physent *pl, int moveres, bool local);
 extern bool collide(physent *d, const vec &dir = vec(0, 0, 0), float cutoff = 0.0f, bool playercol = true);
@@ -349,6 +352,8 @@ extern bool moveplatform(physent *p, const vec &dir);
 extern void updatephysstate(physent *d);
 extern void cleardynentcache();
 extern void updatedynentcache(physent *d);
+extern int finddynents(const vec &bbmin, const vec &bbmax, vector<physent *> &ents);
+extern int finddynents(const vec &o, float radius, vector<physent *> &ents);
 extern bool entinmap(dynent *d, bool avoidplayers = false);
 
 // sound
@@ -402,6 +407,7 @@ extern bool matchanim(const char *name, const char *pattern);
 // ragdoll
 
 extern void moveragdoll(dynent *d);
+extern void moveragdolls(dynent **ds, int numds);
 extern void cleanragdoll(dynent *d);
 
 // server
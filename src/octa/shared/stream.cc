@@ -462,6 +462,32 @@ const char *addpackagedir(const char *dir)
     return pf.dir;
 }
 
+#ifndef STANDALONE
+const char *determinehomedir(string &hdir) {
+#ifdef WIN32
+    copystring(hdir, "$HOME\\My Games\\OctaForge");
+#else
+#ifdef __APPLE__
+    /* SDL_GetPrefPath is nasty and doesn't allow us to omit the org... */
+    char *shdir = SDL_GetPrefPath("", "");
+    if (!shdir) {
+        return NULL;
+    } else {
+        /* We find a way around that manually */
+        const char appn[] = "OctaForge";
+        int len = strlen(shdir);
+        memcpy(hdir, shdir, len - 2);
+        memcpy(hdir + len - 2, appn, sizeof(appn));
+        SDL_free(shdir);
+    }
+#else
+    copystring(hdir, "$HOME/.octaforge");
+#endif
+#endif
+    return hdir;
+}
+#endif
+
 const char *findfile(const char *filename, const char *mode)
 {
     static string s;
@@ -819,6 +845,67 @@ struct filestream : stream
     }
 };
 
+struct memstream : stream
+{
+    vector<uchar> *data;
+    offset pos;
+    bool reading, writing;
+
+    memstream() : data(NULL), pos(0), reading(false), writing(false) {}
+    ~memstream() { close(); }
+
+    bool open(vector<uchar> &buf, const char *mode)
+    {
+        if(data) return false;
+        for(; *mode; mode++)
+        {
+            if(*mode=='r') { reading = true; break; }
+            else if(*mode=='w' || *mode=='a') { writing = true; break; }
+        }
+        if(!reading && !writing) return false;
+        data = &buf;
+        pos = writing && *mode=='a' ? buf.length() : 0;
+        if(writing && *mode=='w') buf.setsize(0);
+        return true;
+    }
+
+    void close() { data = NULL; reading = writing = false; }
+    bool end() { return !data || pos >= data->length(); }
+    offset tell() { return data ? pos : offset(-1); }
+    offset size() { return data ? offset(data->length()) : offset(-1); }
+
+    bool seek(offset off, int whence)
+    {
+        if(!data) return false;
+        switch(whence)
+        {
+            case SEEK_CUR: off += pos; break;
+            case SEEK_END: off += data->length(); break;
+        }
+        if(off < 0 || off > data->length()) return false;
+        pos = off;
+        return true;
+    }
+
+    size_t read(void *buf, size_t len)
+    {
+        if(!reading || pos >= data->length()) return 0;
+        len = min(len, size_t(data->length() - pos));
+        memcpy(buf, data->getbuf() + pos, len);
+        pos += len;
+        return len;
+    }
+
+    size_t write(const void *buf, size_t len)
+    {
+        if(!writing) return 0;
+        if(pos + offset(len) > data->length()) data->pad(int(pos + len - data->length()));
+        memcpy(data->getbuf() + pos, buf, len);
+        pos += len;
+        return len;
+    }
+};
+
 VAR(dbggz, 0, 0, 1);
 
 struct gzstream : stream
@@ -1285,6 +1372,199 @@ struct utf8stream : stream
     bool flush() { return file->flush(); }
 };
 
+#ifndef STANDALONE
+VAR(dbgreadahead, 0, 0, 1);
+
+// inflates/reads the source on a background thread into a ring of buffers so the consumer only ever parses
+struct readaheadstream : stream
+{
+    enum
+    {
+        NUMBUFS = 4,
+        BUFSIZE = 1<<16
+    };
+
+    stream *file;
+    SDL_Thread *thread;
+    SDL_mutex *lock;
+    SDL_cond *filled, *drained;
+    uchar *bufs[NUMBUFS];
+    size_t lens[NUMBUFS];
+    int head, count;
+    bool eof, quit;
+    uchar *cur;
+    size_t curpos, curlen;
+    offset pos;
+    Uint64 opened, stalled;
+
+    readaheadstream() : file(NULL), thread(NULL), lock(NULL), filled(NULL), drained(NULL), head(0), count(0), eof(false), quit(false), cur(NULL), curpos(0), curlen(0), pos(0), opened(0), stalled(0)
+    {
+        loopi(NUMBUFS) { bufs[i] = NULL; lens[i] = 0; }
+    }
+
+    ~readaheadstream()
+    {
+        close();
+    }
+
+    static int producer(void *data)
+    {
+        readaheadstream *r = (readaheadstream *)data;
+        for(;;)
+        {
+            SDL_LockMutex(r->lock);
+            while(r->count >= NUMBUFS && !r->quit) SDL_CondWait(r->drained, r->lock);
+            if(r->quit) { SDL_UnlockMutex(r->lock); break; }
+            int slot = (r->head + r->count)%NUMBUFS;
+            SDL_UnlockMutex(r->lock);
+
+            size_t len = r->file->read(r->bufs[slot], BUFSIZE);
+
+            SDL_LockMutex(r->lock);
+            r->lens[slot] = len;
+            r->count++;
+            if(len < BUFSIZE) r->eof = true;
+            SDL_CondSignal(r->filled);
+            bool done = r->eof;
+            SDL_UnlockMutex(r->lock);
+            if(done) break;
+        }
+        return 0;
+    }
+
+    bool open(stream *f, bool needclose)
+    {
+        if(file) return false;
+        lock = SDL_CreateMutex();
+        filled = SDL_CreateCond();
+        drained = SDL_CreateCond();
+        if(!lock || !filled || !drained) return false;
+        if(needclose) f->refcount = 0;
+        f->incref();
+        file = f;
+        loopi(NUMBUFS) bufs[i] = new uchar[BUFSIZE];
+        opened = SDL_GetPerformanceCounter();
+        thread = SDL_CreateThread(producer, "read-ahead", this);
+        if(!thread)
+        {
+            if(needclose) f->refcount = -1;
+            file = NULL;
+            return false;
+        }
+        return true;
+    }
+
+    void stop()
+    {
+        if(!thread) return;
+        SDL_LockMutex(lock);
+        quit = true;
+        SDL_CondSignal(drained);
+        SDL_UnlockMutex(lock);
+        SDL_WaitThread(thread, NULL);
+        thread = NULL;
+    }
+
+    void close()
+    {
+        if(file)
+        {
+            stop();
+            if(dbgreadahead)
+            {
+                double freq = SDL_GetPerformanceFrequency(), total = (SDL_GetPerformanceCounter() - opened)/freq, stall = stalled/freq;
+                conoutf(CON_DEBUG, "read-ahead: %.1f ms stalled on input, %.1f ms consuming (%d bytes)", stall*1000, (total - stall)*1000, int(pos));
+            }
+            if(file->decref()) delete file;
+            file = NULL;
+        }
+        if(lock) { SDL_DestroyMutex(lock); lock = NULL; }
+        if(filled) { SDL_DestroyCond(filled); filled = NULL; }
+        if(drained) { SDL_DestroyCond(drained); drained = NULL; }
+        loopi(NUMBUFS) DELETEA(bufs[i]);
+    }
+
+    bool nextbuf()
+    {
+        SDL_LockMutex(lock);
+        if(cur)
+        {
+            head = (head + 1)%NUMBUFS;
+            count--;
+            cur = NULL;
+            SDL_CondSignal(drained);
+        }
+        if(!count && !eof)
+        {
+            Uint64 start = SDL_GetPerformanceCounter();
+            while(!count && !eof) SDL_CondWait(filled, lock);
+            stalled += SDL_GetPerformanceCounter() - start;
+        }
+        if(count)
+        {
+            cur = bufs[head];
+            curlen = lens[head];
+            curpos = 0;
+        }
+        SDL_UnlockMutex(lock);
+        return cur && curlen > 0;
+    }
+
+    bool end() { return curpos >= curlen && eof && count <= (cur ? 1 : 0); }
+    offset tell() { return pos; }
+    offset size() { return file ? file->size() : offset(-1); }
+    uint getcrc()
+    {
+        if(!file) return 0;
+        // finish the source so the crc does not depend on how far the producer got
+        stop();
+        uchar skip[512];
+        while(!eof && file->read(skip, sizeof(skip)) == sizeof(skip));
+        eof = true;
+        return file->getcrc();
+    }
+
+    bool seek(offset off, int whence)
+    {
+        if(whence == SEEK_SET) off -= pos;
+        else if(whence != SEEK_CUR) return false;
+        if(off < 0) return false;
+        uchar skip[512];
+        while(off > 0)
+        {
+            size_t skipped = (size_t)min(off, (offset)sizeof(skip));
+            if(read(skip, skipped) != skipped) return false;
+            off -= skipped;
+        }
+        return true;
+    }
+
+    size_t read(void *buf, size_t len)
+    {
+        if(!file) return 0;
+        size_t total = 0;
+        while(len > 0)
+        {
+            if(curpos >= curlen && !nextbuf()) break;
+            size_t n = min(len, curlen - curpos);
+            memcpy((uchar *)buf + total, cur + curpos, n);
+            curpos += n;
+            total += n;
+            len -= n;
+        }
+        pos += total;
+        return total;
+    }
+
+    int getchar()
+    {
+        if(curpos >= curlen && !nextbuf()) return -1;
+        pos++;
+        return cur[curpos++];
+    }
+};
+#endif
+
 stream *openrawfile(const char *filename, const char *mode)
 {
     const char *found = findfile(filename, mode);
@@ -1320,6 +1600,24 @@ stream *opengzfile(const char *filename, const char *mode, stream *file, int lev
     return gz;
 }
 
+stream *openreadahead(stream *file, bool needclose)
+{
+    if(!file) return NULL;
+#ifndef STANDALONE
+    readaheadstream *r = new readaheadstream;
+    if(r->open(file, needclose)) return r;
+    delete r;
+#endif
+    return file;
+}
+
+stream *openmemfile(vector<uchar> &buf, const char *mode)
+{
+    memstream *mem = new memstream;
+    if(!mem->open(buf, mode)) { delete mem; return NULL; }
+    return mem;
+}
+
 stream *openutf8file(const char *filename, const char *mode, stream *file)
 {
     stream *source = file ? file : openfile(filename, mode);
@@ -33,6 +33,14 @@ typedef unsigned long long int ullong;
 #define UNUSED
 #endif
 
+#ifdef __GNUC__
+#define THREADLOCAL __thread
+#elif defined(_MSC_VER)
+#define THREADLOCAL __declspec(thread)
+#else
+#define THREADLOCAL
+#endif
+
 using ostd::swap;
 using ostd::min;
 using ostd::max;
@@ -470,6 +478,36 @@ static inline void quicksort(T *buf, int n)
     quicksort(buf, buf+n, sortless());
 }
 
+struct sortkeyless
+{
+    template<class T> bool operator()(const T &x, const T &y) const { return x.key < y.key; }
+};
+
+// stable LSD radix sort on the 64-bit key member, one byte per pass; bytes that are the same in every key are
+// skipped, small inputs fall back to insertion sort. tmp must hold n elements, returns whichever buffer ends sorted
+template<class T>
+static inline T *radixsort(T *buf, T *tmp, int n)
+{
+    if(n <= 32)
+    {
+        insertionsort(buf, n, sortkeyless());
+        return buf;
+    }
+    ullong diff = 0;
+    loopi(n) diff |= buf[i].key ^ buf[0].key;
+    for(int shift = 0; shift < 64; shift += 8)
+    {
+        if(!((diff>>shift)&0xFF)) continue;
+        int offsets[256];
+        memset(offsets, 0, sizeof(offsets));
+        loopi(n) offsets[(buf[i].key>>shift)&0xFF]++;
+        for(int i = 0, total = 0; i < 256; i++) { int count = offsets[i]; offsets[i] = total; total += count; }
+        loopi(n) tmp[offsets[(buf[i].key>>shift)&0xFF]++] = buf[i];
+        swap(buf, tmp);
+    }
+    return buf;
+}
+
 template<class T> struct isclass
 {
     template<class C> static char test(void (C::*)(void));
@@ -1310,6 +1348,7 @@ extern bool removedir(const char *path);
 extern size_t fixpackagedir(char *dir);
 extern const char *sethomedir(const char *dir);
 extern const char *addpackagedir(const char *dir);
+extern const char *determinehomedir(string &hdir);
 extern const char *findfile(const char *filename, const char *mode);
 extern bool findzipfile(const char *filename);
 extern stream *openrawfile(const char *filename, const char *mode);
@@ -1318,6 +1357,8 @@ extern stream *openfile(const char *filename, const char *mode);
 extern stream *opentempfile(const char *filename, const char *mode);
 extern stream *opengzfile(const char *filename, const char *mode, stream *file = NULL, int level = Z_BEST_COMPRESSION);
 extern stream *openutf8file(const char *filename, const char *mode, stream *file = NULL);
+extern stream *openmemfile(vector<uchar> &buf, const char *mode);
+extern stream *openreadahead(stream *file, bool needclose = true);
 extern char *loadfile(const char *fn, size_t *size, bool utf8 = true);
 extern bool listdir(const char *dir, bool rel, const char *ext, vector<char *> &files, int filter = FTYPE_FILE|FTYPE_DIR);
 extern int listfiles(const char *dir, const char *ext, vector<char *> &files, int filter = FTYPE_FILE|FTYPE_DIR,